@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * requires: liblog4c-dev, pthread
+ */
+
+/**
+ *  @file    alog.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief this file holds the asynchronous logging function definitions
+ *
+ *  The event loop formats a record into a ring slot and returns, a writer
+ *  thread passes the records on to log4c (appender file I/O). A full ring
+ *  drops the record and counts it instead of blocking a request. Without a
+ *  running writer thread records are logged synchronously.
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "alog.h"
+#include "metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/******************************************************************* GLOBALS */
+
+static s_alog_t *pLog = NULL;
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  writer thread, drains the ring and reports dropped records
+ *
+ *  @arg    void*
+ *  @return void*
+ */
+
+static void *alog_writer(void *arg) {
+
+  s_alog_t *alog = (s_alog_t *)arg;
+  s_alogrec_t *rec = NULL;
+
+  const log4c_category_t *cat = NULL;
+
+  struct timespec idle = {0, ALOG_IDLE};
+
+  unsigned long tail = 0;
+  unsigned long dropped = 0;
+  unsigned long reported = 0;
+
+  for (;;) {
+    tail = atomic_load_explicit(&alog->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&alog->head, memory_order_acquire)) {
+      dropped = atomic_load_explicit(&alog->dropped, memory_order_relaxed);
+      if ((dropped != reported) && (cat != NULL)) {
+        log4c_category_log(cat, LOG4C_PRIORITY_WARN,
+                           "log ring full, %lu records dropped",
+                           dropped - reported);
+        reported = dropped;
+      }
+      if (!atomic_load(&alog->running)) {
+        break;
+      }
+      nanosleep(&idle, NULL);
+      continue;
+    }
+
+    rec = &alog->ring[tail & alog->mask];
+    log4c_category_log(rec->cat, rec->prio, "%s", rec->msg);
+    cat = rec->cat;
+
+    atomic_store_explicit(&alog->tail, tail + 1, memory_order_release);
+  }
+
+  return NULL;
+}
+
+/**
+ *  @brief  starts the writer thread (slots: power of two)
+ *
+ *  @arg    unsigned long
+ *  @return int (0 or -1, logging stays synchronous)
+ */
+
+int alog_start(unsigned long slots) {
+
+  s_alog_t *alog = NULL;
+
+  if ((pLog != NULL) || (slots == 0) || (slots & (slots - 1))) {
+    return -1;
+  }
+
+  alog = (s_alog_t *)malloc(sizeof(s_alog_t));
+  if (alog == NULL) {
+    return -1;
+  }
+
+  alog->ring = (s_alogrec_t *)malloc(slots * sizeof(s_alogrec_t));
+  if (alog->ring == NULL) {
+    free(alog);
+    return -1;
+  }
+
+  alog->mask = slots - 1;
+  atomic_init(&alog->head, 0);
+  atomic_init(&alog->tail, 0);
+  atomic_init(&alog->dropped, 0);
+  atomic_init(&alog->running, true);
+
+  if (pthread_create(&alog->thread, NULL, alog_writer, alog) != 0) {
+    free(alog->ring);
+    free(alog);
+    return -1;
+  }
+
+  pLog = alog;
+
+  return 0;
+}
+
+/**
+ *  @brief  stops the writer thread after all queued records are written
+ *
+ *  @arg    void
+ *  @return void
+ */
+
+void alog_stop(void) {
+
+  s_alog_t *alog = pLog;
+
+  if (alog == NULL) {
+    return;
+  }
+
+  atomic_store(&alog->running, false);
+  pthread_join(alog->thread, NULL);
+
+  pLog = NULL;
+
+  free(alog->ring);
+  free(alog);
+}
+
+/**
+ *  @brief  logs a record (queued if the writer thread is running)
+ *
+ *  @arg    const log4c_category_t*, int, const char*, ...
+ *  @return void
+ */
+
+void alog_log(const log4c_category_t *cat, int prio, const char *fmt, ...) {
+
+  s_alogrec_t *rec = NULL;
+
+  unsigned long head = 0;
+
+  va_list ap;
+
+  if ((cat == NULL) || (!log4c_category_is_priority_enabled(cat, prio))) {
+    return;
+  }
+
+  va_start(ap, fmt);
+
+  if (pLog == NULL) {
+    log4c_category_vlog(cat, prio, fmt, ap);
+    va_end(ap);
+    return;
+  }
+
+  head = atomic_load_explicit(&pLog->head, memory_order_relaxed);
+
+  if (head - atomic_load_explicit(&pLog->tail, memory_order_acquire) >
+      pLog->mask) {
+    atomic_fetch_add_explicit(&pLog->dropped, 1, memory_order_relaxed);
+    metrics_inc(M_LOG_DROP);
+    va_end(ap);
+    return;
+  }
+
+  rec = &pLog->ring[head & pLog->mask];
+  rec->cat = cat;
+  rec->prio = prio;
+  vsnprintf(rec->msg, ALOG_MSGSIZE, fmt, ap);
+
+  atomic_store_explicit(&pLog->head, head + 1, memory_order_release);
+
+  va_end(ap);
+}
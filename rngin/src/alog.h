@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    alog.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief asynchronous (ring buffer) logging header file
+ */
+
+#ifndef ALOG_H_INCLUDED
+#define ALOG_H_INCLUDED
+
+/******************************************************************* INCLUDE */
+
+#include <log4c.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/******************************************************************** DEFINE */
+
+/* number of ring slots (power of two) and maximum record length */
+#define ALOG_SLOTS 2048
+#define ALOG_MSGSIZE 1024
+/* writer thread idle sleep (ns) */
+#define ALOG_IDLE 1000000
+
+/******************************************************************* TYPEDEF */
+
+typedef struct ALOGREC {
+  const log4c_category_t *cat;
+  int prio;
+  char msg[ALOG_MSGSIZE];
+} s_alogrec_t;
+
+/* single producer (event loop), single consumer (writer thread) */
+typedef struct ALOG {
+  s_alogrec_t *ring;
+  unsigned long mask;
+  atomic_ulong head;
+  atomic_ulong tail;
+  atomic_ulong dropped;
+  atomic_bool running;
+  pthread_t thread;
+} s_alog_t;
+
+/****************************************************************PROTOTYPES */
+
+int alog_start(unsigned long);
+void alog_stop(void);
+void alog_log(const log4c_category_t *, int, const char *, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif // ALOG_H_INCLUDED
@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * requires: libyaml-dev, liblog4c-dev, sqlite3
+ */
+
+/**
+ *  @file    arena.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief this file holds the request arena function definitions
+ *
+ *  All request-lifetime memory is taken from the active arena (see
+ *  set_arena) and given back at once by reset_arena. Without an active
+ *  arena the allocators fall back to the C library, as do arena_realloc
+ *  and arena_free for memory the active arena does not own (allocated
+ *  at startup, by a library or before set_arena).
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "functions.h"
+
+/******************************************************************** DEFINE */
+
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+#define BLK_HDR ALIGN_UP(sizeof(s_arenablk_t))
+#define BLK_DATA(b) ((char *)(b) + BLK_HDR)
+
+/******************************************************************* GLOBALS */
+
+static s_arena_t *pA = NULL;
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  allocates a new arena block
+ *
+ *  @arg    size_t
+ *  @return s_arenablk_t*
+ */
+
+static s_arenablk_t *new_arenablk(size_t size) {
+
+  s_arenablk_t *blk = (s_arenablk_t *)malloc(BLK_HDR + size);
+
+  if (blk == NULL) {
+    LOG4ERROR(pL, "no memory");
+    return blk;
+  }
+
+  blk->next = NULL;
+  blk->size = size;
+  blk->used = 0;
+
+  return blk;
+}
+
+/**
+ *  @brief  checks if ptr was allocated from the active arena
+ *
+ *  @arg    const void*
+ *  @return bool
+ */
+
+static bool arena_owns(const void *ptr) {
+
+  const char *p = (const char *)ptr;
+  s_arenablk_t *blk = NULL;
+
+  for (blk = pA->head; blk != NULL; blk = blk->next) {
+    if ((p > BLK_DATA(blk)) && (p <= BLK_DATA(blk) + blk->used)) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+ *  @brief  creates an arena with an initial block of blksize bytes
+ *
+ *  @arg    size_t
+ *  @return s_arena_t*
+ */
+
+s_arena_t *new_arena(size_t blksize) {
+
+  s_arena_t *arena = (s_arena_t *)malloc(sizeof(s_arena_t));
+
+  if (arena == NULL) {
+    LOG4ERROR(pL, "no memory");
+    return arena;
+  }
+
+  arena->blksize = ALIGN_UP(blksize);
+  arena->first = new_arenablk(arena->blksize);
+  arena->head = arena->first;
+  arena->allocs = 0;
+  arena->blocks = 0;
+  arena->bytes = 0;
+
+  if (arena->first == NULL) {
+    free(arena);
+    return NULL;
+  }
+
+  return arena;
+}
+
+/**
+ *  @brief  releases all arena memory except the initial block
+ *
+ *  @arg    s_arena_t*
+ *  @return void
+ */
+
+void reset_arena(s_arena_t *arena) {
+
+  s_arenablk_t *blk = NULL;
+
+  if (arena == NULL) {
+    return;
+  }
+
+  LOG4DEBUG(pL, "arena reset: %lu allocations, %zu bytes, %lu extra blocks",
+            arena->allocs, arena->bytes, arena->blocks);
+
+  while (arena->head != arena->first) {
+    blk = arena->head;
+    arena->head = blk->next;
+    free(blk);
+  }
+
+  arena->first->used = 0;
+  arena->allocs = 0;
+  arena->blocks = 0;
+  arena->bytes = 0;
+}
+
+/**
+ *  @brief  frees arena and all its blocks
+ *
+ *  @arg    s_arena_t*
+ *  @return void
+ */
+
+void delete_arena(s_arena_t *arena) {
+
+  s_arenablk_t *blk = NULL;
+
+  if (arena == NULL) {
+    return;
+  }
+
+  if (pA == arena) {
+    pA = NULL;
+  }
+
+  while (arena->head != NULL) {
+    blk = arena->head;
+    arena->head = blk->next;
+    free(blk);
+  }
+
+  free(arena);
+}
+
+/**
+ *  @brief  selects the arena used by arena_* allocators (NULL: libc)
+ *
+ *  @arg    s_arena_t*
+ *  @return void
+ */
+
+void set_arena(s_arena_t *arena) { pA = arena; }
+
+/**
+ *  @brief  allocates memory from the active arena
+ *
+ *  each chunk is preceded by its size, so arena_realloc can copy it
+ *
+ *  @arg    size_t
+ *  @return void*
+ */
+
+void *arena_malloc(size_t size) {
+
+  s_arenablk_t *blk = NULL;
+  size_t need = 0;
+  char *ptr = NULL;
+
+  if (pA == NULL) {
+    return malloc(size);
+  }
+
+  need = ARENA_ALIGN + ALIGN_UP(size);
+  blk = pA->head;
+
+  if (blk->used + need > blk->size) {
+    blk = new_arenablk(need > pA->blksize ? need : pA->blksize);
+    if (blk == NULL) {
+      return NULL;
+    }
+    blk->next = pA->head;
+    pA->head = blk;
+    pA->blocks++;
+  }
+
+  ptr = BLK_DATA(blk) + blk->used;
+  *(size_t *)ptr = size;
+  blk->used += need;
+
+  pA->allocs++;
+  pA->bytes += size;
+
+  return ptr + ARENA_ALIGN;
+}
+
+/**
+ *  @brief  allocates zeroed memory from the active arena
+ *
+ *  @arg    size_t, size_t
+ *  @return void*
+ */
+
+void *arena_calloc(size_t nmemb, size_t size) {
+
+  void *ptr = NULL;
+
+  if (pA == NULL) {
+    return calloc(nmemb, size);
+  }
+
+  if ((size != 0) && (nmemb > ((size_t)-1) / size)) {
+    return NULL;
+  }
+
+  ptr = arena_malloc(nmemb * size);
+  if (ptr != NULL) {
+    memset(ptr, 0, nmemb * size);
+  }
+
+  return ptr;
+}
+
+/**
+ *  @brief  resizes arena memory (grows in place if it is the last chunk),
+ *          memory not owned by the arena is resized by the C library
+ *
+ *  @arg    void*, size_t
+ *  @return void*
+ */
+
+void *arena_realloc(void *ptr, size_t size) {
+
+  s_arenablk_t *blk = NULL;
+  size_t *hdr = NULL;
+  size_t old = 0;
+  void *res = NULL;
+
+  if (ptr == NULL) {
+    return arena_malloc(size);
+  }
+
+  if ((pA == NULL) || !arena_owns(ptr)) {
+    return realloc(ptr, size);
+  }
+
+  hdr = (size_t *)((char *)ptr - ARENA_ALIGN);
+  old = *hdr;
+  blk = pA->head;
+
+  /* last chunk of the current block: just move the bump pointer */
+  if ((char *)ptr + ALIGN_UP(old) == BLK_DATA(blk) + blk->used) {
+    if (blk->used - ALIGN_UP(old) + ALIGN_UP(size) <= blk->size) {
+      blk->used = blk->used - ALIGN_UP(old) + ALIGN_UP(size);
+      pA->bytes += size - old;
+      *hdr = size;
+      return ptr;
+    }
+  }
+
+  res = arena_malloc(size);
+  if (res != NULL) {
+    memcpy(res, ptr, old < size ? old : size);
+  }
+
+  return res;
+}
+
+/**
+ *  @brief  frees memory (no-op for arena memory, released on reset)
+ *
+ *  @arg    void*
+ *  @return void
+ */
+
+void arena_free(void *ptr) {
+
+  if ((ptr != NULL) && ((pA == NULL) || !arena_owns(ptr))) {
+    free(ptr);
+  }
+}
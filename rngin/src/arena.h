@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    arena.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief request arena (bump allocator) header file
+ */
+
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+/******************************************************************* INCLUDE */
+
+#include <stddef.h>
+
+/******************************************************************** DEFINE */
+
+#define ARENA_ALIGN 16
+#define ARENA_BLKSIZE 131072
+
+/******************************************************************* TYPEDEF */
+
+typedef struct ARENABLK {
+  struct ARENABLK *next;
+  size_t size;
+  size_t used;
+} s_arenablk_t;
+
+typedef struct ARENA {
+  s_arenablk_t *head;
+  s_arenablk_t *first;
+  size_t blksize;
+  /* statistics (since last reset) */
+  unsigned long allocs;
+  unsigned long blocks;
+  size_t bytes;
+} s_arena_t;
+
+/****************************************************************PROTOTYPES */
+
+s_arena_t *new_arena(size_t);
+void reset_arena(s_arena_t *);
+void delete_arena(s_arena_t *);
+void set_arena(s_arena_t *);
+
+void *arena_malloc(size_t);
+void *arena_calloc(size_t, size_t);
+void *arena_realloc(void *, size_t);
+void arena_free(void *);
+
+#endif // ARENA_H_INCLUDED
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    cache.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief this file holds the transaction response cache definitions
+ *
+ *  SIP retransmissions and http_client retries repeat a request with the
+ *  same tindex/tlabel. Responses are kept for a short time, keyed by the
+ *  transaction id and a hash of ruri and next, and a repeated request is
+ *  answered with the same bytes. The cache is direct mapped, a new entry
+ *  replaces whatever was in its slot.
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "functions.h"
+#include "cache.h"
+
+/******************************************************************* GLOBALS */
+
+static s_centry_t *pCache = NULL;
+/* time to live (us) */
+static double ttl = 0;
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  FNV-1a hash of a string (NULL: empty), continued from hash
+ *
+ *  @arg    unsigned long, const char*
+ *  @return unsigned long
+ */
+
+static unsigned long hash_string(unsigned long hash, const char *str) {
+
+  const unsigned char *p = (const unsigned char *)str;
+
+  while ((p != NULL) && (*p != '\0')) {
+    hash = (hash ^ *p++) * 0x100000001b3UL;
+  }
+
+  /* separator, ruri "ab" next "c" differs from ruri "a" next "bc" */
+  return (hash ^ 0xff) * 0x100000001b3UL;
+}
+
+/**
+ *  @brief  FNV-1a hash of a buffer, continued from hash
+ *
+ *  @arg    unsigned long, const char*, size_t
+ *  @return unsigned long
+ */
+
+static unsigned long hash_block(unsigned long hash, const char *buf,
+                                size_t len) {
+
+  const unsigned char *p = (const unsigned char *)buf;
+  size_t i;
+
+  for (i = 0; (p != NULL) && (i < len); i++) {
+    hash = (hash ^ p[i]) * 0x100000001b3UL;
+  }
+
+  return hash;
+}
+
+/**
+ *  @brief  slot of a request
+ *
+ *  @arg    int, s_input_t*
+ *  @return s_centry_t*
+ */
+
+static s_centry_t *get_slot(int type, s_input_t *in) {
+
+  unsigned long key = in->hash;
+
+  key ^= ((unsigned long)in->tindex << 32) | in->tlabel;
+  key = (key ^ (unsigned long)type) * 0x9e3779b97f4a7c15UL;
+
+  return &pCache[(key >> 32) & (CACHE_SLOTS - 1)];
+}
+
+/**
+ *  @brief  allocates the cache (ttl in ms, 0 disables caching)
+ *
+ *  @arg    long
+ *  @return int (0 or -1)
+ */
+
+int cache_start(long ms) {
+
+  if ((pCache != NULL) || (ms <= 0)) {
+    return 0;
+  }
+
+  pCache = (s_centry_t *)calloc(CACHE_SLOTS, sizeof(s_centry_t));
+  if (pCache == NULL) {
+    LOG4ERROR(pL, "could not allocate response cache");
+    return -1;
+  }
+  ttl = ms * 1e3;
+
+  LOG4INFO(pL, "caching responses for %ld ms", ms);
+
+  return 0;
+}
+
+/**
+ *  @brief  frees the cache
+ *
+ *  @arg    void
+ *  @return void
+ */
+
+void cache_stop(void) {
+
+  int i;
+
+  if (pCache == NULL) {
+    return;
+  }
+
+  for (i = 0; i < CACHE_SLOTS; i++) {
+    free(pCache[i].data);
+  }
+  free(pCache);
+  pCache = NULL;
+}
+
+/**
+ *  @brief  appends the cached response of a request to io, the key is
+ *          kept in the request for cache_put; a request without tindex and
+ *          tlabel is neither looked up nor cached, it could not be told
+ *          apart from other transactions
+ *
+ *  @arg    int, s_input_t*, struct mbuf*
+ *  @return bool (TRUE: cached response appended)
+ */
+
+bool cache_get(int type, s_input_t *in, struct mbuf *io) {
+
+  s_centry_t *entry = NULL;
+
+  if ((pCache == NULL) || ((in->tindex == 0) && (in->tlabel == 0))) {
+    return FALSE;
+  }
+
+  /* a reused tindex/tlabel pair (e.g. after a restart of the ESRP) comes
+     with another SIP message (Call-ID, CSeq, From, To) */
+  in->hash = hash_string(hash_string(0xcbf29ce484222325UL, in->ruri), in->next);
+  in->hash = hash_block(in->hash, in->shdr, in->shdrlen);
+  entry = get_slot(type, in);
+
+  if ((entry->len == 0) || (entry->hash != in->hash) ||
+      (entry->tindex != in->tindex) || (entry->tlabel != in->tlabel) ||
+      (entry->type != type) || (entry->expires < get_usec())) {
+    metrics_inc(M_CACHE_MISS);
+    return FALSE;
+  }
+
+  mbuf_append(io, entry->data, entry->len);
+  in->outcome = entry->outcome;
+  metrics_inc(M_CACHE_HIT);
+
+  LOG4DEBUG(pL, "cached response [%u:%u]", in->tindex, in->tlabel);
+
+  return TRUE;
+}
+
+/**
+ *  @brief  caches the response of a request looked up by cache_get,
+ *          error and deadline (fallback) responses are not cached, a retry
+ *          gets a full evaluation
+ *
+ *  @arg    int, s_input_t*, const char*, size_t
+ *  @return void
+ */
+
+void cache_put(int type, s_input_t *in, const char *buf, size_t len) {
+
+  s_centry_t *entry = NULL;
+  char *data = NULL;
+
+  if ((pCache == NULL) || (in->hash == 0) || (len == 0) ||
+      (in->outcome == M_OUT_ERROR) || (in->outcome == M_OUT_FALLBACK)) {
+    return;
+  }
+
+  entry = get_slot(type, in);
+
+  if (entry->size < len) {
+    data = (char *)realloc(entry->data, len);
+    if (data == NULL) {
+      LOG4ERROR(pL, "could not allocate response cache entry");
+      return;
+    }
+    entry->data = data;
+    entry->size = len;
+  }
+
+  memcpy(entry->data, buf, len);
+  entry->len = len;
+  entry->hash = in->hash;
+  entry->tindex = in->tindex;
+  entry->tlabel = in->tlabel;
+  entry->type = type;
+  entry->outcome = in->outcome;
+  entry->expires = get_usec() + ttl;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    cache.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief transaction response cache header file
+ */
+
+#ifndef CACHE_H_INCLUDED
+#define CACHE_H_INCLUDED
+
+/******************************************************************* INCLUDE */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/******************************************************************** DEFINE */
+
+/* number of cache slots (power of two) */
+#define CACHE_SLOTS 4096
+
+/* response encodings, cached separately */
+#define CACHE_JSON 0
+#define CACHE_BIN 1
+
+/******************************************************************* TYPEDEF */
+
+typedef struct CENTRY {
+  unsigned long hash;
+  unsigned int tindex;
+  unsigned int tlabel;
+  int type;
+  int outcome;
+  /* expiry (monotonic us) */
+  double expires;
+  char *data;
+  size_t len;
+  size_t size;
+} s_centry_t;
+
+/****************************************************************PROTOTYPES */
+
+struct INPUT;
+struct mbuf;
+
+int cache_start(long);
+void cache_stop(void);
+
+bool cache_get(int, struct INPUT *, struct mbuf *);
+void cache_put(int, struct INPUT *, const char *, size_t);
+
+#endif // CACHE_H_INCLUDED
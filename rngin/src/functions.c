@@ -63,7 +63,7 @@ unsigned char *base64_encode(const unsigned char *src, size_t len,
   olen++;                 /* nul termination */
   if (olen < len)
     return NULL; /* integer overflow */
-  out = malloc(olen);
+  out = arena_malloc(olen);
   if (out == NULL)
     return NULL;
 
@@ -138,7 +138,7 @@ unsigned char *base64_decode(const unsigned char *src, size_t len,
     return NULL;
 
   olen = count / 4 * 3;
-  pos = out = malloc(olen);
+  pos = out = arena_malloc(olen);
   if (out == NULL)
     return NULL;
 
@@ -164,7 +164,7 @@ unsigned char *base64_decode(const unsigned char *src, size_t len,
           pos -= 2;
         else {
           /* Invalid padding */
-          free(out);
+          arena_free(out);
           return NULL;
         }
         break;
@@ -174,7 +174,7 @@ unsigned char *base64_decode(const unsigned char *src, size_t len,
 
   *out_len = pos - out;
 
-  out = realloc(out, *out_len + 2);
+  out = arena_realloc(out, *out_len + 2);
   out[*out_len] = '\r';
   out[*out_len + 1] = '\n';
 
@@ -195,7 +195,7 @@ unsigned char *base64_decode(const unsigned char *src, size_t len,
 void delete_string(char *ptr) {
 
   if (ptr != NULL)
-    free(ptr);
+    arena_free(ptr);
 
   ptr = NULL;
 
@@ -211,7 +211,7 @@ void delete_string(char *ptr) {
 
 char *copy_string(const char *src, size_t len) {
 
-  char *dst = (char *)malloc((len + 1) * sizeof(char));
+  char *dst = (char *)arena_malloc((len + 1) * sizeof(char));
 
   if (dst == NULL) {
     LOG4ERROR(pL, "no memory");
@@ -224,6 +224,22 @@ char *copy_string(const char *src, size_t len) {
   return dst;
 }
 
+/**
+ *  @brief  monotonic clock in microseconds
+ *
+ *  @arg    void
+ *  @return double
+ */
+
+double get_usec(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
 /**
  *  @brief  rallocate memory and replace string
  *
@@ -233,7 +249,7 @@ char *copy_string(const char *src, size_t len) {
 
 char *replace_string(char *src, char *new, size_t len) {
 
-  char *dst = (char *)realloc(src, (len + 1) * sizeof(char));
+  char *dst = (char *)arena_realloc(src, (len + 1) * sizeof(char));
 
   if (dst == NULL) {
     LOG4ERROR(pL, "no memory");
@@ -269,10 +285,10 @@ char *extract_sipuri(const char *str) {
     len = strlen(TEL_URI_SCHEME);
   }
 
-  LOG4DEBUG(pL, "URI  (in): [%s] %ld", str, strlen(str));
+  LOG4DEBUG(pL, "URI  (in): [%s]", str);
 
   if (len > 0) {
-    for (i = len; i < strlen(str); i++) {
+    for (i = len; ptr[i] != '\0'; i++) {
       if ((ptr[i] == ':') || (ptr[i] == '>')) {
         break;
       }
@@ -280,11 +296,81 @@ char *extract_sipuri(const char *str) {
     ret = copy_string(ptr, i);
   }
 
-  LOG4DEBUG(pL, "URI (out): [%s] %ld", ret, i);
+  LOG4DEBUG(pL, "URI (out): [%s] %zu", ret, i);
 
   return ret;
 }
 
+/**
+ *  @brief  parses a uri into its components (scheme, user, host, params)
+ *
+ *  @arg    s_uri_t*, const char*
+ *  @return void
+ */
+
+void parse_uri(s_uri_t *uri, const char *str) {
+
+  const char *ptr = NULL;
+  size_t len = 0;
+
+  memset(uri, 0, sizeof(s_uri_t));
+  uri->raw = str;
+
+  if (str == NULL) {
+    return;
+  }
+
+  uri->uri = extract_sipuri(str);
+  if (uri->uri == NULL) {
+    return;
+  }
+
+  /* extract_sipuri returns the scheme including its colon */
+  ptr = uri->uri;
+  len = strcspn(ptr, COLON);
+  uri->scheme = copy_string(ptr, len);
+  ptr += len + 1;
+
+  len = strcspn(ptr, "@;?");
+  if (ptr[len] == '@') {
+    uri->user = copy_string(ptr, len);
+    ptr += len + 1;
+  }
+
+  len = strcspn(ptr, ";?");
+  if (len > 0) {
+    uri->host = copy_string(ptr, len);
+  }
+  ptr += len;
+
+  if (*ptr == ';') {
+    ptr++;
+    uri->params = copy_string(ptr, strcspn(ptr, "?"));
+  }
+
+  LOG4DEBUG(pL, "URI [%s] => [%s] [%s] [%s] [%s]", uri->uri, uri->scheme,
+            uri->user ? uri->user : "", uri->host ? uri->host : "",
+            uri->params ? uri->params : "");
+}
+
+/**
+ *  @brief  parses the request uris (ruri, next, From, To) once, all
+ *          conditions read them from the context
+ *
+ *  @arg    s_input_t*, s_siphdr_t*
+ *  @return void
+ */
+
+void parse_context(s_input_t *request, s_siphdr_t *sipheader) {
+
+  s_context_t *ctx = &request->ctx;
+
+  parse_uri(&ctx->ruri, request->ruri);
+  parse_uri(&ctx->next, request->next);
+  parse_uri(&ctx->from, get_sipvalue(sipheader, FROM));
+  parse_uri(&ctx->to, get_sipvalue(sipheader, TO));
+}
+
 /**
  *  @brief  removes whitespace that my occur in header name / value
  *
@@ -365,7 +451,7 @@ char *parse_string(char *val, size_t len, int n) {
     return NULL;
   }
 
-  str = (char *)malloc(len * sizeof(char));
+  str = (char *)arena_malloc(len * sizeof(char));
   if (str == NULL) {
     LOG4ERROR(pL, "no memory");
     return NULL;
@@ -379,7 +465,7 @@ char *parse_string(char *val, size_t len, int n) {
   ptr = copy_string(str, strlen(str));
 
   /* cleanup */
-  free(str);
+  arena_free(str);
 
   LOG4DEBUG(pL, "[%d]\t[%s]", n, ptr);
 
@@ -420,7 +506,7 @@ int parse_integer(char *val, int n) {
 
 s_hdr_t **new_list(s_hdr_t **list, int i) {
 
-  list = (s_hdr_t **)realloc(list, (i + 1) * sizeof(s_hdr_t *));
+  list = (s_hdr_t **)arena_realloc(list, (i + 1) * sizeof(s_hdr_t *));
 
   if (list == NULL) {
     LOG4ERROR(pL, "no memory");
@@ -453,7 +539,7 @@ void init_list(s_hdr_t *ptr) {
 
 s_hdr_t *new_listitem(void) {
 
-  s_hdr_t *listitem = (s_hdr_t *)malloc(sizeof(s_hdr_t));
+  s_hdr_t *listitem = (s_hdr_t *)arena_malloc(sizeof(s_hdr_t));
 
   if (listitem == NULL) {
     LOG4ERROR(pL, "no memory");
@@ -477,14 +563,14 @@ void delete_list(s_hdrlist_t *list) {
     for (i = 0; i < list->count; i++) {
       ptr = list->header[i];
       LOG4DEBUG(pL, "DELETING [%s] [%s]", ptr->name, ptr->value);
-      free(ptr->name);
-      free(ptr->value);
-      free(ptr);
+      arena_free(ptr->name);
+      arena_free(ptr->value);
+      arena_free(ptr);
       ptr = NULL;
     }
 
-    free(list->header);
-    free(list);
+    arena_free(list->header);
+    arena_free(list);
     list = NULL;
   }
 
@@ -500,7 +586,7 @@ void delete_list(s_hdrlist_t *list) {
 
 s_query_t *new_query(void) {
 
-  s_query_t *ptr = (s_query_t *)malloc(sizeof(s_query_t));
+  s_query_t *ptr = (s_query_t *)arena_malloc(sizeof(s_query_t));
 
   if (ptr == NULL) {
     LOG4ERROR(pL, "no memory");
@@ -540,10 +626,10 @@ void delete_query(s_query_t *ptr) {
     ptr->max = 0;
     ptr->length = 0;
     if (ptr->state != NULL) {
-      free(ptr->state);
+      arena_free(ptr->state);
       ptr->state = NULL;
     }
-    free(ptr);
+    arena_free(ptr);
     ptr = NULL;
   }
 
@@ -565,15 +651,15 @@ int remove_list_hdr(s_hdrlist_t *list) {
     for (i = 0; i < list->count; i++) {
       ptr = list->header[i];
       LOG4DEBUG(pL, "DELETING [%s] [%s]", ptr->name, ptr->value);
-      free(ptr->name);
-      free(ptr->value);
-      free(ptr);
+      arena_free(ptr->name);
+      arena_free(ptr->value);
+      arena_free(ptr);
       ptr = NULL;
     }
   }
 
   list->count = 0;
-  free(list->header);
+  arena_free(list->header);
   list->header = NULL;
 
   return i;
@@ -619,114 +705,219 @@ int append_list_hdr(s_hdrlist_t *phdr, const char *name, const char *value) {
 }
 
 /**
- *  @brief  parses CRLF separated header list
+ *  @brief  FNV-1a hash of a header name, case insensitive
  *
- *  @arg    const char*, const char*
- *  @return s_hdrlist_t*
+ *  @arg    const char*
+ *  @return unsigned int
+ */
+
+static unsigned int hash_sipname(const char *name) {
+
+  unsigned int hash = 2166136261u;
+
+  for (; *name; name++) {
+    hash ^= (unsigned char)tolower((unsigned char)*name);
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/**
+ *  @brief  adds header i to the index, after the headers of the same name
+ *
+ *  @arg    s_siphdr_t*, int
+ *  @return void
+ */
+
+static void index_sipheader(s_siphdr_t *phdr, int i) {
+
+  unsigned int hash = phdr->hash[i];
+  unsigned int k = hash & phdr->mask;
+  int j;
+
+  while ((j = phdr->first[k]) >= 0) {
+    if ((phdr->hash[j] == hash) &&
+        (strcasecmp(phdr->list.header[j]->name, phdr->list.header[i]->name) ==
+         0)) {
+      phdr->next[phdr->last[k]] = i;
+      phdr->last[k] = i;
+      return;
+    }
+    k = (k + 1) & phdr->mask;
+  }
+
+  phdr->first[k] = i;
+  phdr->last[k] = i;
+}
+
+/**
+ *  @brief  removes trailing whitespace of a header value ending at vend
+ *
+ *  @arg    s_hdr_t*, char*
+ *  @return char* (new end)
+ */
+
+static char *trim_sipvalue(s_hdr_t *item, char *vend) {
+
+  while ((vend > item->value) && isspace((unsigned char)*(vend - 1))) {
+    vend--;
+  }
+
+  return vend;
+}
+
+/**
+ *  @brief  parses a sip header block into an index (tokenizes it in place)
+ *
+ *  lines of any length; names are case insensitive, compact names are given
+ *  in long form; folded lines (leading SP/HT) continue the value, joined by
+ *  one space; lines without a valid name are skipped; an empty line after
+ *  the first header ends the block (message body); repeated headers are
+ *  chained in message order (next). Names and values point into msg
+ *  (writable up to msg[len]); the index is a single allocation, release it
+ *  with arena_free()
+ *
+ *  @arg    char*, size_t
+ *  @return s_siphdr_t*
  */
 
-s_hdrlist_t *parse_list_crlf(const char *list, const char *hsep) {
+s_siphdr_t *parse_sipheader(char *msg, size_t len) {
 
   char *line = NULL;
+  char *eol = NULL;
+  char *sep = NULL;
   char *end = NULL;
-  char *tmp = NULL;
-  char *buf = NULL;
-  char *trim = NULL;
-  
-  int i = 0;
-  int jmp = 0;
+  char *ptr = NULL;
+  char *vend = NULL;
+
+  unsigned int slots = 2;
+  int max = 1;
   int count = 0;
+  int i;
 
-  s_hdrlist_t *phdr = NULL;
-  s_hdr_t **plist = NULL;
+  s_siphdr_t *phdr = NULL;
+  s_hdr_t *pitem = NULL;
 
-  size_t len = 0;
+  size_t tlen = 0;
 
-  if (list == NULL) {
-    LOG4WARN(pL, "no list content");
+  if (msg == NULL) {
+    LOG4WARN(pL, "no sip header");
     return phdr;
   }
 
-  phdr = (s_hdrlist_t *)malloc(sizeof(s_hdrlist_t));
+  end = msg + len;
+
+  /* upper bound of header lines, sizes the one and only allocation */
+  for (ptr = msg; (ptr = memchr(ptr, SEP_CRLF, end - ptr)) != NULL; ptr++) {
+    max++;
+  }
+  while (slots < 2 * (unsigned int)max) {
+    slots <<= 1;
+  }
+
+  phdr = (s_siphdr_t *)arena_malloc(
+      sizeof(s_siphdr_t) +
+      max * (sizeof(s_hdr_t *) + sizeof(s_hdr_t) + sizeof(unsigned int) +
+             sizeof(int)) +
+      2 * slots * sizeof(int));
   if (phdr == NULL) {
     LOG4ERROR(pL, "no memory");
     return phdr;
   }
 
-  while (*list) {
-    /* check line length and line end */
-    for (i = 0; i < MAX_HDR_LINE; i++) {
-      /* Seach for a newline */
-      if (list[i]) {
-        if ('\r' == list[i]) {
-          jmp = 2;
-          break;
-        }
-      }
+  phdr->list.header = (s_hdr_t **)(phdr + 1);
+  pitem = (s_hdr_t *)(phdr->list.header + max);
+  phdr->hash = (unsigned int *)(pitem + max);
+  phdr->next = (int *)(phdr->hash + max);
+  phdr->first = phdr->next + max;
+  phdr->last = phdr->first + slots;
+  phdr->mask = slots - 1;
+  for (i = 0; i < (int)slots; i++) {
+    phdr->first[i] = -1;
+  }
+
+  line = msg;
+  while ((line < end) && (*line)) {
+    eol = memchr(line, SEP_CRLF, end - line);
+    if (eol == NULL) {
+      eol = end;
     }
 
-    if (i == MAX_HDR_LINE) {
-      LOG4WARN(pL, "list line exceeds maximum or wrong separator");
-      break;
+    ptr = line;
+    line = eol + 1;
+
+    if ((eol > ptr) && (*(eol - 1) == '\r')) {
+      eol--;
     }
-    
-    if (NULL == (line = calloc(i + 1, sizeof(char)))) {
-      LOG4ERROR(pL, "no memory");
-      break;
+
+    /* folded line, the value moves up over the line break */
+    if ((eol > ptr) && ((*ptr == ' ') || (*ptr == '\t'))) {
+      while ((ptr < eol) && isspace((unsigned char)*ptr)) {
+        ptr++;
+      }
+      if ((vend != NULL) && (ptr < eol)) {
+        vend = trim_sipvalue(pitem - 1, vend);
+        if (vend > pitem[-1].value) {
+          *vend++ = ' ';
+        }
+        memmove(vend, ptr, eol - ptr);
+        vend += eol - ptr;
+      }
+      continue;
     }
 
-    memcpy(line, list, i);
+    if (vend != NULL) {
+      *trim_sipvalue(pitem - 1, vend) = '\0';
+      vend = NULL;
+    }
 
-    /* check for valid separator */
-    if (strstr(line, hsep) == NULL) {
-      LOG4WARN(pL, "skipping header line with wrong seperator [%s]", line);
-      list = list + (i + jmp);
-      free(line);
+    /* empty line: skipped before the first header, body after it */
+    if (eol == ptr) {
+      if (count > 0) {
+        break;
+      }
       continue;
     }
 
-    LOG4DEBUG(pL, "[%d]\t[%s]", count, line);
-
-    tmp = line;
-    plist = new_list(plist, count);
-    if (plist == NULL) {
-      LOG4ERROR(pL, "no memory");
-      count = 0;
-      plist = NULL;
-      break;
+    /* name: a token before the colon (request line, garbage: skipped) */
+    sep = memchr(ptr, ':', eol - ptr);
+    if (sep == NULL) {
+      LOG4WARN(pL, "skipping sip header line without name [%.*s]",
+               (int)(eol - ptr), ptr);
+      continue;
+    }
+    *sep = '\0';
+    ptr = trim_string(ptr, &tlen);
+    if ((ptr == NULL) || (ptr[strcspn(ptr, " \t")] != '\0')) {
+      LOG4WARN(pL, "skipping sip header line with invalid name [%s]",
+               ptr ? ptr : "");
+      continue;
     }
-    plist[count] = new_listitem();
-    while (*line) {
-      end = strstr(line, hsep);
 
-      if (end) {
-        len = (size_t)(end - line);
-        end += strlen(hsep);
-        buf = copy_string(line, len);
-        trim = trim_string(buf, &len);
-        plist[count]->name = copy_string(trim, len);
-        free(buf);
-        LOG4DEBUG(pL, "-\t[%s]", plist[count]->name);
-      } else {
-        len = strlen(line);
-        end = line + len;
-        buf = copy_string(line, len);
-        trim = trim_string(buf, &len);
-        plist[count]->value = copy_string(trim, len);
-        free(buf);
-        LOG4DEBUG(pL, "-\t[%s]", plist[count]->value);
-      }
-      line = end;
+    pitem->name = (char *)get_sipname(ptr);
+    for (ptr = sep + 1; (ptr < eol) && isspace((unsigned char)*ptr); ptr++) {
     }
+    pitem->value = ptr;
+    vend = eol;
+
+    phdr->list.header[count] = pitem++;
+    phdr->hash[count] = hash_sipname(phdr->list.header[count]->name);
+    phdr->next[count] = -1;
+    index_sipheader(phdr, count);
     count++;
-    list = list + (i + jmp);
+  }
 
-    /*cleanup */
-    free(tmp);
+  if (vend != NULL) {
+    *trim_sipvalue(pitem - 1, vend) = '\0';
   }
 
-  phdr->count = count;
-  phdr->header = plist;
+  phdr->list.count = count;
+
+  for (i = 0; i < count; i++) {
+    LOG4DEBUG(pL, "[%d]\t[%s] [%s]", i, phdr->list.header[i]->name,
+              phdr->list.header[i]->value);
+  }
 
   return phdr;
 }
@@ -758,7 +949,7 @@ s_hdrlist_t *parse_list_comma(const char *value, const char *hsep) {
     return phdr;
   }
 
-  phdr = (s_hdrlist_t *)malloc(sizeof(s_hdrlist_t));
+  phdr = (s_hdrlist_t *)arena_malloc(sizeof(s_hdrlist_t));
   if (phdr == NULL) {
     LOG4ERROR(pL, "no memory");
     return phdr;
@@ -811,14 +1002,14 @@ s_hdrlist_t *parse_list_comma(const char *value, const char *hsep) {
     ptr = strtok(NULL, SEP_COMMA);
 
     /*cleanup */
-    free(tmp);
+    arena_free(tmp);
   }
 
   phdr->count = count;
   phdr->header = plist;
 
   /* cleanup */
-  free(cpy);
+  arena_free(cpy);
 
   return phdr;
 }
@@ -832,7 +1023,7 @@ s_hdrlist_t *parse_list_comma(const char *value, const char *hsep) {
 
 s_rule_t **new_rule(s_rule_t **rule, int i) {
 
-  rule = (s_rule_t **)realloc(rule, (i + 1) * sizeof(s_rule_t *));
+  rule = (s_rule_t **)arena_realloc(rule, (i + 1) * sizeof(s_rule_t *));
 
   if (rule == NULL) {
     LOG4ERROR(pL, "no memory");
@@ -850,7 +1041,7 @@ s_rule_t **new_rule(s_rule_t **rule, int i) {
 
 s_queue_t **new_queue(s_queue_t **queue, int i) {
 
-  queue = (s_queue_t **)realloc(queue, (i + 1) * sizeof(s_queue_t *));
+  queue = (s_queue_t **)arena_realloc(queue, (i + 1) * sizeof(s_queue_t *));
 
   if (queue == NULL) {
     LOG4ERROR(pL, "no memory");
@@ -890,15 +1081,15 @@ void delete_queue(s_quelist_t *queues) {
     for (i = 0; i < queues->count; i++) {
       ptr = queues->queue[i];
       LOG4DEBUG(pL, "DELETING QUEUE [%s]", ptr->uri);
-      free(ptr->uri);
-      free(ptr->state);
-      free(ptr->size);
-      free(ptr);
+      arena_free(ptr->uri);
+      arena_free(ptr->state);
+      arena_free(ptr->size);
+      arena_free(ptr);
       ptr = NULL;
     }
 
-    free(queues->queue);
-    free(queues);
+    arena_free(queues->queue);
+    arena_free(queues);
     queues = NULL;
   }
 
@@ -914,7 +1105,7 @@ void delete_queue(s_quelist_t *queues) {
 
 s_rule_t *new_ruleitem(void) {
 
-  s_rule_t *ruleitem = (s_rule_t *)malloc(sizeof(s_rule_t));
+  s_rule_t *ruleitem = (s_rule_t *)arena_malloc(sizeof(s_rule_t));
 
   if (ruleitem == NULL) {
     LOG4ERROR(pL, "no memory");
@@ -932,7 +1123,7 @@ s_rule_t *new_ruleitem(void) {
 
 s_queue_t *new_queueitem(void) {
 
-  s_queue_t *queueitem = (s_queue_t *)malloc(sizeof(s_queue_t));
+  s_queue_t *queueitem = (s_queue_t *)arena_malloc(sizeof(s_queue_t));
 
   if (queueitem == NULL) {
     LOG4ERROR(pL, "no memory");
@@ -1011,12 +1202,12 @@ void delete_rule(s_rulelist_t *rule) {
         /* queues */
         delete_queue(ptr->quelst);
         /* pointer */
-        free(ptr);
+        arena_free(ptr);
         ptr = NULL;
       }
     }
-    free(rule->rules);
-    free(rule);
+    arena_free(rule->rules);
+    arena_free(rule);
     rule = NULL;
   }
 }
@@ -1080,6 +1271,95 @@ char *get_listvalbyname(s_hdrlist_t *header, const char *name) {
   return NULL;
 }
 
+/**
+ *  @brief get canonical sip header name: long form of a compact name
+ *
+ *  @arg    const char*
+ *  @return const char*
+ */
+
+const char *get_sipname(const char *name) {
+
+  static const char *compact[] = SIP_COMPACT;
+  int c = tolower((unsigned char)name[0]);
+
+  if ((c >= 'a') && (c <= 'z') && (name[1] == '\0') &&
+      (compact[c - 'a'] != NULL)) {
+    return compact[c - 'a'];
+  }
+
+  return name;
+}
+
+/**
+ *  @brief get index of the first sip header of that name (any case, compact
+ *         or long form), the next ones follow via next[]
+ *
+ *  @arg    const s_siphdr_t*, const char*
+ *  @return int (-1: not present)
+ */
+
+int get_sipheader(const s_siphdr_t *header, const char *name) {
+
+  unsigned int hash = 0;
+  unsigned int k = 0;
+  int j;
+
+  if ((header == NULL) || (name == NULL)) {
+    return -1;
+  }
+
+  name = get_sipname(name);
+  hash = hash_sipname(name);
+
+  for (k = hash & header->mask; (j = header->first[k]) >= 0;
+       k = (k + 1) & header->mask) {
+    if ((header->hash[j] == hash) &&
+        (strcasecmp(header->list.header[j]->name, name) == 0)) {
+      return j;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ *  @brief get value of the first sip header of that name
+ *
+ *  @arg    const s_siphdr_t*, const char*
+ *  @return char*
+ */
+
+char *get_sipvalue(const s_siphdr_t *header, const char *name) {
+
+  int i = get_sipheader(header, name);
+
+  return (i < 0) ? NULL : header->list.header[i]->value;
+}
+
+/**
+ *  @brief get default route of a rule ("default: Route: <uri>, ..." or
+ *         plain "default: <uri>")
+ *
+ *  @arg    s_rule_t*
+ *  @return char*
+ */
+
+char *get_defaultroute(s_rule_t *rule) {
+
+  s_hdrlist_t *plist = rule->fblst;
+  char *uri = get_listvalbyname(plist, ROUTE);
+  int i;
+
+  for (i = 0; (uri == NULL) && (plist != NULL) && (i < plist->count); i++) {
+    if (plist->header[i]->name == NULL) {
+      uri = plist->header[i]->value;
+    }
+  }
+
+  return uri;
+}
+
 /**
  *  @brief get queue index by prio
  *
@@ -1116,68 +1396,214 @@ int get_queuebyprio(s_quelist_t *queue, const int prio) {
   return -1;
 }
 
-/*********************************************************** CHECK FUNCTIONS */
-
 /**
- *  @brief  check time condition
+ *  @brief  initializes queue state snapshot
  *
- *  @arg    char*, char*
- *  @return bool
+ *  with memo set, each distinct queue uri is looked up once and the
+ *  result is shared by all later lookups of the snapshot, the first
+ *  lookup starts the read transaction (see sqlite_RELEASE); a snapshot
+ *  starts with the newest states of the queue state cache
+ *
+ *  @arg    s_qsnap_t*, const char*, bool
+ *  @return void
  */
 
-bool check_time(char *tfrom, char *tto) {
+void init_qsnap(s_qsnap_t *snap, const char *dbfile, bool memo) {
 
-  time_t now;
+  qcache_update();
 
-  double sec_from;
-  double sec_to;
+  snap->dbfile = dbfile;
+  snap->db = NULL;
+  snap->qstate = NULL;
+  snap->count = 0;
+  snap->memo = memo;
+  snap->deadline = 0;
+  snap->expired = FALSE;
+  snap->usec = 0;
+}
 
-  int from_hr;
-  int from_min;
-  int to_hr;
-  int to_min;
-  bool ret;
+/**
+ *  @brief  sets the evaluation deadline to ms from now (0: none)
+ *
+ *  @arg    s_qsnap_t*, long
+ *  @return void
+ */
 
-  char delimiter[] = COLON;
+void set_deadline(s_qsnap_t *snap, long ms) {
 
-  char *ptr = NULL;
-  char *str = NULL;
+  snap->deadline = (ms > 0) ? get_usec() + ms * 1e3 : 0;
+  snap->expired = FALSE;
+}
 
-  struct tm beg;
+/**
+ *  @brief  checks whether the evaluation deadline has passed
+ *
+ *  @arg    s_qsnap_t*
+ *  @return bool
+ */
 
-  time(&now);
-  beg = *localtime(&now);
+bool check_deadline(s_qsnap_t *snap) {
 
-  str = tfrom;
-  ptr = strtok(str, delimiter);
-  from_hr = atoi(ptr);
-  ptr = strtok(NULL, delimiter);
-  if (ptr != NULL) {
-    from_min = atoi(ptr);
+  if ((snap == NULL) || (snap->deadline == 0)) {
+    return FALSE;
   }
 
-  if (tto == NULL) {
-    to_hr = from_hr;
-    to_min = from_min;
-  } else {
-    str = tto;
-    ptr = strtok(str, delimiter);
-    to_hr = atoi(ptr);
-    ptr = strtok(NULL, delimiter);
-    if (ptr != NULL) {
-      to_min = atoi(ptr);
-    }
+  if ((!snap->expired) && (get_usec() > snap->deadline)) {
+    LOG4WARN(pL, "request deadline exceeded");
+    snap->expired = TRUE;
   }
 
-  beg.tm_hour = from_hr;
-  beg.tm_min = from_min;
-  sec_from = difftime(now, mktime(&beg));
+  return snap->expired;
+}
 
-  if (to_hr < from_hr) {
-    beg.tm_mday++;
-  }
+/**
+ *  @brief  get queue state (state, max, length) of uri
+ *
+ *  @arg    s_qsnap_t*, s_query_t*, char*
+ *  @return int (0 if found, otherwise -1)
+ */
 
-  beg.tm_hour = to_hr;
+int get_queuestate(s_qsnap_t *snap, s_query_t *query, char *uri) {
+
+  s_qstate_t *pstate = NULL;
+  double start = 0;
+  int res = -1;
+  int i;
+
+  if (snap->memo) {
+    for (i = 0; i < snap->count; i++) {
+      pstate = &snap->qstate[i];
+      if (strcmp(pstate->uri, uri) == 0) {
+        LOG4DEBUG(pL, "\t- snapshot hit: %s", uri);
+        query->max = pstate->query.max;
+        query->length = pstate->query.length;
+        if (pstate->query.state != NULL) {
+          query->state = copy_string(pstate->query.state,
+                                     strlen(pstate->query.state));
+        }
+        return pstate->res;
+      }
+    }
+  }
+
+  /* the database only without current cached states */
+  res = qcache_lookup(uri, query);
+  if (res != QCACHE_STALE) {
+    metrics_inc(M_QCACHE_HIT);
+  } else {
+    if (qcache_age() >= 0) {
+      metrics_inc(M_QCACHE_STALE);
+    }
+
+    /* no lookups once the deadline has passed */
+    if (check_deadline(snap)) {
+      return -1;
+    }
+
+    start = get_usec();
+    if ((snap->db == NULL) && snap->memo && (snap->dbfile != NULL)) {
+      sqlite_SNAPSHOT(snap);
+    }
+    if (snap->db != NULL) {
+      res = sqlite_QUERYSNAP(query, uri, snap);
+    } else {
+      res = sqlite_QUERY(query, uri, snap);
+    }
+    start = get_usec() - start;
+    snap->usec += start;
+    metrics_observe(H_DBQUERY, start);
+
+    /* a lookup cut short by the deadline is not a queue state */
+    if (check_deadline(snap)) {
+      return -1;
+    }
+  }
+
+  if (snap->memo) {
+    pstate = (s_qstate_t *)arena_realloc(snap->qstate,
+                                         (snap->count + 1) * sizeof(s_qstate_t));
+    if (pstate == NULL) {
+      LOG4ERROR(pL, "no memory");
+      return res;
+    }
+    snap->qstate = pstate;
+    pstate = &snap->qstate[snap->count];
+    pstate->uri = copy_string(uri, strlen(uri));
+    pstate->query.max = query->max;
+    pstate->query.length = query->length;
+    pstate->query.state = NULL;
+    if (query->state != NULL) {
+      pstate->query.state = copy_string(query->state, strlen(query->state));
+    }
+    pstate->res = res;
+    snap->count++;
+  }
+
+  return res;
+}
+
+/*********************************************************** CHECK FUNCTIONS */
+
+/**
+ *  @brief  check time condition
+ *
+ *  @arg    char*, char*
+ *  @return bool
+ */
+
+bool check_time(char *tfrom, char *tto) {
+
+  time_t now;
+
+  double sec_from;
+  double sec_to;
+
+  int from_hr;
+  int from_min;
+  int to_hr;
+  int to_min;
+  bool ret;
+
+  char delimiter[] = COLON;
+
+  char *ptr = NULL;
+  char *str = NULL;
+
+  struct tm beg;
+
+  time(&now);
+  beg = *localtime(&now);
+
+  str = tfrom;
+  ptr = strtok(str, delimiter);
+  from_hr = atoi(ptr);
+  ptr = strtok(NULL, delimiter);
+  if (ptr != NULL) {
+    from_min = atoi(ptr);
+  }
+
+  if (tto == NULL) {
+    to_hr = from_hr;
+    to_min = from_min;
+  } else {
+    str = tto;
+    ptr = strtok(str, delimiter);
+    to_hr = atoi(ptr);
+    ptr = strtok(NULL, delimiter);
+    if (ptr != NULL) {
+      to_min = atoi(ptr);
+    }
+  }
+
+  beg.tm_hour = from_hr;
+  beg.tm_min = from_min;
+  sec_from = difftime(now, mktime(&beg));
+
+  if (to_hr < from_hr) {
+    beg.tm_mday++;
+  }
+
+  beg.tm_hour = to_hr;
   beg.tm_min = to_min;
   sec_to = difftime(now, mktime(&beg));
 
@@ -1321,17 +1747,16 @@ bool cond_day(const char *day, s_rule_t *rule) {
 /**
  *  @brief  check next uri condition
  *
- *  @arg    char*, s_rule_t
+ *  @arg    s_uri_t*, s_rule_t
  *  @return bool
  */
 
-bool cond_nexturi(const char *uri, s_rule_t *rule) {
+bool cond_nexturi(const s_uri_t *next, s_rule_t *rule) {
 
   bool res = TRUE;
-  char *tmp = NULL;
 
   /* do we have something to test */
-  if (uri == NULL) {
+  if (next->raw == NULL) {
     LOG4WARN(pL, "no next uri received");
     return res;
   }
@@ -1343,21 +1768,16 @@ bool cond_nexturi(const char *uri, s_rule_t *rule) {
 
   LOG4DEBUG(pL, "--- NEXT HOP CHECK...[%s]", rule->id);
 
-  tmp = extract_sipuri(uri);
-
-  if (tmp == NULL) {
+  if (next->uri == NULL) {
     LOG4WARN(pL, "could not extract next uri");
   } else {
-    if (check_string(tmp, rule->next)) {
+    if (check_string(next->uri, rule->next)) {
       res = TRUE;
     } else {
       res = FALSE;
     }
 
     LOG4DEBUG(pL, "%s = %s", rule->next, res ? "TRUE" : "FALSE");
-
-    /* cleanup */
-    free(tmp);
   }
 
   if (res == TRUE) {
@@ -1370,12 +1790,13 @@ bool cond_nexturi(const char *uri, s_rule_t *rule) {
 /**
  *  @brief  check ruri condition
  *
- *  @arg    char*, s_rule_t
+ *  @arg    s_uri_t*, s_rule_t
  *  @return bool
  */
 
-bool cond_ruri(const char *ruri, s_rule_t *rule) {
+bool cond_ruri(const s_uri_t *uri, s_rule_t *rule) {
 
+  const char *ruri = uri->raw;
   bool res = TRUE;
 
   /* do we have something to test */
@@ -1408,24 +1829,27 @@ bool cond_ruri(const char *ruri, s_rule_t *rule) {
 /**
  *  @brief  check sip header condition
  *
- *  @arg    s_hdrlist_t*, s_rule_t*, s_hdrlist_t*
+ *  a condition holds if any of the headers of that name matches
+ *
+ *  @arg    s_hdrlist_t*, s_rule_t*, s_siphdr_t*
  *  @return bool
  */
 
-bool cond_header(s_hdrlist_t *plist, s_rule_t *rule, s_hdrlist_t *shdr) {
+bool cond_header(s_hdrlist_t *plist, s_rule_t *rule, s_siphdr_t *shdr) {
 
   s_hdr_t *hdr = NULL;
 
   bool res = TRUE;
   bool grp = FALSE;
+  bool match = FALSE;
 
-  char *value = NULL;
   char *name = NULL;
 
   char empty[] = "empty";
 
   int i = 0;
   int j = 0;
+  int k = 0;
 
   /* do we have something to test ?*/
   if (plist == NULL) {
@@ -1440,7 +1864,7 @@ bool cond_header(s_hdrlist_t *plist, s_rule_t *rule, s_hdrlist_t *shdr) {
     return res;
   }
 
-  if (shdr->count == 0) {
+  if (shdr->list.count == 0) {
     return res;
   }
 
@@ -1452,9 +1876,12 @@ bool cond_header(s_hdrlist_t *plist, s_rule_t *rule, s_hdrlist_t *shdr) {
     hdr = plist->header[i];
     if (hdr) {
       if ((hdr->name != NULL) && (hdr->value != NULL)) {
-        value = get_listvalbyname(shdr, hdr->name);
-        if (value != NULL) {
-          if (check_string(value, hdr->value)) {
+        k = get_sipheader(shdr, hdr->name);
+        if (k >= 0) {
+          for (match = FALSE; (k >= 0) && !match; k = shdr->next[k]) {
+            match = check_string(shdr->list.header[k]->value, hdr->value);
+          }
+          if (match) {
             res &= TRUE;
             grp = TRUE;
             j++;
@@ -1484,11 +1911,12 @@ bool cond_header(s_hdrlist_t *plist, s_rule_t *rule, s_hdrlist_t *shdr) {
 /**
  *  @brief  check queue condition (queries database)
  *
- *  @arg    s_hdrlist_t*, s_rule_t*, s_input_t*, char*
+ *  @arg    s_hdrlist_t*, s_rule_t*, s_input_t*, char*, s_qsnap_t*
  *  @return bool
  */
 
-bool cond_queue(s_quelist_t *plist, s_rule_t *rule, s_input_t *in, char *uri, const char *dbname) {
+bool cond_queue(s_quelist_t *plist, s_rule_t *rule, s_input_t *in, char *uri,
+                s_qsnap_t *snap) {
 
   const s_attr_t *scan;
 
@@ -1539,8 +1967,8 @@ bool cond_queue(s_quelist_t *plist, s_rule_t *rule, s_input_t *in, char *uri, co
     if (suri == NULL) {
       break;
     }
-    sqlite_QUERY(query, suri, dbname);
-    free(suri);
+    get_queuestate(snap, query, suri);
+    arena_free(suri);
 
     if (query->state != NULL) {
 
@@ -1553,7 +1981,7 @@ bool cond_queue(s_quelist_t *plist, s_rule_t *rule, s_input_t *in, char *uri, co
         /* allocate memory */
         char *(val[scan->fields]);
         for (i = 0; i < scan->fields; i++) {
-          val[i] = (char *)malloc(strlen(plist->queue[idx]->size) + 1);
+          val[i] = (char *)arena_malloc(strlen(plist->queue[idx]->size) + 1);
           if (val[i] == NULL) {
             LOG4ERROR(pL, "no memory");
             break;
@@ -1578,7 +2006,7 @@ bool cond_queue(s_quelist_t *plist, s_rule_t *rule, s_input_t *in, char *uri, co
         /* cleanup */
         for (i = 0; i < scan->fields; i++) {
           if (val[i] != NULL) {
-            free(val[i]);
+            arena_free(val[i]);
           }
         }
       }
@@ -1613,18 +2041,16 @@ bool cond_queue(s_quelist_t *plist, s_rule_t *rule, s_input_t *in, char *uri, co
   }
 
   /* nothing found ... try normal next hop if exists */
-  if ((uri == NULL) && (in->next != NULL)) {
-    LOG4DEBUG(pL, "\t- using normal next hop uri: %s", in->next);
+  if ((uri == NULL) && (in->ctx.next.raw != NULL)) {
+    LOG4DEBUG(pL, "\t- using normal next hop uri: %s", in->ctx.next.raw);
     query = new_query();
     if (query != NULL) {
       init_query(query);
-      suri = extract_sipuri(in->next);
-      if (suri != NULL) {
-        sqlite_QUERY(query, suri, dbname);
-        free(suri);
+      if (in->ctx.next.uri != NULL) {
+        get_queuestate(snap, query, in->ctx.next.uri);
         if (query->state != NULL) {
           ret = check_queuestate("active", query->state);
-          LOG4DEBUG(pL, "%s %s = %s", in->next, "active",
+          LOG4DEBUG(pL, "%s %s = %s", in->ctx.next.raw, "active",
                     ret ? "TRUE" : "FALSE");
           if (ret) {
             uri = in->next;
@@ -1650,7 +2076,7 @@ bool cond_queue(s_quelist_t *plist, s_rule_t *rule, s_input_t *in, char *uri, co
         if (fblist->count > 1) {
           LOG4WARN(pL, "replacing 'add action' header list with default");
           if (rule->addlst == NULL) {
-            rule->addlst = (s_hdrlist_t *)malloc(sizeof(s_hdrlist_t));
+            rule->addlst = (s_hdrlist_t *)arena_malloc(sizeof(s_hdrlist_t));
             if (rule->addlst == NULL) {
               LOG4ERROR(pL, "no memory");
               LOG4WARN(pL, "can not replace 'add action' header");
@@ -1723,7 +2149,7 @@ bool cond_time(s_hdrlist_t *plist, s_rule_t *rule) {
       scan = get_scanner(time_attr, hdr->name);
       /* allocate memory */
       for (i = 0; i < scan->fields; i++) {
-        val[i] = (char *)malloc(strlen(hdr->value) + 1);
+        val[i] = (char *)arena_malloc(strlen(hdr->value) + 1);
         if (val[i] == NULL) {
           LOG4ERROR(pL, "no memory");
           res = TRUE;
@@ -1765,7 +2191,7 @@ bool cond_time(s_hdrlist_t *plist, s_rule_t *rule) {
       /* cleanup */
       for (i = 0; i < scan->fields; i++) {
         if (val[i] != NULL) {
-          free(val[i]);
+          arena_free(val[i]);
         }
       }
     }
@@ -1789,7 +2215,7 @@ bool cond_setroute(s_quelist_t *plist, s_rule_t *rule, s_input_t *in,
                    char *uri) {
 
   s_hdrlist_t *hlist = NULL;
-  char *suri = NULL;
+  char *suri = in->ctx.next.uri;
   char *tmp = NULL;
 
   size_t len;
@@ -1819,12 +2245,11 @@ bool cond_setroute(s_quelist_t *plist, s_rule_t *rule, s_input_t *in,
   LOG4DEBUG(pL, "routing to next hop: '%s'", uri);
 
   if (!check_string(uri, in->next)) {
-    suri = extract_sipuri(in->next);
     if (suri == NULL) {
       LOG4WARN(pL, "could not get normal next hop uri: %s", in->next);
     } else {
       len = strlen(suri) + strlen(HIDX0);
-      tmp = (char *)malloc(len + 1);
+      tmp = (char *)arena_malloc(len + 1);
       if (tmp == NULL) {
         LOG4ERROR(pL, "no memory");
         LOG4WARN(pL, "could not add history info uri: %s", in->next);
@@ -1836,24 +2261,22 @@ bool cond_setroute(s_quelist_t *plist, s_rule_t *rule, s_input_t *in,
           LOG4DEBUG(pL, "\t- adding H-I header: %s", tmp);
         }
         /* cleanup */
-        free(tmp);
+        arena_free(tmp);
       }
-      /* cleanup */
-      free(suri);
     }
   }
 
   if ((strstr(rule->route, ";transport") == NULL) &&
       (rule->transport != NULL)) {
     len = strlen(rule->route) + strlen(rule->transport) + strlen(TPSTR);
-    tmp = (char *)malloc(len + 1);
+    tmp = (char *)arena_malloc(len + 1);
     if (tmp == NULL) {
       LOG4ERROR(pL, "no memory");
     } else {
       snprintf(tmp, len, TPSTR, rule->route, rule->transport);
       rule->route = replace_string(rule->route, tmp, strlen(tmp));
       /* cleanup */
-      free(tmp);
+      arena_free(tmp);
     }
   }
 
@@ -1912,19 +2335,17 @@ void set_state(const char *key, int *state) {
 }
 
 /**
- *  @brief  reads and parses yaml file (rules ..)
+ *  @brief  parses yaml rules from an initialized parser
  *
- *  @arg    char*
+ *  @arg    yaml_parser_t*, const char*
  *  @return s_rulelist_t*
  */
 
-s_rulelist_t *parse_rule(const char *file) {
+static s_rulelist_t *parse_rule_yaml(yaml_parser_t *parser, const char *file) {
   s_rulelist_t *rlist = NULL;
   s_rule_t **prule = NULL;
   s_queue_t **pqueue = NULL;
 
-  FILE *fh = fopen(file, "r");
-
   char *key = NULL;
   char *val = NULL;
 
@@ -1935,16 +2356,10 @@ s_rulelist_t *parse_rule(const char *file) {
 
   bool iskey = FALSE;
 
-  yaml_parser_t parser;
   yaml_token_t token;
   size_t len = 0;
 
-  if (fh == NULL) {
-    LOG4ERROR(pL, "can not open rule file [%s]", file);
-    return NULL;
-  }
-
-  rlist = (s_rulelist_t *)malloc(sizeof(s_rulelist_t));
+  rlist = (s_rulelist_t *)arena_malloc(sizeof(s_rulelist_t));
 
   if (rlist == NULL) {
     LOG4ERROR(pL, "no memory");
@@ -1954,17 +2369,8 @@ s_rulelist_t *parse_rule(const char *file) {
   rlist->maxhits = 0;
   rlist->maxprio = 0;
 
-  /* Initialize parser */
-  if (!yaml_parser_initialize(&parser))
-    LOG4ERROR(pL, "failed to initialize parser [%d]", errno);
-  if (fh == NULL)
-    LOG4ERROR(pL, "failed to open file %s [%d]", file, errno);
-
-  /* Set input file */
-  yaml_parser_set_input_file(&parser, fh);
-
   do {
-    if (!yaml_parser_scan(&parser, &token)) {
+    if (!yaml_parser_scan(parser, &token)) {
       LOG4WARN(pL, "yml scan failed");
     }
     switch (token.type) {
@@ -1990,7 +2396,7 @@ s_rulelist_t *parse_rule(const char *file) {
         q = -1;
         pqueue = NULL;
         if (prule[n]) {
-          prule[n]->quelst = (s_quelist_t *)malloc(sizeof(s_quelist_t));
+          prule[n]->quelst = (s_quelist_t *)arena_malloc(sizeof(s_quelist_t));
           if (prule[n]->quelst == NULL) {
             LOG4ERROR(pL, "no memory");
             break;
@@ -2159,11 +2565,8 @@ s_rulelist_t *parse_rule(const char *file) {
   rlist->count = n + 1;
   rlist->rules = prule;
 
-  /* free token and cleanup */
+  /* free token */
   yaml_token_delete(&token);
-  yaml_parser_delete(&parser);
-
-  fclose(fh);
 
   if (qstate != S_NONE) {
     LOG4ERROR(pL, "wrong configuration file [%s]", file);
@@ -2173,6 +2576,122 @@ s_rulelist_t *parse_rule(const char *file) {
   return rlist;
 }
 
+/**
+ *  @brief  reads and parses yaml file (rules ..)
+ *
+ *  @arg    char*
+ *  @return s_rulelist_t*
+ */
+
+s_rulelist_t *parse_rule(const char *file) {
+  s_rulelist_t *rlist = NULL;
+
+  FILE *fh = fopen(file, "r");
+
+  yaml_parser_t parser;
+
+  if (fh == NULL) {
+    LOG4ERROR(pL, "can not open rule file [%s]", file);
+    return NULL;
+  }
+
+  /* Initialize parser */
+  if (!yaml_parser_initialize(&parser)) {
+    LOG4ERROR(pL, "failed to initialize parser [%d]", errno);
+    fclose(fh);
+    return NULL;
+  }
+
+  /* Set input file */
+  yaml_parser_set_input_file(&parser, fh);
+
+  rlist = parse_rule_yaml(&parser, file);
+  metrics_inc(rlist ? M_RULES_LOAD : M_RULES_ERROR);
+
+  /* cleanup */
+  yaml_parser_delete(&parser);
+  fclose(fh);
+
+  return rlist;
+}
+
+/**
+ *  @brief  parses yaml rules from memory (see read_rule)
+ *
+ *  @arg    const char*, size_t
+ *  @return s_rulelist_t*
+ */
+
+s_rulelist_t *parse_rule_string(const char *buf, size_t len) {
+  s_rulelist_t *rlist = NULL;
+
+  yaml_parser_t parser;
+
+  if (buf == NULL) {
+    return NULL;
+  }
+
+  /* Initialize parser */
+  if (!yaml_parser_initialize(&parser)) {
+    LOG4ERROR(pL, "failed to initialize parser [%d]", errno);
+    return NULL;
+  }
+
+  /* Set input string */
+  yaml_parser_set_input_string(&parser, (const unsigned char *)buf, len);
+
+  rlist = parse_rule_yaml(&parser, "<memory>");
+  metrics_inc(rlist ? M_RULES_LOAD : M_RULES_ERROR);
+
+  /* cleanup */
+  yaml_parser_delete(&parser);
+
+  return rlist;
+}
+
+/**
+ *  @brief  reads whole rules file into memory (one rule generation)
+ *
+ *  @arg    const char*, size_t*
+ *  @return char*
+ */
+
+char *read_rule(const char *file, size_t *len) {
+
+  FILE *fh = fopen(file, "r");
+
+  char *buf = NULL;
+  long size = 0;
+
+  *len = 0;
+
+  if (fh == NULL) {
+    LOG4ERROR(pL, "can not open rule file [%s]", file);
+    return NULL;
+  }
+
+  if ((fseek(fh, 0, SEEK_END) != 0) || ((size = ftell(fh)) < 0) ||
+      (fseek(fh, 0, SEEK_SET) != 0)) {
+    LOG4ERROR(pL, "can not read rule file [%s]", file);
+    fclose(fh);
+    return NULL;
+  }
+
+  buf = (char *)arena_malloc(size + 1);
+  if (buf == NULL) {
+    LOG4ERROR(pL, "no memory");
+    fclose(fh);
+    return NULL;
+  }
+
+  *len = fread(buf, 1, size, fh);
+  buf[*len] = '\0';
+
+  fclose(fh);
+
+  return buf;
+}
+
 /**
  *  @brief  print all yaml rules
  *
@@ -2279,11 +2798,12 @@ void print_rule(s_rulelist_t *rulelist, bool printall) {
 /**
  *  @brief  execute condition validation on each rule
  *
- *  @arg    s_input_t*, s_rulelist_t*, s_hdrlist_t*
+ *  @arg    s_input_t*, s_rulelist_t*, s_siphdr_t*, s_qsnap_t*
  *  @return void
  */
 
-void validate_rule(s_input_t *cond, s_rulelist_t *rule, s_hdrlist_t *shdr, const char* dbname) {
+void validate_rule(s_input_t *cond, s_rulelist_t *rule, s_siphdr_t *shdr,
+                   s_qsnap_t *snap) {
 
   s_rule_t **rules = NULL;
   char *uri = NULL;
@@ -2293,16 +2813,20 @@ void validate_rule(s_input_t *cond, s_rulelist_t *rule, s_hdrlist_t *shdr, const
     if (rule->rules != NULL) {
       rules = rule->rules;
       for (i = 0; i < rule->count; i++) {
+        /* out of time: the caller answers with the default route */
+        if (check_deadline(snap)) {
+          break;
+        }
         if (rules[i] != NULL) {
-          rules[i]->valid &= cond_ruri(cond->ruri, rules[i]);
-          rules[i]->valid &= cond_nexturi(cond->next, rules[i]);
+          rules[i]->valid &= cond_ruri(&cond->ctx.ruri, rules[i]);
+          rules[i]->valid &= cond_nexturi(&cond->ctx.next, rules[i]);
           rules[i]->valid &= cond_day(rules[i]->weekday, rules[i]);
           rules[i]->valid &= cond_time(rules[i]->timelst, rules[i]);
           rules[i]->valid &= cond_header(rules[i]->hdrlst, rules[i], shdr);
           /* execute condition validation only for valid rules */
           if (rules[i]->valid) {
             rules[i]->valid |=
-                cond_queue(rules[i]->quelst, rules[i], cond, uri, dbname);
+                cond_queue(rules[i]->quelst, rules[i], cond, uri, snap);
           }
           if (rules[i]->valid) {
             /* if we can't set a route, rule gets invalid */
@@ -2327,11 +2851,11 @@ void validate_rule(s_input_t *cond, s_rulelist_t *rule, s_hdrlist_t *shdr, const
 /**
  *  @brief  selects a valid rule based on prio and condition hits
  *
- *  @arg    s_input_t*, s_rulelist_t*, s_hdrlist_t*
+ *  @arg    s_input_t*, s_rulelist_t*, s_siphdr_t*
  *  @return void
  */
 
-void select_rule(s_input_t *cond, s_rulelist_t *rule, s_hdrlist_t *shdr) {
+void select_rule(s_input_t *cond, s_rulelist_t *rule, s_siphdr_t *shdr) {
 
   s_rule_t **rules = NULL;
   int i = 0;
@@ -2394,148 +2918,400 @@ void select_rule(s_input_t *cond, s_rulelist_t *rule, s_hdrlist_t *shdr) {
   return;
 }
 
+/************************************************************ REQUEST TIMING */
+
 /**
- *  @brief  create json object to be returned
+ *  @brief  resets request attributes, no stage has run yet
  *
- *  @arg    s_input_t*, s_rulelist_t*, int*
- *  @return char*
+ *  @arg    s_input_t*
+ *  @return void
  */
 
-void *get_jsonresponse(s_rulelist_t *rulelist, char *next, size_t *lgth) {
+static void init_input(s_input_t *request) {
 
-  s_hdrlist_t *plist = NULL;
-  s_hdr_t **phdr = NULL;
-  s_rule_t **rules = NULL;
+  int i;
 
-  cJSON *root = NULL;
-  cJSON *hdr = NULL;
-  cJSON *bdy = NULL;
-  cJSON *hdrline = NULL;
-  // cJSON *bdyline = NULL;
+  request->ruri = NULL;
+  request->next = NULL;
+  request->shdr = NULL;
+  request->shdrlen = 0;
+  request->tindex = 0;
+  request->tlabel = 0;
+  request->outcome = M_OUT_ERROR;
+  request->hash = 0;
+  memset(&request->ctx, 0, sizeof(s_context_t));
+
+  for (i = 0; i < P_COUNT; i++) {
+    request->stage[i] = -1;
+  }
+}
 
-  size_t len = 0;
+/**
+ *  @brief  adds the time since start to a processing stage (P_*)
+ *
+ *  @arg    s_input_t*, int, double
+ *  @return double (now, start of the next stage)
+ */
 
-  char *presult = NULL;
-  char *ptarget = NULL;
-  char *pname = NULL;
+static double add_stage(s_input_t *request, int id, double start) {
 
-  int i;
-  int j;
+  double now = get_usec();
 
-  *lgth = 0;
+  if (request->stage[id] < 0) {
+    request->stage[id] = 0;
+  }
+  request->stage[id] += now - start;
 
-  /* set default */
-  ptarget = next;
+  return now;
+}
 
-  if (rulelist != NULL) {
-    if (rulelist->rules != NULL) {
-      rules = rulelist->rules;
+/**
+ *  @brief  records request time and stage times (stages that have run)
+ *
+ *  @arg    s_input_t*, double
+ *  @return void
+ */
 
-      for (i = 0; i < rulelist->count; i++) {
-        if (rules[i] != NULL) {
-          if ((rules[i]->use == 1) && (rules[i]->valid)) {
-            if (rules[i]->route != NULL) {
-              ptarget = rules[i]->route;
-              LOG4INFO(pL, "rule selected =>");
-              LOG4INFO(pL, "...[%s: %s]", rules[i]->id, rules[i]->name);
-              break;
-            }
-          }
-        }
-      }
+static void put_stages(s_input_t *request, double start) {
 
-      root = cJSON_CreateObject();
-      hdr = cJSON_CreateArray();
-      bdy = cJSON_CreateArray();
+  int i;
 
-      cJSON_AddStringToObject(root, "target", ptarget);
-      cJSON_AddNumberToObject(root, "statusCode", 200);
-      cJSON_AddItemToObject(root, "additionalHeaders", hdr);
-      cJSON_AddItemToObject(root, "additionalBodyParts", bdy);
-      cJSON_AddNumberToObject(root, "tindex", 0);
-      cJSON_AddNumberToObject(root, "tlabel", 0);
+  metrics_observe(H_REQUEST, get_usec() - start);
 
-      for (i = 0; i < rulelist->count; i++) {
-        if (rules[i] != NULL) {
-          if ((rules[i]->addlst != NULL) && (rules[i]->use == 1) &&
-              (rules[i]->valid)) {
-            plist = rules[i]->addlst;
-            if (plist->header != NULL) {
-              phdr = plist->header;
-              for (j = 0; j < plist->count; j++) {
-                cJSON_AddItemToArray(hdr, hdrline = cJSON_CreateObject());
-                len = strlen(phdr[j]->name) + 2;
-                pname = (char *)malloc(len * sizeof(char));
-                snprintf(pname, len, "%s:", phdr[j]->name);
-                cJSON_AddStringToObject(hdrline, "name", pname);
-                cJSON_AddStringToObject(hdrline, "value", phdr[j]->value);
-                free(pname);
-              }
-            }
-          }
-        }
-      }
-      // cJSON_AddItemToArray(bdy, bdyline = cJSON_CreateObject());
-      presult = cJSON_PrintUnformatted(root);
-    } else {
-      LOG4WARN(pL, "no valid rule found");
+  for (i = 0; i < P_COUNT; i++) {
+    if (request->stage[i] >= 0) {
+      metrics_observe(H_STAGE + i, request->stage[i]);
     }
   }
+}
 
-  if (presult == NULL) {
-    LOG4ERROR(pL, "failed to create response, returning error");
-    len = strlen(ERR_RESP) + strlen(ERR_DEFAULT) + 1;
-    presult = (char *)malloc(len);
-    snprintf(presult, len, ERR_RESP, ERR_DEFAULT);
-  } else {
-    LOG4DEBUG(pL, "JSON:\n[%s]\n", presult);
+/**
+ *  @brief  inserts the timing header (stage times in us) at off, the end of
+ *          the response header
+ *
+ *  @arg    struct mbuf*, size_t, const double*, double
+ *  @return void
+ */
+
+static void put_timing(struct mbuf *io, size_t off, const double *stage,
+                       double start) {
+
+  char line[MAX_HDR_LINE];
+  size_t len;
+  int i;
+
+  len = snprintf(line, sizeof(line), "%s: ", TIMING_HDR);
+  for (i = 0; (i < P_COUNT) && (len < sizeof(line)); i++) {
+    if (stage[i] >= 0) {
+      len += snprintf(line + len, sizeof(line) - len, "%s=%.1f;",
+                      metrics_stage(i), stage[i]);
+    }
+  }
+  if (len < sizeof(line)) {
+    len += snprintf(line + len, sizeof(line) - len, "total=%.1f\r\n",
+                    get_usec() - start);
+  }
+
+  if (len < sizeof(line)) {
+    mbuf_insert(io, off, line, len);
+  } else {
+    LOG4WARN(pL, "timing header too long");
   }
+}
 
-  *lgth = strlen(presult);
+/****************************************************** JSON RESPONSE WRITER */
 
-  /* cleanup */
-  cJSON_Delete(root);
+/**
+ *  @brief  appends json escaped string content (without quotes)
+ *
+ *  @arg    struct mbuf*, const char*
+ *  @return void
+ */
+
+static void put_jsonescaped(struct mbuf *io, const char *str) {
+
+  const char *run = NULL;
+  char esc[8];
+
+  if (str == NULL) {
+    return;
+  }
+
+  for (run = str; *str; str++) {
+    if (((unsigned char)*str >= 0x20) && (*str != '"') && (*str != '\\')) {
+      continue;
+    }
+    mbuf_append(io, run, str - run);
+    switch (*str) {
+    case '"':
+      MBUF_PUTS(io, "\\\"");
+      break;
+    case '\\':
+      MBUF_PUTS(io, "\\\\");
+      break;
+    case '\n':
+      MBUF_PUTS(io, "\\n");
+      break;
+    case '\r':
+      MBUF_PUTS(io, "\\r");
+      break;
+    case '\t':
+      MBUF_PUTS(io, "\\t");
+      break;
+    default:
+      snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*str);
+      mbuf_append(io, esc, 6);
+    }
+    run = str + 1;
+  }
 
-  return presult;
+  mbuf_append(io, run, str - run);
 }
 
 /**
- *  @brief  main request handler (mongoose)
+ *  @brief  appends a quoted and escaped json string
  *
- *  @arg    struct mg_connection*, struct http_message*
+ *  @arg    struct mbuf*, const char*
  *  @return void
  */
 
-static void handle_req(struct mg_connection *nc, struct http_message *hm) {
+static void put_jsonstring(struct mbuf *io, const char *str) {
 
-  /* get rules and db file via user data */
-  s_cfg_t *cfg = (s_cfg_t *)nc->mgr->user_data;
+  MBUF_PUTS(io, "\"");
+  put_jsonescaped(io, str);
+  MBUF_PUTS(io, "\"");
+}
 
-  s_input_t *request = (s_input_t *)malloc(sizeof(s_input_t));
-  s_hdrlist_t *sipheader = NULL;
-  s_rulelist_t *rulelist = NULL;
+/**
+ *  @brief  appends an unsigned json number
+ *
+ *  @arg    struct mbuf*, unsigned int
+ *  @return void
+ */
 
-  request->ruri = NULL;
-  request->next = NULL;
-  request->shdr = NULL;
+static void put_jsonnumber(struct mbuf *io, unsigned int num) {
+
+  char str[16];
+  int len = snprintf(str, sizeof(str), "%u", num);
+
+  mbuf_append(io, str, len);
+}
+
+/**
+ *  @brief  appends an additionalHeaders object ({"name":"<name>:",...})
+ *
+ *  @arg    struct mbuf*, s_hdr_t*
+ *  @return void
+ */
+
+static void put_jsonheader(struct mbuf *io, s_hdr_t *hdr) {
+
+  MBUF_PUTS(io, "{\"name\":\"");
+  put_jsonescaped(io, hdr->name);
+  MBUF_PUTS(io, ":\",\"value\":");
+  put_jsonstring(io, hdr->value);
+  MBUF_PUTS(io, "}");
+}
+
+/**
+ *  @brief  returns the target of the selected rule (default: next hop)
+ *
+ *  a missing rule list results in the error target (statusCode 500)
+ *
+ *  @arg    s_rulelist_t*, s_input_t*, int*
+ *  @return const char*
+ */
+
+static const char *get_target(s_rulelist_t *rulelist, s_input_t *in,
+                              int *status) {
+
+  s_rule_t **rules = NULL;
+
+  const char *ptarget = NULL;
+
+  int i;
+
+  /* set default */
+  ptarget = in->next;
+  *status = 200;
+  if (in->outcome != M_OUT_FALLBACK) {
+    in->outcome = M_OUT_NEXT;
+  }
+
+  if ((rulelist != NULL) && (rulelist->rules != NULL)) {
+    rules = rulelist->rules;
+
+    for (i = 0; i < rulelist->count; i++) {
+      if (rules[i] != NULL) {
+        if ((rules[i]->use == 1) && (rules[i]->valid)) {
+          if (rules[i]->route != NULL) {
+            ptarget = rules[i]->route;
+            in->outcome = M_OUT_RULE;
+            LOG4INFO(pL, "rule selected =>");
+            LOG4INFO(pL, "...[%s: %s]", rules[i]->id, rules[i]->name);
+            break;
+          }
+        }
+      }
+    }
+  } else {
+    if (rulelist != NULL) {
+      LOG4WARN(pL, "no valid rule found");
+    }
+    LOG4ERROR(pL, "failed to create response, returning error");
+    ptarget = ERR_DEFAULT;
+    *status = 500;
+    in->outcome = M_OUT_ERROR;
+  }
+
+  LOG4INFO(pL, "...[target: %s]", ptarget ? ptarget : "");
+
+  return ptarget;
+}
+
+/**
+ *  @brief  writes the response json (PRF schema) to io
+ *
+ *  a missing rule list results in an error response (statusCode 500)
+ *
+ *  @arg    struct mbuf*, s_rulelist_t*, s_input_t*
+ *  @return size_t (bytes written)
+ */
+
+size_t get_jsonresponse(struct mbuf *io, s_rulelist_t *rulelist,
+                        s_input_t *in) {
+
+  s_hdrlist_t *plist = NULL;
+  s_hdr_t **phdr = NULL;
+  s_rule_t **rules = NULL;
+
+  size_t off = io->len;
+
+  const char *ptarget = NULL;
+
+  bool first = TRUE;
+
+  int status = 200;
+  int i;
+  int j;
+
+  ptarget = get_target(rulelist, in, &status);
+  if (status == 200) {
+    rules = rulelist->rules;
+  }
+
+  MBUF_PUTS(io, "{\"target\":");
+  put_jsonstring(io, ptarget);
+  MBUF_PUTS(io, ",\"statusCode\":");
+  put_jsonnumber(io, status);
+  MBUF_PUTS(io, ",\"additionalHeaders\":[");
+
+  if (rules != NULL) {
+    for (i = 0; i < rulelist->count; i++) {
+      if (rules[i] != NULL) {
+        if ((rules[i]->addlst != NULL) && (rules[i]->use == 1) &&
+            (rules[i]->valid)) {
+          plist = rules[i]->addlst;
+          if (plist->header != NULL) {
+            phdr = plist->header;
+            for (j = 0; j < plist->count; j++) {
+              if (!first) {
+                MBUF_PUTS(io, ",");
+              }
+              put_jsonheader(io, phdr[j]);
+              first = FALSE;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  MBUF_PUTS(io, "],\"additionalBodyParts\":[],\"tindex\":");
+  put_jsonnumber(io, in->tindex);
+  MBUF_PUTS(io, ",\"tlabel\":");
+  put_jsonnumber(io, in->tlabel);
+  MBUF_PUTS(io, "}");
+
+  LOG4DEBUG(pL, "JSON:\n[%.*s]\n", (int)(io->len - off), io->buf + off);
+
+  return io->len - off;
+}
+
+/**
+ *  @brief  logs request attributes, warns about missing ones
+ *
+ *  @arg    s_input_t*
+ *  @return void
+ */
+
+static void log_input(s_input_t *request) {
+
+  if (request->ruri) {
+    LOG4DEBUG(pL, "ruri: [%s]", request->ruri);
+  } else {
+    LOG4WARN(pL, "request URI missing");
+  }
+  if (request->next) {
+    LOG4DEBUG(pL, "next: [%s]", request->next);
+  } else {
+    LOG4WARN(pL, "next hop USI missing");
+  }
+  if (request->shdr) {
+    LOG4DEBUG(pL, "shdr: [%zu] =>\n##\n%.*s ...\n##", request->shdrlen, 896,
+              request->shdr);
+  } else {
+    LOG4WARN(pL, "SIP message header missing");
+  }
+}
+
+/**
+ *  @brief  get unsigned integer (e.g. tindex, tlabel) from json number
+ *
+ *  @arg    cJSON*
+ *  @return unsigned int
+ */
+
+static unsigned int get_jsonuint(cJSON *item) {
+
+  if ((item == NULL) || (item->type != cJSON_Number)) {
+    return 0;
+  }
+
+  if ((item->valuedouble < 0) || (item->valuedouble > UINT_MAX)) {
+    LOG4WARN(pL, "transaction id out of range: %f", item->valuedouble);
+    return 0;
+  }
+
+  return (unsigned int)item->valuedouble;
+}
+
+/**
+ *  @brief  reads request attributes (ruri, next, sip message, transaction
+ *          id) from a json request object
+ *
+ *  @arg    cJSON*, s_input_t*
+ *  @return void
+ */
+
+static void get_jsoninput(cJSON *jrequest, s_input_t *request) {
 
   char *res = NULL;
   char *shdr = NULL;
 
-  size_t lgth;
+  size_t lgth = 0;
 
-  /* Get form variables */
   cJSON *jruri = NULL;
   cJSON *jshdr = NULL;
   cJSON *jnext = NULL;
+  cJSON *jtidx = NULL;
+  cJSON *jtlbl = NULL;
 
-  cJSON *jrequest = cJSON_Parse(hm->body.p);
-  if (jrequest == NULL) {
-    const char *error_ptr = cJSON_GetErrorPtr();
-    if (error_ptr != NULL) {
-      LOG4ERROR(pL, "JSON error before: %s\n", error_ptr);
-    }
-  } else {
+  double start = 0;
+
+  init_input(request);
+
+  if (jrequest != NULL) {
     jruri = cJSON_GetObjectItem(jrequest, "ruri");
     if (jruri != NULL) {
       if ((jruri->valuestring != NULL) && (strlen(jruri->valuestring) > 0)) {
@@ -2547,18 +3323,21 @@ static void handle_req(struct mg_connection *nc, struct http_message *hm) {
     jshdr = cJSON_GetObjectItem(jrequest, "request");
     if (jshdr != NULL) {
       if ((jshdr->valuestring != NULL) && (strlen(jshdr->valuestring) > 0)) {
+        start = get_usec();
         shdr = copy_string(jshdr->valuestring, strlen(jshdr->valuestring) + 1);
         res = (char *)base64_decode((unsigned char *)shdr, strlen(shdr), &lgth);
         if (res != NULL) {
           request->shdr = copy_string((char *)res, lgth);
+          request->shdrlen = lgth;
         } else {
           LOG4WARN(pL, "base64 decoding returned empty message");
         }
         /* cleanup */
         if (shdr)
-          free(shdr);
+          arena_free(shdr);
         if (res)
-          free(res);
+          arena_free(res);
+        add_stage(request, P_BASE64, start);
       }
     }
 
@@ -2570,129 +3349,1021 @@ static void handle_req(struct mg_connection *nc, struct http_message *hm) {
       }
     }
 
-    cJSON_Delete(jrequest);
+    /* transaction id, echoed back in the response */
+    jtidx = cJSON_GetObjectItem(jrequest, "tindex");
+    request->tindex = get_jsonuint(jtidx);
+    jtlbl = cJSON_GetObjectItem(jrequest, "tlabel");
+    request->tlabel = get_jsonuint(jtlbl);
   }
 
-  if (request->ruri) {
-    LOG4DEBUG(pL, "ruri: [%s]", request->ruri);
-  } else {
-    LOG4WARN(pL, "request URI missing");
-  }
-  if (request->next) {
-    LOG4DEBUG(pL, "next: [%s]", request->next);
-  } else {
-    LOG4WARN(pL, "next hop USI missing");
+  log_input(request);
+}
+
+/**
+ *  @brief  deselects all rules, so the response carries the next hop (or,
+ *          without next hop, the default route of the first rule)
+ *
+ *  @arg    s_input_t*, s_rulelist_t*
+ *  @return void
+ */
+
+static void set_default(s_input_t *request, s_rulelist_t *rulelist) {
+
+  s_rule_t **rules = rulelist->rules;
+  char *uri = NULL;
+  int i;
+
+  for (i = 0; (rules != NULL) && (i < rulelist->count); i++) {
+    if (rules[i] != NULL) {
+      rules[i]->use = 0;
+      if (uri == NULL) {
+        uri = get_defaultroute(rules[i]);
+      }
+    }
   }
-  if (request->shdr) {
-    LOG4DEBUG(pL, "shdr: [%zu] =>\n##\n%.*s ...\n##", lgth, 896, request->shdr);
-  } else {
-    LOG4WARN(pL, "SIP message header missing");
+
+  if ((request->next == NULL) && (uri != NULL)) {
+    request->next = copy_string(uri, strlen(uri));
   }
 
-  /* Send headers */
-  mg_printf(nc, "%s", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+  request->outcome = M_OUT_FALLBACK;
+
+  LOG4WARN(pL, "evaluation aborted, answering with default route [%s]",
+           request->next ? request->next : "");
+}
+
+/**
+ *  @brief  evaluates rules for one request
+ *
+ *  @arg    s_input_t*, s_rulelist_t*, s_qsnap_t*
+ *  @return s_rulelist_t* (evaluated rules, NULL on error)
+ */
+
+static s_rulelist_t *eval_request(s_input_t *request, s_rulelist_t *rulelist,
+                                  s_qsnap_t *snap) {
+
+  s_siphdr_t *sipheader = NULL;
+  s_context_t *ctx = &request->ctx;
+
+  double start = get_usec();
+  double usec = snap->usec;
 
   if (request->shdr) {
-    sipheader = parse_list_crlf(request->shdr, SEP_HDR);
+    sipheader = parse_sipheader(request->shdr, request->shdrlen);
   } else {
     LOG4WARN(pL, "invalid SIP message");
   }
+  parse_context(request, sipheader);
+  add_stage(request, P_SIPHDR, start);
 
   LOG4INFO(pL, "request received =>");
-  if (request->ruri != NULL) {
-    LOG4INFO(pL, "...[ruri: %s]", request->ruri);
+  if (ctx->ruri.raw != NULL) {
+    LOG4INFO(pL, "...[ruri: %s]", ctx->ruri.raw);
   }
-  if (request->next != NULL) {
-    LOG4INFO(pL, "...[next: %s]", request->next);
+  if (ctx->next.raw != NULL) {
+    LOG4INFO(pL, "...[next: %s]", ctx->next.raw);
   }
-  if ((res = get_listvalbyname(sipheader, FROM)) != NULL) {
-    LOG4INFO(pL, "...[from: %s]", res);
+  if (ctx->from.raw != NULL) {
+    LOG4INFO(pL, "...[from: %s]", ctx->from.raw);
   }
-  if ((res = get_listvalbyname(sipheader, TO)) != NULL) {
-    LOG4INFO(pL, "...[to:   %s]", res);
+  if (ctx->to.raw != NULL) {
+    LOG4INFO(pL, "...[to:   %s]", ctx->to.raw);
   }
 
-  rulelist = parse_rule(cfg->rulefile);
-
   if (((sipheader != NULL) || (request->ruri) || (request->next)) &&
       (rulelist != NULL)) {
     LOG4DEBUG(pL, "VALIDATING === RULES ===");
-    validate_rule(request, rulelist, sipheader, cfg->dbfile);
-    LOG4DEBUG(pL, "SELECTING === RULE ===");
-    select_rule(request, rulelist, sipheader);
+    start = get_usec();
+    validate_rule(request, rulelist, sipheader, snap);
+    /* queue state lookups are a stage of their own */
+    usec = snap->usec - usec;
+    if (usec > 0) {
+      request->stage[P_QUEUE] = usec;
+    }
+    start = add_stage(request, P_EVAL, start + usec);
+    if (check_deadline(snap)) {
+      set_default(request, rulelist);
+    } else {
+      LOG4DEBUG(pL, "SELECTING === RULE ===");
+      select_rule(request, rulelist, sipheader);
+    }
+    add_stage(request, P_SELECT, start);
     // print_rule(rulelist, FALSE);
-    res = get_jsonresponse(rulelist, request->next, &lgth);
   } else {
     LOG4ERROR(pL, "sip header or rulelist missing");
-    lgth = strlen(ERR_RESP) + strlen(ERR_DEFAULT) + 1;
-    res = (char *)malloc(lgth);
-    snprintf(res, lgth, ERR_RESP, ERR_DEFAULT);
+    rulelist = NULL;
   }
 
-  if (rulelist != NULL) {
-    LOG4DEBUG(pL, "DELETING === RULES ===");
-    delete_rule(rulelist);
-  }
+  return rulelist;
+}
 
-  if (sipheader != NULL) {
-    LOG4DEBUG(pL, "DELETING === SIP HEADER ===");
-    delete_list(sipheader);
-  }
+/**
+ *  @brief  evaluates rules for one request and writes the response json
+ *
+ *  @arg    struct mbuf*, s_input_t*, s_rulelist_t*, s_qsnap_t*
+ *  @return size_t (bytes written)
+ */
 
-  if (request->ruri)
-    free(request->ruri);
-  if (request->shdr)
-    free(request->shdr);
-  if (request->next)
-    free(request->next);
+static size_t put_decision(struct mbuf *io, s_input_t *request,
+                           s_rulelist_t *rulelist, s_qsnap_t *snap) {
 
-  free(request);
+  s_rulelist_t *rules = eval_request(request, rulelist, snap);
 
-  /* Compute the result and send it back as a JSON object */
-  mg_printf_http_chunk(nc, "%.*s", lgth, res);
-  mg_send_http_chunk(nc, "", 0); /* Send empty chunk, the end of response */
+  double start = get_usec();
+  size_t len = get_jsonresponse(io, rules, request);
 
-  LOG4INFO(pL, "response sent =>");
-  LOG4INFO(pL, "[%s]", res);
+  add_stage(request, P_SERIALIZE, start);
 
-  /* cleanup */
-  free(res);
+  return len;
 }
 
 /**
- *  @brief  defaul request handler (mongoose)
+ *  @brief  starts an http chunk in the send buffer
  *
- *  @arg    struct mg_connection*, struct http_message*
- *  @return void
+ *  the chunk size is reserved up front and patched by end_chunk once the
+ *  body is written, so the response is never copied
+ *
+ *  @arg    struct mbuf*
+ *  @return size_t (chunk offset)
  */
 
-static void handle_default(struct mg_connection *nc, struct http_message *hm) {
-  /* Send headers */
-  mg_printf(nc, "%s", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+static size_t begin_chunk(struct mbuf *io) {
 
-  /* Compute the result and send it back as a JSON object */
-  mg_printf_http_chunk(nc, ERR_RESP_STATIC);
-  mg_send_http_chunk(nc, "", 0); /* Send empty chunk, the end of response */
+  size_t off = io->len;
+
+  MBUF_PUTS(io, CHUNK_PAD);
+
+  return off;
 }
 
 /**
- *  @brief  main event handler (mongoose)
+ *  @brief  completes an http chunk started by begin_chunk
  *
- *  @arg    struct mg_connection*, int, void*
- *  @return void
+ *  @arg    struct mbuf*, size_t
+ *  @return size_t (chunk data length)
  */
 
-void ev_handler(struct mg_connection *nc, int ev, void *ev_data) {
+static size_t end_chunk(struct mbuf *io, size_t off) {
 
-  struct http_message *hm = (struct http_message *)ev_data;
-  struct mbuf *io = &nc->recv_mbuf;
+  char hex[CHUNK_HEX + 1];
+  size_t len = io->len - off - (sizeof(CHUNK_PAD) - 1);
 
-  switch (ev) {
-  case MG_EV_HTTP_REQUEST:
-    if (mg_vcmp(&hm->uri, "/api/v1/prf/req") == 0) {
-      handle_req(nc, hm); /* Handle RESTful call */
-    } else {
-      handle_default(nc, hm);
+  snprintf(hex, sizeof(hex), "%0*zx", CHUNK_HEX, len);
+  memcpy(io->buf + off, hex, CHUNK_HEX);
+  MBUF_PUTS(io, "\r\n");
+
+  return len;
+}
+
+/********************************************************* ADMISSION CONTROL */
+
+/**
+ *  @brief  precomputes the shed response from the default route of the
+ *          first rule (rules file as read at startup)
+ *
+ *  @arg    s_cfg_t*
+ *  @return int (0 or -1)
+ */
+
+int init_shed(s_cfg_t *cfg) {
+
+  s_rulelist_t *rulelist = NULL;
+  s_rule_t *rule = NULL;
+  char *uri = NULL;
+  struct mbuf io;
+  size_t len;
+  int i;
+
+  cfg->backlog = 0;
+  cfg->shed = 0;
+  cfg->shedtarget = NULL;
+  cfg->shedstatus = 200;
+  cfg->shedjson = NULL;
+  cfg->shedjsonlen = 0;
+
+  rulelist = parse_rule(cfg->rulefile);
+  for (i = 0; (rulelist != NULL) && (rulelist->rules != NULL) &&
+              (i < rulelist->count) && (uri == NULL);
+       i++) {
+    if (rulelist->rules[i] != NULL) {
+      rule = rulelist->rules[i];
+      uri = get_defaultroute(rule);
+    }
+  }
+
+  if (uri == NULL) {
+    LOG4WARN(pL, "no default route found, shed requests get error response");
+    cfg->shedtarget = copy_string(ERR_DEFAULT, strlen(ERR_DEFAULT));
+    cfg->shedstatus = 500;
+  } else if (rule->transport != NULL) {
+    /* same form as a rule route (see cond_setroute) */
+    len = strlen(uri) + strlen(rule->transport) + strlen(TPSTR);
+    cfg->shedtarget = (char *)arena_malloc(len);
+    if (cfg->shedtarget != NULL) {
+      snprintf(cfg->shedtarget, len, TPSTR, uri, rule->transport);
+    }
+  } else {
+    cfg->shedtarget = copy_string(uri, strlen(uri));
+  }
+
+  delete_rule(rulelist);
+
+  if (cfg->shedtarget == NULL) {
+    return -1;
+  }
+
+  mbuf_init(&io, 256);
+  MBUF_PUTS(&io, "{\"target\":");
+  put_jsonstring(&io, cfg->shedtarget);
+  MBUF_PUTS(&io, ",\"statusCode\":");
+  put_jsonnumber(&io, cfg->shedstatus);
+  MBUF_PUTS(&io, ",\"additionalHeaders\":[],\"additionalBodyParts\":[],"
+                 "\"tindex\":");
+
+  cfg->shedjson = io.buf;
+  cfg->shedjsonlen = io.len;
+
+  LOG4DEBUG(pL, "shed response target: %s", cfg->shedtarget);
+
+  return 0;
+}
+
+/**
+ *  @brief  frees the precomputed shed response
+ *
+ *  @arg    s_cfg_t*
+ *  @return void
+ */
+
+void delete_shed(s_cfg_t *cfg) {
+
+  delete_string(cfg->shedtarget);
+  free(cfg->shedjson);
+
+  cfg->shedtarget = NULL;
+  cfg->shedjson = NULL;
+}
+
+/**
+ *  @brief  admission check, counts requests of the current poll round
+ *
+ *  requests that arrive together are handled one after another, so the
+ *  n-th request of a round waits for the n-1 evaluations before it;
+ *  beyond the watermark requests are shed (answered with the default
+ *  route without rule evaluation); requests not yet read (socket buffers,
+ *  ready connections beyond NETIF_EVENTS) are not counted, carrying the
+ *  count over to the next round would shed every request as long as
+ *  rounds stay full
+ *
+ *  @arg    s_cfg_t*
+ *  @return bool (FALSE: shed request)
+ */
+
+bool admit_request(s_cfg_t *cfg) {
+
+  if ((cfg->watermark <= 0) || (++cfg->backlog <= cfg->watermark)) {
+    return TRUE;
+  }
+
+  cfg->shed++;
+  metrics_inc(M_OUT_SHED);
+
+  /* log once per overloaded round */
+  if (cfg->backlog == cfg->watermark + 1) {
+    LOG4WARN(pL, "overload, shedding requests [%lu shed]", cfg->shed);
+  }
+
+  return FALSE;
+}
+
+/**
+ *  @brief  scans an unsigned json number member without parsing the json
+ *
+ *  @arg    const struct mg_str*, const char*
+ *  @return unsigned int
+ */
+
+static unsigned int scan_jsonuint(const struct mg_str *body, const char *key) {
+
+  const char *end = body->p + body->len;
+  const char *ptr = mg_strstr(*body, mg_mk_str(key));
+
+  unsigned long val = 0;
+
+  if (ptr == NULL) {
+    return 0;
+  }
+
+  for (ptr += strlen(key);
+       (ptr < end) && ((*ptr == ' ') || (*ptr == '\t') || (*ptr == ':'));
+       ptr++)
+    ;
+
+  for (; (ptr < end) && (*ptr >= '0') && (*ptr <= '9'); ptr++) {
+    val = val * 10 + (*ptr - '0');
+    if (val > UINT_MAX) {
+      return 0;
+    }
+  }
+
+  return (unsigned int)val;
+}
+
+/**
+ *  @brief  appends the precomputed shed response object (transaction id
+ *          echoed)
+ *
+ *  @arg    struct mbuf*, s_cfg_t*, unsigned int, unsigned int
+ *  @return void
+ */
+
+static void put_jsonshed(struct mbuf *io, s_cfg_t *cfg, unsigned int tindex,
+                         unsigned int tlabel) {
+
+  mbuf_append(io, cfg->shedjson, cfg->shedjsonlen);
+  put_jsonnumber(io, tindex);
+  MBUF_PUTS(io, ",\"tlabel\":");
+  put_jsonnumber(io, tlabel);
+  MBUF_PUTS(io, "}");
+}
+
+/**
+ *  @brief  sends the precomputed shed response (transaction id echoed)
+ *
+ *  @arg    struct mg_connection*, struct http_message*
+ *  @return void
+ */
+
+static void handle_shed(struct mg_connection *nc, struct http_message *hm) {
+
+  s_cfg_t *cfg = (s_cfg_t *)nc->mgr->user_data;
+  struct mbuf *io = &nc->send_mbuf;
+  size_t off;
+
+  MBUF_PUTS(io, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+
+  off = begin_chunk(io);
+  put_jsonshed(io, cfg, scan_jsonuint(&hm->body, "\"tindex\""),
+               scan_jsonuint(&hm->body, "\"tlabel\""));
+  end_chunk(io, off);
+  MBUF_PUTS(io, "0\r\n\r\n");
+}
+
+/**
+ *  @brief  main request handler (mongoose)
+ *
+ *  @arg    struct mg_connection*, struct http_message*
+ *  @return void
+ */
+
+static void handle_req(struct mg_connection *nc, struct http_message *hm) {
+
+  /* get rules and db file via user data */
+  s_cfg_t *cfg = (s_cfg_t *)nc->mgr->user_data;
+
+  s_input_t request;
+  s_rulelist_t *rulelist = NULL;
+  s_qsnap_t snap;
+
+  double start = get_usec();
+  double now = 0;
+
+  size_t hdr;
+  size_t off;
+  size_t lgth;
+
+  if (!admit_request(cfg)) {
+    handle_shed(nc, hm);
+    return;
+  }
+
+  /* request-lifetime memory comes from the arena, released at the end */
+  set_arena(cfg->arena);
+
+  /* each queue is looked up once, all rules see the same queue states */
+  init_qsnap(&snap, cfg->dbfile, TRUE);
+  set_deadline(&snap, cfg->deadline);
+
+  /* Get form variables */
+  cJSON *jrequest = cJSON_Parse(hm->body.p);
+  if (jrequest == NULL) {
+    const char *error_ptr = cJSON_GetErrorPtr();
+    if (error_ptr != NULL) {
+      LOG4ERROR(pL, "JSON error before: %s\n", error_ptr);
+    }
+  }
+
+  get_jsoninput(jrequest, &request);
+  cJSON_Delete(jrequest);
+  rec_request(&request);
+  /* json stage: everything up to here but base64 decoding */
+  now = add_stage(&request, P_JSON, start);
+  if (request.stage[P_BASE64] > 0) {
+    request.stage[P_JSON] -= request.stage[P_BASE64];
+  }
+
+  /* Send headers (the timing header is inserted before the blank line) */
+  MBUF_PUTS(&nc->send_mbuf,
+            "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+  hdr = nc->send_mbuf.len - 2;
+
+  /* Compute the result (or repeat it) and send it back as a JSON object */
+  off = begin_chunk(&nc->send_mbuf);
+  if (!cache_get(CACHE_JSON, &request, &nc->send_mbuf)) {
+    rulelist = parse_rule(cfg->rulefile);
+    add_stage(&request, P_RULES, now);
+    lgth = put_decision(&nc->send_mbuf, &request, rulelist, &snap);
+    cache_put(CACHE_JSON, &request,
+              nc->send_mbuf.buf + off + sizeof(CHUNK_PAD) - 1, lgth);
+  }
+  lgth = end_chunk(&nc->send_mbuf, off);
+  rec_decision(&snap, PRFREC_JSON,
+               nc->send_mbuf.buf + off + sizeof(CHUNK_PAD) - 1, lgth);
+  sqlite_RELEASE(&snap);
+  if (snap.expired) {
+    cfg->timeouts++;
+  }
+  if (mg_get_http_header(hm, TIMING_HDR) != NULL) {
+    put_timing(&nc->send_mbuf, hdr, request.stage, start);
+  }
+  mg_send_http_chunk(nc, "", 0); /* Send empty chunk, the end of response */
+
+  metrics_inc(request.outcome);
+  put_stages(&request, start);
+
+  LOG4INFO(pL, "response sent => [%zu bytes]", lgth);
+
+  /* cleanup: request, sip header, rules and response live in the arena */
+  reset_arena(cfg->arena);
+  set_arena(NULL);
+}
+
+/**
+ *  @brief  batch request handler (mongoose)
+ *
+ *  evaluates a json array of requests against one rules file read and one
+ *  queue state snapshot, queue lookups are shared by all batch items; each
+ *  item counts against the watermark like a single request
+ *
+ *  @arg    struct mg_connection*, struct http_message*
+ *  @return void
+ */
+
+static void handle_batch(struct mg_connection *nc, struct http_message *hm) {
+
+  /* get rules and db file via user data */
+  s_cfg_t *cfg = (s_cfg_t *)nc->mgr->user_data;
+
+  s_input_t request;
+  s_rulelist_t *rulelist = NULL;
+  s_qsnap_t snap;
+
+  cJSON *jitem = NULL;
+
+  char *rules = NULL;
+
+  size_t rlen = 0;
+  size_t hdr;
+  size_t off;
+  size_t item;
+  size_t lgth;
+
+  double stage[P_COUNT];
+  double begin = get_usec();
+  double start = 0;
+  double parse = 0;
+
+  int count = 0;
+  int i;
+
+  for (i = 0; i < P_COUNT; i++) {
+    stage[i] = -1;
+  }
+
+  /* request-lifetime memory comes from the arena, released at the end */
+  set_arena(cfg->arena);
+
+  cJSON *jbatch = cJSON_Parse(hm->body.p);
+  parse = get_usec() - begin;
+
+  /* Send headers (the timing header is inserted before the blank line) */
+  MBUF_PUTS(&nc->send_mbuf,
+            "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+  hdr = nc->send_mbuf.len - 2;
+
+  off = begin_chunk(&nc->send_mbuf);
+  MBUF_PUTS(&nc->send_mbuf, "[");
+
+  if ((jbatch == NULL) || (jbatch->type != cJSON_Array)) {
+    LOG4ERROR(pL, "batch request is not a JSON array");
+  } else {
+    /* one rule generation and one queue state snapshot for all items */
+    rules = read_rule(cfg->rulefile, &rlen);
+    init_qsnap(&snap, cfg->dbfile, TRUE);
+
+    for (jitem = jbatch->child; jitem != NULL; jitem = jitem->next) {
+      LOG4DEBUG(pL, "=== BATCH ITEM %d ===", count);
+      if (count++ > 0) {
+        MBUF_PUTS(&nc->send_mbuf, ",");
+      }
+      if (!admit_request(cfg)) {
+        put_jsonshed(&nc->send_mbuf, cfg,
+                     get_jsonuint(cJSON_GetObjectItem(jitem, "tindex")),
+                     get_jsonuint(cJSON_GetObjectItem(jitem, "tlabel")));
+        continue;
+      }
+      start = get_usec();
+      set_deadline(&snap, cfg->deadline);
+      get_jsoninput(jitem, &request);
+      rec_request(&request);
+      /* the batch is parsed once, its parse time goes to the first item */
+      start = add_stage(&request, P_JSON, start - parse);
+      if (request.stage[P_BASE64] > 0) {
+        request.stage[P_JSON] -= request.stage[P_BASE64];
+      }
+      parse = 0;
+      item = nc->send_mbuf.len;
+      if (cache_get(CACHE_JSON, &request, &nc->send_mbuf)) {
+        lgth = nc->send_mbuf.len - item;
+      } else {
+        rulelist = parse_rule_string(rules, rlen);
+        add_stage(&request, P_RULES, start);
+        lgth = put_decision(&nc->send_mbuf, &request, rulelist, &snap);
+        cache_put(CACHE_JSON, &request, nc->send_mbuf.buf + item, lgth);
+      }
+      rec_decision(&snap, PRFREC_JSON, nc->send_mbuf.buf + item, lgth);
+      if (snap.expired) {
+        cfg->timeouts++;
+      }
+      metrics_inc(request.outcome);
+      put_stages(&request, start);
+      for (i = 0; i < P_COUNT; i++) {
+        if (request.stage[i] >= 0) {
+          stage[i] = (stage[i] < 0) ? request.stage[i]
+                                    : stage[i] + request.stage[i];
+        }
+      }
+    }
+
+    sqlite_RELEASE(&snap);
+
+    LOG4INFO(pL, "batch evaluated => [%d requests, %d queue lookups]", count,
+             snap.count);
+  }
+
+  MBUF_PUTS(&nc->send_mbuf, "]");
+  lgth = end_chunk(&nc->send_mbuf, off);
+  if (mg_get_http_header(hm, TIMING_HDR) != NULL) {
+    /* stage times summed over all items */
+    put_timing(&nc->send_mbuf, hdr, stage, begin);
+  }
+  mg_send_http_chunk(nc, "", 0); /* Send empty chunk, the end of response */
+
+  LOG4INFO(pL, "response sent => [%zu bytes]", lgth);
+
+  cJSON_Delete(jbatch);
+
+  /* cleanup: requests, rules, snapshot and response live in the arena */
+  reset_arena(cfg->arena);
+  set_arena(NULL);
+}
+
+/**
+ *  @brief  metrics request handler (mongoose), Prometheus text format
+ *
+ *  @arg    struct mg_connection*, struct http_message*
+ *  @return void
+ */
+
+static void handle_metrics(struct mg_connection *nc, struct http_message *hm) {
+
+  size_t off;
+
+  (void)hm;
+
+  MBUF_PUTS(&nc->send_mbuf, "HTTP/1.1 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Transfer-Encoding: chunked\r\n\r\n");
+
+  off = begin_chunk(&nc->send_mbuf);
+  metrics_write(&nc->send_mbuf);
+  end_chunk(&nc->send_mbuf, off);
+  mg_send_http_chunk(nc, "", 0); /* Send empty chunk, the end of response */
+}
+
+/**
+ *  @brief  makes the response that starts at off the last one of the
+ *          connection (Connection: close)
+ *
+ *  @arg    struct mg_connection*, size_t
+ *  @return void
+ */
+
+static void put_close(struct mg_connection *nc, size_t off) {
+
+  struct mbuf *io = &nc->send_mbuf;
+  const char *end = mg_strstr(mg_mk_str_n(io->buf + off, io->len - off),
+                              mg_mk_str("\r\n\r\n"));
+
+  if (end != NULL) {
+    mbuf_insert(io, end - io->buf + 2, "Connection: close\r\n", 19);
+  }
+  nc->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+/**
+ *  @brief  defaul request handler (mongoose)
+ *
+ *  @arg    struct mg_connection*, struct http_message*
+ *  @return void
+ */
+
+static void handle_default(struct mg_connection *nc, struct http_message *hm) {
+  /* Send headers */
+  mg_printf(nc, "%s", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+
+  /* Compute the result and send it back as a JSON object */
+  mg_printf_http_chunk(nc, ERR_RESP_STATIC);
+  mg_send_http_chunk(nc, "", 0); /* Send empty chunk, the end of response */
+}
+
+/*********************************************************** BINARY PROTOCOL */
+
+/**
+ *  @brief  reads an unsigned 16 bit integer (network byte order)
+ *
+ *  @arg    const char*
+ *  @return unsigned int
+ */
+
+static unsigned int get_binu16(const char *buf) {
+
+  uint16_t val;
+
+  memcpy(&val, buf, sizeof(val));
+
+  return ntohs(val);
+}
+
+/**
+ *  @brief  reads an unsigned 32 bit integer (network byte order)
+ *
+ *  @arg    const char*
+ *  @return unsigned int
+ */
+
+static unsigned int get_binu32(const char *buf) {
+
+  uint32_t val;
+
+  memcpy(&val, buf, sizeof(val));
+
+  return ntohl(val);
+}
+
+/**
+ *  @brief  appends an unsigned 16 bit integer (network byte order)
+ *
+ *  @arg    struct mbuf*, unsigned int
+ *  @return void
+ */
+
+static void put_binu16(struct mbuf *io, unsigned int num) {
+
+  uint16_t val = htons((uint16_t)num);
+
+  mbuf_append(io, &val, sizeof(val));
+}
+
+/**
+ *  @brief  appends an unsigned 32 bit integer (network byte order)
+ *
+ *  @arg    struct mbuf*, unsigned int
+ *  @return void
+ */
+
+static void put_binu32(struct mbuf *io, unsigned int num) {
+
+  uint32_t val = htonl((uint32_t)num);
+
+  mbuf_append(io, &val, sizeof(val));
+}
+
+/**
+ *  @brief  appends a length prefixed string (u16, NULL is empty)
+ *
+ *  @arg    struct mbuf*, const char*
+ *  @return void
+ */
+
+static void put_binstring(struct mbuf *io, const char *str) {
+
+  size_t len = str ? strlen(str) : 0;
+
+  if (len > UINT16_MAX) {
+    LOG4WARN(pL, "string truncated to %d bytes", UINT16_MAX);
+    len = UINT16_MAX;
+  }
+
+  put_binu16(io, len);
+  mbuf_append(io, str, len);
+}
+
+/**
+ *  @brief  reads request attributes from a binary request record (without
+ *          length prefix), strings are copied and NUL terminated
+ *
+ *  @arg    const char*, size_t, s_input_t*
+ *  @return int (0 or -1 if the record is malformed)
+ */
+
+static int get_bininput(const char *buf, size_t len, s_input_t *request) {
+
+  const char *end = buf + len;
+  size_t n = 0;
+
+  init_input(request);
+
+  if (len < PRFBIN_REQ_MIN) {
+    return -1;
+  }
+
+  request->tindex = get_binu32(buf);
+  request->tlabel = get_binu32(buf + 4);
+  buf += 8;
+
+  n = get_binu16(buf);
+  buf += 2;
+  if ((size_t)(end - buf) < n + 2) {
+    return -1;
+  }
+  if (n > 0) {
+    request->ruri = copy_string(buf, n);
+  }
+  buf += n;
+
+  n = get_binu16(buf);
+  buf += 2;
+  if ((size_t)(end - buf) < n + 4) {
+    return -1;
+  }
+  if (n > 0) {
+    request->next = copy_string(buf, n);
+  }
+  buf += n;
+
+  n = get_binu32(buf);
+  buf += 4;
+  if ((size_t)(end - buf) != n) {
+    return -1;
+  }
+  if (n > 0) {
+    /* writable copy, the header block is tokenized in place */
+    request->shdr = copy_string(buf, n);
+    request->shdrlen = n;
+  }
+
+  log_input(request);
+
+  return 0;
+}
+
+/**
+ *  @brief  writes a binary response record to io (see prfbin.h)
+ *
+ *  @arg    struct mbuf*, s_rulelist_t*, s_input_t*
+ *  @return size_t (bytes written)
+ */
+
+static size_t get_binresponse(struct mbuf *io, s_rulelist_t *rulelist,
+                              s_input_t *in) {
+
+  s_hdrlist_t *plist = NULL;
+  s_hdr_t **phdr = NULL;
+  s_rule_t **rules = NULL;
+
+  size_t off = io->len;
+  size_t cnt = 0;
+
+  const char *ptarget = NULL;
+
+  uint32_t len;
+  uint16_t count = 0;
+
+  int status = 200;
+  int i;
+  int j;
+
+  /* record length, patched below */
+  put_binu32(io, 0);
+  put_binu32(io, in->tindex);
+  put_binu32(io, in->tlabel);
+
+  ptarget = get_target(rulelist, in, &status);
+  if (status == 200) {
+    rules = rulelist->rules;
+  }
+
+  put_binu16(io, status);
+  put_binstring(io, ptarget);
+
+  /* header count, patched below */
+  cnt = io->len;
+  put_binu16(io, 0);
+
+  if (rules != NULL) {
+    for (i = 0; i < rulelist->count; i++) {
+      if (rules[i] != NULL) {
+        if ((rules[i]->addlst != NULL) && (rules[i]->use == 1) &&
+            (rules[i]->valid)) {
+          plist = rules[i]->addlst;
+          if (plist->header != NULL) {
+            phdr = plist->header;
+            for (j = 0; (j < plist->count) && (count < UINT16_MAX); j++) {
+              put_binstring(io, phdr[j]->name);
+              put_binstring(io, phdr[j]->value);
+              count++;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  count = htons(count);
+  memcpy(io->buf + cnt, &count, sizeof(count));
+  len = htonl((uint32_t)(io->len - off - PRFBIN_LEN));
+  memcpy(io->buf + off, &len, sizeof(len));
+
+  return io->len - off;
+}
+
+/**
+ *  @brief  writes the precomputed shed response record (transaction id
+ *          taken from the request record)
+ *
+ *  @arg    struct mbuf*, s_cfg_t*, const char*, size_t
+ *  @return void
+ */
+
+static void put_binshed(struct mbuf *io, s_cfg_t *cfg, const char *buf,
+                        size_t len) {
+
+  size_t tlen = strlen(cfg->shedtarget);
+
+  put_binu32(io, PRFBIN_RESP_MIN + tlen);
+  put_binu32(io, (len >= 8) ? get_binu32(buf) : 0);
+  put_binu32(io, (len >= 8) ? get_binu32(buf + 4) : 0);
+  put_binu16(io, cfg->shedstatus);
+  put_binstring(io, cfg->shedtarget);
+  put_binu16(io, 0);
+}
+
+/**
+ *  @brief  binary request handler (one record, without length prefix)
+ *
+ *  @arg    struct mg_connection*, const char*, size_t
+ *  @return void
+ */
+
+static void handle_bin(struct mg_connection *nc, const char *buf, size_t len) {
+
+  /* get rules and db file via user data */
+  s_cfg_t *cfg = (s_cfg_t *)nc->mgr->user_data;
+
+  s_input_t request;
+  s_rulelist_t *rulelist = NULL;
+  s_qsnap_t snap;
+
+  double start = get_usec();
+  double now = 0;
+
+  size_t off;
+  size_t lgth;
+
+  bool hit = FALSE;
+
+  if (!admit_request(cfg)) {
+    put_binshed(&nc->send_mbuf, cfg, buf, len);
+    return;
+  }
+
+  /* request-lifetime memory comes from the arena, released at the end */
+  set_arena(cfg->arena);
+
+  /* each queue is looked up once, all rules see the same queue states */
+  init_qsnap(&snap, cfg->dbfile, TRUE);
+  set_deadline(&snap, cfg->deadline);
+
+  off = nc->send_mbuf.len;
+
+  if (get_bininput(buf, len, &request) == 0) {
+    rec_request(&request);
+    hit = cache_get(CACHE_BIN, &request, &nc->send_mbuf);
+    if (!hit) {
+      now = get_usec();
+      rulelist = parse_rule(cfg->rulefile);
+      add_stage(&request, P_RULES, now);
+      rulelist = eval_request(&request, rulelist, &snap);
+    }
+  } else {
+    LOG4ERROR(pL, "malformed binary request [%zu bytes]", len);
+  }
+
+  if (hit) {
+    lgth = nc->send_mbuf.len - off;
+  } else {
+    now = get_usec();
+    lgth = get_binresponse(&nc->send_mbuf, rulelist, &request);
+    add_stage(&request, P_SERIALIZE, now);
+    cache_put(CACHE_BIN, &request, nc->send_mbuf.buf + off, lgth);
+  }
+  rec_decision(&snap, PRFREC_BIN, nc->send_mbuf.buf + off + PRFBIN_LEN,
+               lgth - PRFBIN_LEN);
+  sqlite_RELEASE(&snap);
+  if (snap.expired) {
+    cfg->timeouts++;
+  }
+
+  metrics_inc(request.outcome);
+  put_stages(&request, start);
+
+  LOG4INFO(pL, "response sent => [%zu bytes]", lgth);
+
+  /* cleanup: request, sip header and rules live in the arena */
+  reset_arena(cfg->arena);
+  set_arena(NULL);
+}
+
+/**
+ *  @brief  binary protocol event handler (mongoose)
+ *
+ *  handles every complete record in the receive buffer, a record longer
+ *  than PRFBIN_MAX closes the connection
+ *
+ *  @arg    struct mg_connection*, int, void*
+ *  @return void
+ */
+
+void ev_binhandler(struct mg_connection *nc, int ev, void *ev_data) {
+
+  struct mbuf *io = &nc->recv_mbuf;
+
+  size_t off = 0;
+  size_t len = 0;
+
+  (void)ev_data;
+
+  if (ev != MG_EV_RECV) {
+    return;
+  }
+
+  while (io->len - off >= PRFBIN_LEN) {
+    len = get_binu32(io->buf + off);
+    if (len > PRFBIN_MAX) {
+      LOG4ERROR(pL, "binary request too long [%zu bytes], closing", len);
+      nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+      off = io->len;
+      break;
+    }
+    if (io->len - off - PRFBIN_LEN < len) {
+      break;
+    }
+    handle_bin(nc, io->buf + off + PRFBIN_LEN, len);
+    off += PRFBIN_LEN + len;
+  }
+
+  mbuf_remove(io, off);
+}
+
+/**
+ *  @brief  main event handler (mongoose)
+ *
+ *  @arg    struct mg_connection*, int, void*
+ *  @return void
+ */
+
+void ev_handler(struct mg_connection *nc, int ev, void *ev_data) {
+
+  s_cfg_t *cfg = (s_cfg_t *)nc->mgr->user_data;
+  struct http_message *hm = (struct http_message *)ev_data;
+  struct mbuf *io = &nc->recv_mbuf;
+  size_t off = nc->send_mbuf.len;
+
+  switch (ev) {
+  case MG_EV_HTTP_REQUEST:
+    if (mg_vcmp(&hm->uri, "/api/v1/prf/req") == 0) {
+      handle_req(nc, hm); /* Handle RESTful call */
+    } else if (mg_vcmp(&hm->uri, "/api/v1/prf/batch") == 0) {
+      handle_batch(nc, hm); /* Handle RESTful batch call */
+    } else if (mg_vcmp(&hm->uri, "/metrics") == 0) {
+      handle_metrics(nc, hm);
+    } else {
+      handle_default(nc, hm);
+    }
+    /* the client sends its next request to the restarted rngin */
+    if (cfg->draining) {
+      put_close(nc, off);
     }
     break;
     mbuf_remove(io, io->len);
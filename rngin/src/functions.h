@@ -32,9 +32,19 @@
 
 /******************************************************************* INCLUDE */
 
+#include "alog.h"
+#include "arena.h"
+#include "cache.h"
+#include "handoff.h"
+#include "metrics.h"
+#include "netif.h"
+#include "qcache.h"
 #include "cjson.h"
 #include "mongoose.h"
+#include "prfbin.h"
+#include "record.h"
 #include <log4c.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -96,6 +106,41 @@
 
 #define MAX_HDR_LINE 256
 
+/* long forms of the compact sip header names a..z (RFC 3261 7.3.3, IANA) */
+#define SIP_COMPACT                                                            \
+  {                                                                            \
+    "Accept-Contact", "Referred-By", "Content-Type", "Request-Disposition",    \
+        "Content-Encoding", "From", NULL, NULL, "Call-ID", "Reject-Contact",   \
+        "Supported", "Content-Length", "Contact", "Identity-Info", "Event",    \
+        NULL, NULL, "Refer-To", "Subject", "To", "Allow-Events", "Via", NULL,  \
+        "Session-Expires", "Identity", NULL                                    \
+  }
+
+/* default per-request deadline (ms) */
+#define DEADLINE_MS 20
+/* sqlite progress handler interval (virtual machine instructions) */
+#define DEADLINE_OPS 1000
+
+/* worker processes (-n) and the least time between restarts of one (ms) */
+#define WORKERS_MAX 64
+#define RESPAWN_MS 1000
+
+/* time to finish requests in progress after a handoff (ms) */
+#define DRAIN_MS 5000
+
+/* idle time before an http connection is closed while draining (s), a
+ * busy one closes with its next response */
+#define DRAIN_IDLE 1
+
+/* http chunk size placeholder, patched after the body is written */
+#define CHUNK_HEX 8
+#define CHUNK_PAD "00000000\r\n"
+
+/* debug request header, answered with the processing time by stage */
+#define TIMING_HDR "X-PRF-Timing"
+
+#define MBUF_PUTS(io, str) mbuf_append(io, str, sizeof(str) - 1)
+
 #define SCAN_STRING(tk, args...) sscanf(tk, "%[^\n]s", ##args)
 #define SCAN_INTEGER(tk, args...) sscanf(tk, "%d", ##args)
 
@@ -144,10 +189,6 @@
 
 /* ERROR RESPONSE */
 #define ERR_DEFAULT "sip:unknown@domain.invalid"
-#define ERR_RESP                                                               \
-  "{\"target\":\"%s\",\"statusCode\":500,"                                     \
-  "\"additionalHeaders\":[],\"additionalBodyParts\":[],"                       \
-  "\"tindex\":0,\"tlabel\":0}"
 
 #define ERR_RESP_STATIC                                                        \
   "{\"target\":\"\",\"statusCode\":500,"                                       \
@@ -168,11 +209,32 @@
 #define __SHORT_FILE__                                                         \
   (strrchr(__FILE__, '\\') ? strrchr(__FILE__, '\\') + 1 : __FILE__)
 
+/* the priority is checked before any argument is evaluated */
+#define __LOGON__(category, loglevel)                                          \
+  ((category != NULL) && log4c_category_is_priority_enabled(category, loglevel))
+
 #define __LOG4C__(category, format, loglevel, ...)                             \
-  log4c_category_log(category, loglevel, format, ##__VA_ARGS__)
+  do {                                                                         \
+    if (__LOGON__(category, loglevel))                                         \
+      alog_log(category, loglevel, format, ##__VA_ARGS__);                     \
+  } while (0)
+
+/* make NODEBUG=1 (RNGIN_NODEBUG) compiles debug and trace logging out */
+#ifdef RNGIN_NODEBUG
+#define __LOGDB__(category, format, loglevel, ...)                             \
+  do {                                                                         \
+    if (0)                                                                     \
+      alog_log(category, loglevel, "[%s] [%s:%d] " format, __func__,           \
+               __SHORT_FILE__, __LINE__, ##__VA_ARGS__);                       \
+  } while (0)
+#else
 #define __LOGDB__(category, format, loglevel, ...)                             \
-  log4c_category_log(category, loglevel, "[%s] [%s:%d] " format, __func__,     \
-                     __SHORT_FILE__, __LINE__, ##__VA_ARGS__)
+  do {                                                                         \
+    if (__LOGON__(category, loglevel))                                         \
+      alog_log(category, loglevel, "[%s] [%s:%d] " format, __func__,           \
+               __SHORT_FILE__, __LINE__, ##__VA_ARGS__);                       \
+  } while (0)
+#endif
 
 #define LOG4FATAL(category, format, ...)                                       \
   __LOG4C__(category, format, LOG4C_PRIORITY_FATAL, ##__VA_ARGS__)
@@ -199,6 +261,21 @@
 typedef struct CFG {
   const char *dbfile;
   const char *rulefile;
+  s_arena_t *arena;
+  /* per-request deadline (ms, 0: none) and number of exceeded deadlines */
+  long deadline;
+  unsigned long timeouts;
+  /* admission control: requests per poll round before shedding (0: off) */
+  int watermark;
+  int backlog;
+  unsigned long shed;
+  /* stopping after a handoff, responses close their connection */
+  bool draining;
+  /* precomputed shed response (default route) */
+  char *shedtarget;
+  int shedstatus;
+  char *shedjson;
+  size_t shedjsonlen;
 } s_cfg_t;
 
 typedef struct ATTR {
@@ -231,6 +308,18 @@ typedef struct HDRLIST {
   int count;
 } s_hdrlist_t;
 
+typedef struct SIPHDR {
+  /* headers in message order, compact names in long form (f: From) */
+  s_hdrlist_t list;
+  /* per header: name hash and next header of the same name (-1: last) */
+  unsigned int *hash;
+  int *next;
+  /* first and last header per name, open addressing (-1: free slot) */
+  int *first;
+  int *last;
+  unsigned int mask;
+} s_siphdr_t;
+
 typedef struct RULE {
   char *name;
   char *id;
@@ -261,10 +350,41 @@ typedef struct RULELIST {
   int maxhits;
 } s_rulelist_t;
 
+typedef struct URI {
+  /* as received, e.g. <sip:alice@example.com>;tag=1 (NULL: missing) */
+  const char *raw;
+  /* sip, sips or tel uri without port (extract_sipuri, NULL: none) */
+  char *uri;
+  /* components of uri (NULL: not present) */
+  char *scheme;
+  char *user;
+  char *host;
+  char *params;
+} s_uri_t;
+
+typedef struct CONTEXT {
+  s_uri_t ruri;
+  s_uri_t next;
+  s_uri_t from;
+  s_uri_t to;
+} s_context_t;
+
 typedef struct INPUT {
   char *ruri;
   char *next;
   char *shdr;
+  size_t shdrlen;
+  /* uris parsed once per request (parse_context), read by the conditions */
+  s_context_t ctx;
+  unsigned int tindex;
+  unsigned int tlabel;
+  /* response outcome (M_OUT_*) */
+  int outcome;
+  /* response cache key hash of ruri, next and the SIP message (0: not
+     looked up) */
+  unsigned long hash;
+  /* processing time by stage (P_*, us) */
+  double stage[P_COUNT];
 } s_input_t;
 
 typedef struct QUERY {
@@ -273,6 +393,25 @@ typedef struct QUERY {
   int length;
 } s_query_t;
 
+typedef struct QSTATE {
+  char *uri;
+  s_query_t query;
+  int res;
+} s_qstate_t;
+
+typedef struct QSNAP {
+  const char *dbfile;
+  struct sqlite3 *db;
+  s_qstate_t *qstate;
+  int count;
+  bool memo;
+  /* evaluation deadline (monotonic us, 0: none) */
+  double deadline;
+  bool expired;
+  /* time spent in queue state database lookups (us) */
+  double usec;
+} s_qsnap_t;
+
 /****************************************************************** GLOBALS */
 
 log4c_category_t *pL;
@@ -284,8 +423,13 @@ static const unsigned char base64_table[65] =
 
 /****************************************************************PROTOTYPES */
 
-int sqlite_QUERY(s_query_t *, char *, const char *);
+int sqlite_QUERY(s_query_t *, char *, s_qsnap_t *);
+int sqlite_QUERYSNAP(s_query_t *, char *, s_qsnap_t *);
+int sqlite_SNAPSHOT(s_qsnap_t *);
+void sqlite_RELEASE(s_qsnap_t *);
 int sqlite_CHECK(const char *);
+int sqlite_OPEN(const char *);
+void sqlite_CLOSE(void);
 
 unsigned char *base64_encode(const unsigned char *, size_t, size_t *);
 unsigned char *base64_decode(const unsigned char *, size_t, size_t *);
@@ -297,7 +441,10 @@ char *extract_string(const char *, const char *, const char *);
 char *trim_string(char *str, size_t *len);
 char *parse_string(char *, size_t, int);
 char *extract_sipuri(const char *);
+void parse_uri(s_uri_t *, const char *);
+void parse_context(s_input_t *, s_siphdr_t *);
 int parse_integer(char *, int);
+double get_usec(void);
 
 s_hdr_t **new_list(s_hdr_t **, int);
 void init_list(s_hdr_t *);
@@ -309,7 +456,7 @@ void init_query(s_query_t *);
 void delete_query(s_query_t *);
 int remove_list_hdr(s_hdrlist_t *);
 int append_list_hdr(s_hdrlist_t *, const char *, const char *);
-s_hdrlist_t *parse_list_crlf(const char *, const char *);
+s_siphdr_t *parse_sipheader(char *, size_t);
 s_hdrlist_t *parse_list_comma(const char *, const char *);
 s_rule_t **new_rule(s_rule_t **, int);
 s_queue_t **new_queue(s_queue_t **, int);
@@ -319,7 +466,15 @@ s_rule_t *new_ruleitem(void);
 s_queue_t *new_queueitem(void);
 const s_attr_t *get_scanner(const s_attr_t *, const char *);
 char *get_listvalbyname(s_hdrlist_t *, const char *);
+const char *get_sipname(const char *);
+int get_sipheader(const s_siphdr_t *, const char *);
+char *get_sipvalue(const s_siphdr_t *, const char *);
+char *get_defaultroute(s_rule_t *);
 int get_queuebyprio(s_quelist_t *, const int);
+void init_qsnap(s_qsnap_t *, const char *, bool);
+void set_deadline(s_qsnap_t *, long);
+bool check_deadline(s_qsnap_t *);
+int get_queuestate(s_qsnap_t *, s_query_t *, char *);
 
 bool check_time(char *, char *);
 bool check_string(const char *, const char *);
@@ -327,23 +482,29 @@ bool check_queuestate(const char *, const char *);
 bool check_queuesize(char *, int, int);
 
 bool cond_day(const char *, s_rule_t *);
-bool cond_nexturi(const char *, s_rule_t *);
-bool cond_ruri(const char *, s_rule_t *);
-bool cond_header(s_hdrlist_t *, s_rule_t *, s_hdrlist_t *);
-bool cond_queue(s_quelist_t *, s_rule_t *, s_input_t *, char *, const char *);
+bool cond_nexturi(const s_uri_t *, s_rule_t *);
+bool cond_ruri(const s_uri_t *, s_rule_t *);
+bool cond_header(s_hdrlist_t *, s_rule_t *, s_siphdr_t *);
+bool cond_queue(s_quelist_t *, s_rule_t *, s_input_t *, char *, s_qsnap_t *);
 bool cond_time(s_hdrlist_t *, s_rule_t *);
 bool cond_setroute(s_quelist_t *, s_rule_t *, s_input_t *, char *);
 
 void set_state(const char *, int *);
 
 s_rulelist_t *parse_rule(const char *);
+s_rulelist_t *parse_rule_string(const char *, size_t);
+char *read_rule(const char *, size_t *);
 void init_rule(s_rule_t *);
 void delete_rule(s_rulelist_t *);
 void print_rule(s_rulelist_t *, bool);
-void validate_rule(s_input_t *, s_rulelist_t *, s_hdrlist_t *, const char *);
-void select_rule(s_input_t *, s_rulelist_t *, s_hdrlist_t *);
+void validate_rule(s_input_t *, s_rulelist_t *, s_siphdr_t *, s_qsnap_t *);
+void select_rule(s_input_t *, s_rulelist_t *, s_siphdr_t *);
 
-void *get_jsonresponse(s_rulelist_t *, char *, size_t *);
+size_t get_jsonresponse(struct mbuf *, s_rulelist_t *, s_input_t *);
+int init_shed(s_cfg_t *);
+void delete_shed(s_cfg_t *);
+bool admit_request(s_cfg_t *);
 void ev_handler(struct mg_connection *, int, void *);
+void ev_binhandler(struct mg_connection *, int, void *);
 
 #endif // FUNCTIONS_H_INCLUDED
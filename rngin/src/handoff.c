@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * requires: liblog4c-dev
+ */
+
+/**
+ *  @file    handoff.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief this file holds the listening socket handoff definitions
+ *
+ *  A restarted rngin (-H) connects to the handoff socket of the running
+ *  one and receives its listening sockets (SCM_RIGHTS). Both accept on
+ *  them until the old process has stopped accepting and drained its
+ *  connections, so clients never see a refused connection.
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "functions.h"
+#include "handoff.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  receives the listening sockets of a running rngin from its
+ *          handoff socket (socks: HANDOFF_SOCKS entries, -1 if none)
+ *
+ *  @arg    const char*, int*
+ *  @return int (0: received, -1: no running rngin or error)
+ */
+
+int handoff_recv(const char *path, int *socks) {
+
+  struct sockaddr_un sun;
+  struct timeval tv;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg = NULL;
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * HANDOFF_SOCKS)];
+    struct cmsghdr align;
+  } ctl;
+  s_handoff_t hdr;
+  int fds[HANDOFF_SOCKS];
+  int num = 0;
+  int sock;
+  int i;
+  int n;
+
+  for (i = 0; i < HANDOFF_SOCKS; i++) {
+    socks[i] = -1;
+  }
+
+  if (strlen(path) >= sizeof(sun.sun_path)) {
+    LOG4ERROR(pL, "unix socket path too long: %s", path);
+    return -1;
+  }
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+
+  if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+    LOG4ERROR(pL, "could not create unix socket: %s", strerror(errno));
+    return -1;
+  }
+
+  /* no running rngin */
+  if (connect(sock, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+    LOG4DEBUG(pL, "no rngin to take over from at %s: %s", path,
+              strerror(errno));
+    close(sock);
+    return -1;
+  }
+
+  tv.tv_sec = HANDOFF_TIMEOUT_MS / 1000;
+  tv.tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&ctl, 0, sizeof(ctl));
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl.buf;
+  msg.msg_controllen = sizeof(ctl.buf);
+
+  n = (int)recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  close(sock);
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+      num = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+      if (num > HANDOFF_SOCKS) {
+        num = HANDOFF_SOCKS;
+      }
+      memcpy(fds, CMSG_DATA(cmsg), num * sizeof(int));
+    }
+  }
+
+  if ((n != (int)sizeof(hdr)) ||
+      (memcmp(hdr.magic, HANDOFF_MAGIC, sizeof(hdr.magic)) != 0)) {
+    LOG4ERROR(pL, "invalid handoff from %s", path);
+    for (i = 0; i < num; i++) {
+      close(fds[i]);
+    }
+    return -1;
+  }
+
+  /* sockets follow in order of the present flags */
+  for (i = 0, n = 0; i < HANDOFF_SOCKS; i++) {
+    if (hdr.present[i] && (n < num)) {
+      socks[i] = fds[n++];
+    }
+  }
+
+  LOG4INFO(pL, "took over %d listening sockets from %s", num, path);
+
+  return 0;
+}
+
+/**
+ *  @brief  sends the listening sockets (HANDOFF_SOCKS entries, -1 if none)
+ *          to a restarted rngin connected to the handoff socket
+ *
+ *  @arg    int, const int*
+ *  @return int (0 or -1)
+ */
+
+int handoff_send(int sock, const int *socks) {
+
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg = NULL;
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * HANDOFF_SOCKS)];
+    struct cmsghdr align;
+  } ctl;
+  s_handoff_t hdr;
+  int fds[HANDOFF_SOCKS];
+  int num = 0;
+  int i;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, HANDOFF_MAGIC, sizeof(hdr.magic));
+  for (i = 0; i < HANDOFF_SOCKS; i++) {
+    if (socks[i] >= 0) {
+      hdr.present[i] = 1;
+      fds[num++] = socks[i];
+    }
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&ctl, 0, sizeof(ctl));
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (num > 0) {
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * num);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num);
+  }
+
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(hdr)) {
+    LOG4ERROR(pL, "could not hand over listening sockets: %s", strerror(errno));
+    return -1;
+  }
+
+  LOG4INFO(pL, "handed over %d listening sockets", num);
+
+  return 0;
+}
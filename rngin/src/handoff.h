@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/**
+ *  @file    handoff.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief listening socket handoff header file
+ */
+
+#ifndef HANDOFF_H_INCLUDED
+#define HANDOFF_H_INCLUDED
+
+/******************************************************************** DEFINE */
+
+#define HANDOFF_MAGIC "RNGIN1"
+
+/* listening sockets handed over: http, unix http, binary */
+#define HANDOFF_SOCKS 3
+
+/* wait for the running rngin to answer (ms) */
+#define HANDOFF_TIMEOUT_MS 2000
+
+/******************************************************************* TYPEDEF */
+
+typedef struct HANDOFF {
+  char magic[sizeof(HANDOFF_MAGIC)];
+  /* 1: socket i follows in SCM_RIGHTS */
+  unsigned char present[HANDOFF_SOCKS];
+} s_handoff_t;
+
+/****************************************************************PROTOTYPES */
+
+int handoff_recv(const char *, int *);
+int handoff_send(int, const int *);
+
+#endif // HANDOFF_H_INCLUDED
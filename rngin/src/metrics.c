@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * requires: libyaml-dev, liblog4c-dev, sqlite3
+ */
+
+/**
+ *  @file    metrics.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief this file holds the runtime metrics function definitions
+ *
+ *  Recording is a relaxed atomic increment, latencies go to histograms
+ *  with power of two (microsecond) buckets. metrics_write renders all
+ *  values in the Prometheus text format. Before workers are forked, the
+ *  metrics move to shared memory, so all workers record into and report
+ *  the same values.
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "functions.h"
+#include <stdarg.h>
+#include <sys/mman.h>
+
+/******************************************************************** DEFINE */
+
+#define METRICS_LINE 256
+
+/********************************************************************* CONST */
+
+static const char *out_label[] = {"rule", "next", "fallback", "shed",
+                                  "error"};
+
+static const char *stage_label[] = {"json",  "base64", "siphdr", "rules",
+                                    "eval",  "queue",  "select", "serialize"};
+
+static const struct {
+  const char *name;
+  const char *help;
+} hist_name[H_STAGE + 1] = {
+    {"rngin_request_duration_seconds", "request processing time"},
+    {"rngin_db_query_duration_seconds", "queue state database lookup time"},
+    {"rngin_stage_duration_seconds", "request processing time by stage"},
+};
+
+static const double quantiles[] = {0.5, 0.99, 0.999};
+
+/******************************************************************* GLOBALS */
+
+static s_metrics_t local;
+static s_metrics_t *pMetrics = &local;
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  moves the metrics to memory shared with processes forked later
+ *          (call before the workers are forked)
+ *
+ *  @arg    void
+ *  @return int (0 or -1 on error)
+ */
+
+int metrics_share(void) {
+
+  s_metrics_t *shared;
+
+  if (pMetrics != &local) {
+    return 0;
+  }
+
+  shared = mmap(NULL, sizeof(s_metrics_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    LOG4ERROR(pL, "could not map shared metrics: %s", strerror(errno));
+    return -1;
+  }
+
+  /* still single threaded, nothing records meanwhile */
+  memcpy(shared, &local, sizeof(s_metrics_t));
+  pMetrics = shared;
+
+  return 0;
+}
+
+/**
+ *  @brief  increments a counter (M_*)
+ *
+ *  @arg    int
+ *  @return void
+ */
+
+void metrics_inc(int id) {
+
+  atomic_fetch_add_explicit(&pMetrics->counter[id], 1, memory_order_relaxed);
+}
+
+/**
+ *  @brief  records a latency (microseconds) in histogram id (H_*)
+ *
+ *  @arg    int, double
+ *  @return void
+ */
+
+void metrics_observe(int id, double usec) {
+
+  s_methist_t *hist = &pMetrics->hist[id];
+  unsigned long val = (usec > 0) ? (unsigned long)usec : 0;
+  int i = 0;
+
+  /* smallest i with val <= 2^i */
+  if (val > 1) {
+    i = 64 - __builtin_clzl(val - 1);
+  }
+  if (i >= H_BUCKETS) {
+    i = H_BUCKETS - 1;
+  }
+
+  atomic_fetch_add_explicit(&hist->bucket[i], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->sum, val, memory_order_relaxed);
+}
+
+/**
+ *  @brief  appends a formatted line
+ *
+ *  @arg    struct mbuf*, const char*, ...
+ *  @return void
+ */
+
+static void put_line(struct mbuf *io, const char *fmt, ...) {
+
+  char line[METRICS_LINE];
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+
+  if (len > 0) {
+    mbuf_append(io, line, (size_t)len < sizeof(line) ? (size_t)len
+                                                      : sizeof(line) - 1);
+  }
+}
+
+/**
+ *  @brief  appends a histogram
+ *
+ *  @arg    struct mbuf*, int
+ *  @return void
+ */
+
+static void put_histogram(struct mbuf *io, int id) {
+
+  s_methist_t *hist = &pMetrics->hist[id];
+  const char *name = hist_name[id < H_STAGE ? id : H_STAGE].name;
+
+  /* stage histograms share one name, told apart by a stage label */
+  char label[METRICS_LINE / 4] = "";
+  char tag[METRICS_LINE / 4] = "";
+
+  unsigned long bucket[H_BUCKETS];
+  unsigned long cum = 0;
+  unsigned long count = 0;
+  int i;
+
+  for (i = 0; i < H_BUCKETS; i++) {
+    bucket[i] = atomic_load_explicit(&hist->bucket[i], memory_order_relaxed);
+    count += bucket[i];
+  }
+
+  if (id >= H_STAGE) {
+    snprintf(label, sizeof(label), "stage=\"%s\",", stage_label[id - H_STAGE]);
+    snprintf(tag, sizeof(tag), "{stage=\"%s\"}", stage_label[id - H_STAGE]);
+  }
+
+  if (id <= H_STAGE) {
+    put_line(io, "# HELP %s %s\n# TYPE %s histogram\n", name,
+             hist_name[id].help, name);
+  }
+  for (i = 0; i < H_BUCKETS - 1; i++) {
+    cum += bucket[i];
+    put_line(io, "%s_bucket{%sle=\"%g\"} %lu\n", name, label, (1UL << i) / 1e6,
+             cum);
+  }
+  put_line(io, "%s_bucket{%sle=\"+Inf\"} %lu\n", name, label, count);
+  put_line(io, "%s_sum%s %g\n", name, tag,
+           atomic_load_explicit(&hist->sum, memory_order_relaxed) / 1e6);
+  put_line(io, "%s_count%s %lu\n", name, tag, count);
+}
+
+/**
+ *  @brief  appends the estimated quantiles of a histogram (upper bucket
+ *          bound of the quantile)
+ *
+ *  @arg    struct mbuf*, int
+ *  @return void
+ */
+
+static void put_quantiles(struct mbuf *io, int id) {
+
+  s_methist_t *hist = &pMetrics->hist[id];
+  const char *name = hist_name[id < H_STAGE ? id : H_STAGE].name;
+
+  char label[METRICS_LINE / 4] = "";
+
+  unsigned long bucket[H_BUCKETS];
+  unsigned long cum = 0;
+  unsigned long count = 0;
+  size_t q;
+  int i;
+
+  for (i = 0; i < H_BUCKETS; i++) {
+    bucket[i] = atomic_load_explicit(&hist->bucket[i], memory_order_relaxed);
+    count += bucket[i];
+  }
+
+  if (id >= H_STAGE) {
+    snprintf(label, sizeof(label), "stage=\"%s\",",
+             stage_label[id - H_STAGE]);
+  }
+
+  if (id <= H_STAGE) {
+    put_line(io, "# TYPE %s_quantile gauge\n", name);
+  }
+  for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+    cum = 0;
+    for (i = 0; (i < H_BUCKETS - 1) && (count > 0); i++) {
+      cum += bucket[i];
+      if (cum >= count * quantiles[q]) {
+        break;
+      }
+    }
+    put_line(io, "%s_quantile{%squantile=\"%g\"} %g\n", name, label,
+             quantiles[q], (count > 0) ? (1UL << i) / 1e6 : 0);
+  }
+}
+
+/**
+ *  @brief  writes all metrics (Prometheus text format 0.0.4) to io
+ *
+ *  @arg    struct mbuf*
+ *  @return void
+ */
+
+void metrics_write(struct mbuf *io) {
+
+  int i;
+
+  put_line(io, "# HELP rngin_requests_total requests by outcome\n"
+               "# TYPE rngin_requests_total counter\n");
+  for (i = M_OUT_RULE; i <= M_OUT_ERROR; i++) {
+    put_line(io, "rngin_requests_total{outcome=\"%s\"} %lu\n",
+             out_label[i - M_OUT_RULE],
+             atomic_load_explicit(&pMetrics->counter[i], memory_order_relaxed));
+  }
+
+  put_line(io, "# HELP rngin_rules_loads_total rules file loads\n"
+               "# TYPE rngin_rules_loads_total counter\n"
+               "rngin_rules_loads_total %lu\n",
+           atomic_load_explicit(&pMetrics->counter[M_RULES_LOAD],
+                                memory_order_relaxed));
+  put_line(io, "# HELP rngin_rules_errors_total failed rules file loads\n"
+               "# TYPE rngin_rules_errors_total counter\n"
+               "rngin_rules_errors_total %lu\n",
+           atomic_load_explicit(&pMetrics->counter[M_RULES_ERROR],
+                                memory_order_relaxed));
+
+  put_line(io, "# HELP rngin_cache_lookups_total response cache lookups\n"
+               "# TYPE rngin_cache_lookups_total counter\n"
+               "rngin_cache_lookups_total{result=\"hit\"} %lu\n"
+               "rngin_cache_lookups_total{result=\"miss\"} %lu\n",
+           atomic_load_explicit(&pMetrics->counter[M_CACHE_HIT],
+                                memory_order_relaxed),
+           atomic_load_explicit(&pMetrics->counter[M_CACHE_MISS],
+                                memory_order_relaxed));
+
+  /* queue state cache (-q) */
+  if (qcache_age() >= 0) {
+    put_line(io, "# HELP rngin_queue_cache_age_seconds time since the queue "
+                 "states were last known current\n"
+                 "# TYPE rngin_queue_cache_age_seconds gauge\n"
+                 "rngin_queue_cache_age_seconds %.6f\n",
+             qcache_age());
+    put_line(io, "# HELP rngin_queue_cache_loads_total queues table loads\n"
+                 "# TYPE rngin_queue_cache_loads_total counter\n"
+                 "rngin_queue_cache_loads_total %lu\n",
+             atomic_load_explicit(&pMetrics->counter[M_QCACHE_LOAD],
+                                  memory_order_relaxed));
+    put_line(io, "# HELP rngin_queue_lookups_total queue state lookups by "
+                 "source\n"
+                 "# TYPE rngin_queue_lookups_total counter\n"
+                 "rngin_queue_lookups_total{source=\"cache\"} %lu\n"
+                 "rngin_queue_lookups_total{source=\"database\"} %lu\n",
+             atomic_load_explicit(&pMetrics->counter[M_QCACHE_HIT],
+                                  memory_order_relaxed),
+             atomic_load_explicit(&pMetrics->counter[M_QCACHE_STALE],
+                                  memory_order_relaxed));
+  }
+
+  put_line(io, "# HELP rngin_log_dropped_total log records dropped\n"
+               "# TYPE rngin_log_dropped_total counter\n"
+               "rngin_log_dropped_total %lu\n",
+           atomic_load_explicit(&pMetrics->counter[M_LOG_DROP],
+                                memory_order_relaxed));
+
+  /* all samples of a metric name are grouped (stage histograms) */
+  for (i = 0; i < H_COUNT; i++) {
+    put_histogram(io, i);
+  }
+  for (i = 0; i < H_COUNT; i++) {
+    put_quantiles(io, i);
+  }
+}
+
+/**
+ *  @brief  name of a processing stage (P_*)
+ *
+ *  @arg    int
+ *  @return const char*
+ */
+
+const char *metrics_stage(int id) {
+
+  if ((id < 0) || (id >= P_COUNT)) {
+    return "";
+  }
+
+  return stage_label[id];
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    metrics.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief runtime metrics (counters, latency histograms) header file
+ */
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+/******************************************************************* INCLUDE */
+
+#include <stdatomic.h>
+
+/******************************************************************** DEFINE */
+
+/* request outcomes */
+#define M_OUT_RULE 0
+#define M_OUT_NEXT 1
+#define M_OUT_FALLBACK 2
+#define M_OUT_SHED 3
+#define M_OUT_ERROR 4
+/* rules file loads */
+#define M_RULES_LOAD 5
+#define M_RULES_ERROR 6
+/* response cache lookups */
+#define M_CACHE_HIT 7
+#define M_CACHE_MISS 8
+/* queue state lookups with the queue state cache on */
+#define M_QCACHE_HIT 9
+#define M_QCACHE_STALE 10
+/* queue state cache table loads */
+#define M_QCACHE_LOAD 11
+/* log records dropped, log ring full */
+#define M_LOG_DROP 12
+#define M_COUNTERS 13
+
+/* request processing stages */
+#define P_JSON 0
+#define P_BASE64 1
+#define P_SIPHDR 2
+#define P_RULES 3
+#define P_EVAL 4
+#define P_QUEUE 5
+#define P_SELECT 6
+#define P_SERIALIZE 7
+#define P_COUNT 8
+
+/* latency histograms, one per stage from H_STAGE on */
+#define H_REQUEST 0
+#define H_DBQUERY 1
+#define H_STAGE 2
+#define H_COUNT (H_STAGE + P_COUNT)
+
+/* bucket i counts values <= 2^i us, the last bucket is +Inf */
+#define H_BUCKETS 24
+
+/******************************************************************* TYPEDEF */
+
+typedef struct METHIST {
+  atomic_ulong bucket[H_BUCKETS];
+  atomic_ulong count;
+  atomic_ulong sum;
+} s_methist_t;
+
+typedef struct METRICS {
+  atomic_ulong counter[M_COUNTERS];
+  s_methist_t hist[H_COUNT];
+} s_metrics_t;
+
+/****************************************************************PROTOTYPES */
+
+struct mbuf;
+
+int metrics_share(void);
+void metrics_inc(int);
+void metrics_observe(int, double);
+void metrics_write(struct mbuf *);
+
+const char *metrics_stage(int);
+
+#endif // METRICS_H_INCLUDED
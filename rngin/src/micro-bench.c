@@ -0,0 +1,541 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    micro-bench.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief microbenchmarks of the rngin request path functions (make bench)
+ *
+ *  Each function runs on fixed, realistic inputs (a Kamailio INVITE header
+ *  block, the rules below) until the minimum run time is reached. As in
+ *  rngin every operation allocates from a request arena that is reset
+ *  afterwards (-l: libc allocations instead). Reports ns/op, arena and heap
+ *  allocations/op; heap allocations are counted by interposing malloc, so
+ *  they include library allocations (libyaml).
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "functions.h"
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/******************************************************************** DEFINE */
+
+/* default minimum run time per benchmark (ms) */
+#define BENCH_MS 200
+
+#define SIP_HDRS                                                               \
+  "Via: SIP/2.0/TCP 10.0.0.1:5060;branch=z9hG4bK776asdhds;rport\r\n"           \
+  "Max-Forwards: 69\r\n"                                                       \
+  "From: <sip:user@dec112.at>;tag=1928301774\r\n"                              \
+  "To: <sip:9144@root.dects.dec112.eu>\r\n"                                    \
+  "Call-ID: a84b4c76e66710@pc33.dec112.at\r\n"                                 \
+  "CSeq: 314159 INVITE\r\n"                                                    \
+  "Contact: <sip:user@10.0.0.1:5060;transport=tcp>\r\n"                        \
+  "Route: <sip:border@border.dects.dec112.eu;lr>\r\n"                          \
+  "Geolocation: <cid:target123@dec112.at>\r\n"                                 \
+  "Geolocation-Routing: yes\r\n"                                               \
+  "User-Agent: DEC112 App 1.4\r\n"                                             \
+  "Content-Type: multipart/mixed;boundary=boundary1\r\n"                       \
+  "Content-Length: 1224\r\n"
+
+#define SIP_URI "<sip:user@dec112.at;transport=tcp>;tag=1928301774"
+
+/* queue state database, one of QUEUE_ROWS queues is looked up */
+#define QUEUE_ROWS 16
+/* queue state cache refresh interval (ms) */
+#define QUEUE_REFRESH 100
+#define QUEUE_URI "sip:border@border.dects.dec112.eu"
+#define QUEUES                                                                 \
+  "CREATE TABLE queues (uri VARCHAR(64), state VARCHAR(16), "                  \
+  "dequeuer VARCHAR(64), max INT, length INT, PRIMARY KEY(uri));"
+
+#define RULES                                                                  \
+  "# prf rule 0\n"                                                             \
+  "- rule: DECTS default\n"                                                    \
+  "  id: R0\n"                                                                 \
+  "  priority: 1\n"                                                            \
+  "  default: sip:border@border.dects.dec112.eu\n"                             \
+  "  transport: tcp\n"                                                         \
+  "  - actions:\n"                                                             \
+  "    add: >\n"                                                               \
+  "      Call-Info: <urn:dec112:endpoint:chat:service.dec112.at>;"             \
+  "purpose=dec112-ServiceId\n"                                                 \
+  "# prf rule 1\n"                                                             \
+  "- rule: DECTS sos\n"                                                        \
+  "  id: R1\n"                                                                 \
+  "  priority: 1\n"                                                            \
+  "  default: sip:border@border.dects.dec112.eu\n"                             \
+  "  transport: tcp\n"                                                         \
+  "  - conditions:\n"                                                          \
+  "    ruri: urn:service:sos\n"                                                \
+  "    day: SUN MON TUE WED THU FRI SAT\n"                                     \
+  "    time: RANGE 00:00-23:59\n"                                              \
+  "    header: >\n"                                                            \
+  "      To: sip:9144@root.dects.dec112.eu,\n"                                 \
+  "      To: _9144,\n"                                                         \
+  "      From: _user\n"                                                        \
+  "  - actions:\n"                                                             \
+  "    add: >\n"                                                               \
+  "      Call-Info: <urn:dec112:endpoint:chat:service.dec112.at>;"             \
+  "purpose=dec112-ServiceId\n"                                                 \
+  "    route: sip:border-rule1@border.dects.dec112.eu\n"                       \
+  "# prf rule 2\n"                                                             \
+  "- rule: DECTS sos.ambulance\n"                                              \
+  "  id: R2\n"                                                                 \
+  "  priority: 1\n"                                                            \
+  "  default: sip:border@border.dects.dec112.eu\n"                             \
+  "  transport: tcp\n"                                                         \
+  "  - conditions:\n"                                                          \
+  "    ruri: urn:service:sos.ambulance\n"                                      \
+  "    header: >\n"                                                            \
+  "      To: sip:9144@root.dects.dec112.eu\n"                                  \
+  "  - actions:\n"                                                             \
+  "    add: >\n"                                                               \
+  "      Call-Info: <urn:dec112:endpoint:chat:service.dec112.at>;"             \
+  "purpose=dec112-ServiceId\n"                                                 \
+  "    route: sip:border@border.dects.dec112.eu\n"
+
+#define ERROR_PRINT(fmt, args...)                                              \
+  fprintf(stderr, "ERROR: %s():%d: " fmt, __func__, __LINE__, ##args)
+
+/******************************************************************* TYPEDEF */
+
+typedef struct MBENCH {
+  const char *name;
+  void (*run)(void);
+} s_mbench_t;
+
+/******************************************************************* GLOBALS */
+
+/* heap allocations (malloc, calloc, realloc) */
+static unsigned long heap_allocs = 0;
+
+/* fixed inputs, set up once (libc memory) */
+static char *b64 = NULL;
+static char shdr[sizeof(SIP_HDRS)];
+static char rulefile[] = "/tmp/micro-bench-XXXXXX";
+static char dbfile[] = "/tmp/micro-bench-db-XXXXXX";
+static char queueuri[] = QUEUE_URI;
+static s_rulelist_t *rulelist = NULL;
+static s_siphdr_t *sipheader = NULL;
+static s_rule_t *rule = NULL;
+static s_input_t input;
+static struct mbuf io;
+
+/* keeps results alive */
+static volatile size_t sink = 0;
+
+/************************************************************* HEAP COUNTING */
+
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+
+void *malloc(size_t size) {
+  heap_allocs++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  heap_allocs++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  heap_allocs++;
+  return __libc_realloc(ptr, size);
+}
+
+/**************************************************************** BENCHMARKS */
+
+static void run_base64_decode(void) {
+  size_t len = 0;
+  unsigned char *res =
+      base64_decode((unsigned char *)b64, strlen(b64), &len);
+
+  sink += len;
+  arena_free(res);
+}
+
+static void run_parse_sipheader(void) {
+  s_siphdr_t *index = NULL;
+
+  /* the headers are tokenized in place, start from a fresh copy */
+  memcpy(shdr, SIP_HDRS, sizeof(SIP_HDRS));
+  index = parse_sipheader(shdr, sizeof(SIP_HDRS) - 1);
+
+  /* one allocation, names and values point into shdr */
+  sink += index ? index->list.count : 0;
+  arena_free(index);
+}
+
+static void run_get_sipheader(void) {
+  /* compact form, the last header of the block */
+  sink += get_sipheader(sipheader, "l");
+}
+
+static void run_extract_sipuri(void) {
+  char *uri = extract_sipuri(SIP_URI);
+
+  sink += (uri != NULL);
+  delete_string(uri);
+}
+
+static void run_parse_context(void) {
+  parse_context(&input, sipheader);
+
+  sink += (input.ctx.next.host != NULL);
+}
+
+static void run_check_string_exact(void) {
+  sink += check_string("sip:9144@root.dects.dec112.eu",
+                       "sip:9144@root.dects.dec112.eu");
+}
+
+static void run_check_string_substr(void) {
+  sink += check_string("<sip:9144@root.dects.dec112.eu>", "_9144");
+}
+
+static void run_check_time(void) {
+  /* the times are tokenized in place */
+  char tfrom[] = "00:00";
+  char tto[] = "23:59";
+
+  sink += check_time(tfrom, tto);
+}
+
+static void run_cond_time(void) { sink += cond_time(rule->timelst, rule); }
+
+static void run_cond_header(void) {
+  sink += cond_header(rule->hdrlst, rule, sipheader);
+}
+
+static void run_get_queuestate(void) {
+  s_qsnap_t snap;
+  s_query_t query;
+
+  init_qsnap(&snap, dbfile, FALSE);
+  init_query(&query);
+  sink += (get_queuestate(&snap, &query, queueuri) == 0);
+}
+
+static void run_get_queuestate_snap(void) {
+  s_qsnap_t snap;
+  s_query_t query;
+
+  /* as for a request: read transaction, lookup, release */
+  init_qsnap(&snap, dbfile, TRUE);
+  init_query(&query);
+  sink += (get_queuestate(&snap, &query, queueuri) == 0);
+  sqlite_RELEASE(&snap);
+}
+
+static void run_qcache_lookup(void) {
+  s_query_t query;
+
+  /* started on first use, the database lookups above run without it */
+  while (qcache_age() < 0) {
+    if ((qcache_start(dbfile, QUEUE_REFRESH) != 0) || (usleep(1000) != 0)) {
+      break;
+    }
+  }
+  qcache_update();
+
+  init_query(&query);
+  sink += (qcache_lookup(queueuri, &query) == 0);
+}
+
+static void run_parse_rule(void) {
+  s_rulelist_t *rlist = parse_rule(rulefile);
+
+  sink += rlist ? rlist->count : 0;
+  if (rlist) {
+    delete_rule(rlist);
+  }
+}
+
+static void run_get_jsonresponse(void) {
+  io.len = 0;
+  sink += get_jsonresponse(&io, rulelist, &input);
+}
+
+static const s_mbench_t benchmarks[] = {
+    {"base64_decode", run_base64_decode},
+    {"parse_sipheader", run_parse_sipheader},
+    {"get_sipheader", run_get_sipheader},
+    {"extract_sipuri", run_extract_sipuri},
+    {"parse_context", run_parse_context},
+    {"check_string/exact", run_check_string_exact},
+    {"check_string/substr", run_check_string_substr},
+    {"check_time", run_check_time},
+    {"cond_time", run_cond_time},
+    {"cond_header", run_cond_header},
+    {"get_queuestate", run_get_queuestate},
+    {"get_queuestate/snapshot", run_get_queuestate_snap},
+    {"qcache_lookup", run_qcache_lookup},
+    {"parse_rule", run_parse_rule},
+    {"get_jsonresponse", run_get_jsonresponse},
+};
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  monotonic time in nanoseconds
+ *
+ *  @arg    void
+ *  @return double
+ */
+
+static double now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ *  @brief  creates the queue state database
+ *
+ *  @arg    void
+ *  @return int (0 or -1)
+ */
+
+static int init_queues(void) {
+  sqlite3 *db = NULL;
+  char sql[256];
+  int fd = mkstemp(dbfile);
+  int res = -1;
+  int i;
+
+  if (fd < 0) {
+    return -1;
+  }
+  close(fd);
+
+  if ((sqlite3_open(dbfile, &db) == SQLITE_OK) &&
+      (sqlite3_exec(db, QUEUES "BEGIN;", NULL, NULL, NULL) == SQLITE_OK)) {
+    res = 0;
+    for (i = 0; (i < QUEUE_ROWS) && (res == 0); i++) {
+      if (i == QUEUE_ROWS / 2) {
+        snprintf(sql, sizeof(sql),
+                 "INSERT INTO queues VALUES ('%s', 'active', 'x', 10, %d);",
+                 QUEUE_URI, i);
+      } else {
+        snprintf(sql, sizeof(sql),
+                 "INSERT INTO queues VALUES ('sip:q%d@esrp.dec112.eu', "
+                 "'active', 'x', 10, %d);",
+                 i, i);
+      }
+      res = (sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK) ? 0 : -1;
+    }
+    if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+      res = -1;
+    }
+  }
+  sqlite3_close(db);
+
+  return res;
+}
+
+/**
+ *  @brief  sets up the fixed inputs: encoded and parsed sip headers, rules
+ *          file, evaluated rules for the response writer
+ *
+ *  @arg    void
+ *  @return int (0 or -1)
+ */
+
+static int init_inputs(void) {
+  s_qsnap_t snap;
+  size_t len = 0;
+  int fd = -1;
+  int i;
+
+  b64 = (char *)base64_encode((unsigned char *)SIP_HDRS,
+                              sizeof(SIP_HDRS) - 1, &len);
+
+  fd = mkstemp(rulefile);
+  if ((fd < 0) || (write(fd, RULES, sizeof(RULES) - 1) !=
+                   (ssize_t)(sizeof(RULES) - 1))) {
+    ERROR_PRINT("could not write %s\n", rulefile);
+    return -1;
+  }
+  close(fd);
+
+  if (init_queues() != 0) {
+    ERROR_PRINT("could not write %s\n", dbfile);
+    return -1;
+  }
+
+  memcpy(shdr, SIP_HDRS, sizeof(SIP_HDRS));
+  sipheader = parse_sipheader(copy_string(shdr, sizeof(SIP_HDRS) - 1),
+                              sizeof(SIP_HDRS) - 1);
+  rulelist = parse_rule(rulefile);
+  if ((b64 == NULL) || (sipheader == NULL) || (rulelist == NULL)) {
+    ERROR_PRINT("could not set up inputs\n");
+    return -1;
+  }
+
+  for (i = 0; i < rulelist->count; i++) {
+    if (strcmp(rulelist->rules[i]->id, "R1") == 0) {
+      rule = rulelist->rules[i];
+    }
+  }
+  if ((rule == NULL) || (rule->timelst == NULL) || (rule->hdrlst == NULL)) {
+    ERROR_PRINT("rule R1 conditions missing\n");
+    return -1;
+  }
+
+  /* evaluated as in rngin, no queue conditions: no database */
+  memset(&input, 0, sizeof(input));
+  input.ruri = "urn:service:sos";
+  input.next = "sip:border@border.dects.dec112.eu";
+  input.tindex = 4711;
+  input.tlabel = 815;
+  init_qsnap(&snap, NULL, FALSE);
+  parse_context(&input, sipheader);
+  validate_rule(&input, rulelist, sipheader, &snap);
+  select_rule(&input, rulelist, sipheader);
+
+  mbuf_init(&io, 4096);
+
+  return 0;
+}
+
+/**
+ *  @brief  runs one benchmark until the minimum run time is reached
+ *
+ *  @arg    const s_mbench_t*, s_arena_t*, double
+ *  @return void
+ */
+
+static void run_bench(const s_mbench_t *bench, s_arena_t *arena,
+                      double min_ns) {
+  unsigned long ops = 0;
+  unsigned long batch = 1;
+  unsigned long allocs = 0;
+  unsigned long heap = 0;
+  unsigned long i;
+  double beg = 0;
+  double ns = 0;
+
+  /* warmup */
+  for (i = 0; i < 100; i++) {
+    bench->run();
+    if (arena) {
+      reset_arena(arena);
+    }
+  }
+
+  heap = heap_allocs;
+
+  while (ns < min_ns) {
+    beg = now_ns();
+    for (i = 0; i < batch; i++) {
+      bench->run();
+      if (arena) {
+        allocs += arena->allocs;
+        reset_arena(arena);
+      }
+    }
+    ns += now_ns() - beg;
+    ops += batch;
+    batch *= 2;
+  }
+
+  heap = heap_allocs - heap;
+
+  printf("%-22s %10lu %12.1f %12.2f %12.2f\n", bench->name, ops, ns / ops,
+         (double)allocs / ops, (double)heap / ops);
+}
+
+/********************************************************************** MAIN */
+int main(int argc, char *argv[]) {
+  s_arena_t *arena = NULL;
+
+  const char *filter = NULL;
+
+  double min_ns = BENCH_MS * 1e6;
+
+  int libc = 0;
+  int opt;
+  size_t i;
+
+  while ((opt = getopt(argc, argv, "t:f:l")) != -1) {
+    switch (opt) {
+    case 't':
+      min_ns = atoi(optarg) * 1e6;
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    case 'l':
+      libc = 1;
+      break;
+    default:
+      ERROR_PRINT("usage: micro-bench [-t ms per benchmark] [-f name filter] "
+                  "[-l (libc allocations)]\n");
+      exit(1);
+    }
+  }
+
+  /* no log4c: logging is off, as far as the log level check goes */
+  pL = NULL;
+
+  if (init_inputs() != 0) {
+    unlink(rulefile);
+    unlink(dbfile);
+    exit(1);
+  }
+
+  if (!libc) {
+    arena = new_arena(ARENA_BLKSIZE);
+    set_arena(arena);
+  }
+
+  printf("%-22s %10s %12s %12s %12s\n", "benchmark", "ops", "ns/op",
+         "arena/op", "heap/op");
+
+  for (i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+    if ((filter == NULL) || (strstr(benchmarks[i].name, filter) != NULL)) {
+      run_bench(&benchmarks[i], arena, min_ns);
+    }
+  }
+
+  set_arena(NULL);
+  delete_arena(arena);
+  mbuf_free(&io);
+  qcache_stop();
+  sqlite_CLOSE();
+  unlink(rulefile);
+  unlink(dbfile);
+
+  return 0;
+}
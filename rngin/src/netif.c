@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    netif.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief this file holds the event loop backend definitions
+ *
+ *  mongoose polls all connections with select() in every loop round, the
+ *  epoll backend is a mongoose network interface that only touches
+ *  connections with events. Sockets are registered edge-triggered, each
+ *  connection keeps whether it is readable and writable until a recv or
+ *  send runs into EAGAIN. Once per NETIF_SWEEP_MS all connections are
+ *  visited, this delivers MG_EV_POLL and timers (rngin uses neither) and
+ *  retries a throttled receive or a failed accept.
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "functions.h"
+#include "netif.h"
+#include "uring.h"
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+/******************************************************************* GLOBALS */
+
+/* mongoose socket interface (mg_net_if_socket.c), the epoll backend reuses
+ * everything but polling, sending and receiving */
+extern const struct mg_iface_vtable mg_socket_iface_vtable;
+
+void mg_socket_if_sock_set(struct mg_connection *, sock_t);
+void mg_socket_if_destroy_conn(struct mg_connection *);
+time_t mg_socket_if_poll(struct mg_iface *, int);
+
+static struct mg_iface_vtable epoll_vtable;
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  connection state (NETIF_*)
+ *
+ *  @arg    struct mg_connection*
+ *  @return int
+ */
+
+static int get_netstate(struct mg_connection *nc) {
+
+  return (int)(uintptr_t)nc->mgr_data;
+}
+
+/**
+ *  @brief  sets the connection state (NETIF_*)
+ *
+ *  @arg    struct mg_connection*, int
+ *  @return void
+ */
+
+static void set_netstate(struct mg_connection *nc, int state) {
+
+  nc->mgr_data = (void *)(uintptr_t)state;
+}
+
+/**
+ *  @brief  registers a connection socket (once)
+ *
+ *  @arg    struct mg_connection*
+ *  @return void
+ */
+
+static void add_epoll(struct mg_connection *nc) {
+
+  s_netif_t *netif = (s_netif_t *)nc->iface->data;
+  struct epoll_event ev;
+
+  if ((nc->sock == INVALID_SOCKET) || (get_netstate(nc) & NETIF_ADDED) ||
+      (netif == NULL) || (netif->epfd < 0)) {
+    return;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.ptr = nc;
+
+  if (epoll_ctl(netif->epfd, EPOLL_CTL_ADD, nc->sock, &ev) != 0) {
+    LOG4ERROR(pL, "could not register socket %d: %s", (int)nc->sock,
+              strerror(errno));
+    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+    return;
+  }
+
+  /* a new socket can be written, reading waits for the first event */
+  set_netstate(nc, NETIF_ADDED | NETIF_WRITABLE);
+}
+
+/**
+ *  @brief  creates the epoll instance (mongoose interface init)
+ *
+ *  @arg    struct mg_iface*
+ *  @return void
+ */
+
+static void epoll_init(struct mg_iface *iface) {
+
+  s_netif_t *netif = (s_netif_t *)calloc(1, sizeof(s_netif_t));
+
+  if (netif == NULL) {
+    LOG4ERROR(pL, "could not allocate memory");
+    return;
+  }
+
+  netif->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (netif->epfd < 0) {
+    LOG4ERROR(pL, "could not create epoll instance: %s", strerror(errno));
+  }
+  iface->data = netif;
+}
+
+/**
+ *  @brief  closes the epoll instance (mongoose interface free)
+ *
+ *  @arg    struct mg_iface*
+ *  @return void
+ */
+
+static void epoll_free(struct mg_iface *iface) {
+
+  s_netif_t *netif = (s_netif_t *)iface->data;
+
+  if (netif == NULL) {
+    return;
+  }
+
+  if (netif->epfd >= 0) {
+    close(netif->epfd);
+  }
+  free(netif);
+  iface->data = NULL;
+}
+
+/**
+ *  @brief  registers an outgoing connection, its socket is not set via
+ *          sock_set (mongoose interface add_conn)
+ *
+ *  @arg    struct mg_connection*
+ *  @return void
+ */
+
+static void epoll_add_conn(struct mg_connection *nc) { add_epoll(nc); }
+
+/**
+ *  @brief  associates and registers a socket (mongoose interface sock_set)
+ *
+ *  @arg    struct mg_connection*, sock_t
+ *  @return void
+ */
+
+static void epoll_sock_set(struct mg_connection *nc, sock_t sock) {
+
+  mg_socket_if_sock_set(nc, sock);
+  add_epoll(nc);
+}
+
+/**
+ *  @brief  unregisters and closes a socket (mongoose interface
+ *          destroy_conn)
+ *
+ *  @arg    struct mg_connection*
+ *  @return void
+ */
+
+static void epoll_destroy_conn(struct mg_connection *nc) {
+
+  s_netif_t *netif = (s_netif_t *)nc->iface->data;
+
+  if ((nc->sock != INVALID_SOCKET) && (get_netstate(nc) & NETIF_ADDED)) {
+    epoll_ctl(netif->epfd, EPOLL_CTL_DEL, nc->sock, NULL);
+  }
+  set_netstate(nc, 0);
+
+  mg_socket_if_destroy_conn(nc);
+}
+
+/**
+ *  @brief  sends data, EAGAIN clears the writable state (mongoose
+ *          interface tcp_send)
+ *
+ *  @arg    struct mg_connection*, const void*, size_t
+ *  @return int (bytes sent, -1 on error)
+ */
+
+static int epoll_tcp_send(struct mg_connection *nc, const void *buf,
+                          size_t len) {
+
+  ssize_t n;
+
+  do {
+    n = send(nc->sock, buf, len, MSG_NOSIGNAL);
+  } while ((n < 0) && (errno == EINTR));
+
+  if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+    set_netstate(nc, get_netstate(nc) & ~NETIF_WRITABLE);
+    return 0;
+  }
+
+  return (int)n;
+}
+
+/**
+ *  @brief  receives data, EAGAIN clears the readable state (mongoose
+ *          interface tcp_recv)
+ *
+ *  @arg    struct mg_connection*, void*, size_t
+ *  @return int (bytes received, -1 on error)
+ */
+
+static int epoll_tcp_recv(struct mg_connection *nc, void *buf, size_t len) {
+
+  ssize_t n;
+
+  do {
+    n = recv(nc->sock, buf, len, 0);
+  } while ((n < 0) && (errno == EINTR));
+
+  if (n == 0) {
+    /* orderly shutdown, flush the output */
+    set_netstate(nc, get_netstate(nc) & ~NETIF_READABLE);
+    nc->flags |= MG_F_SEND_AND_CLOSE;
+  } else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+    set_netstate(nc, get_netstate(nc) & ~NETIF_READABLE);
+    return 0;
+  }
+
+  return (int)n;
+}
+
+/**
+ *  @brief  accepts all pending connections of a listener
+ *
+ *  @arg    struct mg_connection*
+ *  @return void
+ */
+
+static void accept_conns(struct mg_connection *lc) {
+
+  struct mg_connection *nc = NULL;
+  union socket_address sa;
+  socklen_t len;
+  sock_t sock;
+
+  for (;;) {
+    len = sizeof(sa);
+    sock = accept(lc->sock, &sa.sa, &len);
+    if (sock == INVALID_SOCKET) {
+      if ((errno == EINTR) || (errno == ECONNABORTED)) {
+        continue;
+      }
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        set_netstate(lc, get_netstate(lc) & ~NETIF_READABLE);
+      } else {
+        /* e.g. out of descriptors, retried by the next sweep */
+        LOG4WARN(pL, "could not accept connection: %s", strerror(errno));
+      }
+      return;
+    }
+
+    nc = mg_if_accept_new_conn(lc);
+    if (nc == NULL) {
+      closesocket(sock);
+      continue;
+    }
+    nc->iface->vtable->sock_set(nc, sock);
+    mg_if_accept_tcp_cb(nc, &sa, len);
+  }
+}
+
+/**
+ *  @brief  sends pending data while the socket is writable, closes the
+ *          connection once it is done
+ *
+ *  @arg    struct mg_connection*, double
+ *  @return void
+ */
+
+static void flush_conn(struct mg_connection *nc, double now) {
+
+  while ((nc->send_mbuf.len > 0) && (get_netstate(nc) & NETIF_WRITABLE) &&
+         !(nc->flags & (MG_F_CLOSE_IMMEDIATELY | MG_F_CONNECTING))) {
+    mg_if_can_send_cb(nc);
+  }
+
+  if ((nc->flags & (MG_F_CLOSE_IMMEDIATELY | MG_F_RECV_AND_CLOSE)) ||
+      ((nc->flags & MG_F_SEND_AND_CLOSE) && (nc->send_mbuf.len == 0))) {
+    mg_if_poll(nc, now);
+  }
+}
+
+/**
+ *  @brief  handles the events of a connection (0: sweep)
+ *
+ *  @arg    struct mg_connection*, uint32_t, double
+ *  @return void
+ */
+
+static void handle_conn(struct mg_connection *nc, uint32_t events,
+                        double now) {
+
+  int state = get_netstate(nc);
+  int err = 0;
+  socklen_t len = sizeof(err);
+
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+    state |= NETIF_READABLE;
+  }
+  if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+    state |= NETIF_WRITABLE;
+  }
+  set_netstate(nc, state);
+
+  /* closes flagged connections, timers and MG_EV_POLL */
+  if (!mg_if_poll(nc, now)) {
+    return;
+  }
+
+  if (nc->flags & MG_F_CONNECTING) {
+    if (events != 0) {
+      if (getsockopt(nc->sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+        err = 1;
+      }
+      mg_if_connect_cb(nc, err);
+    } else if (nc->err != 0) {
+      mg_if_connect_cb(nc, nc->err);
+    }
+  }
+
+  if (get_netstate(nc) & NETIF_READABLE) {
+    if (nc->flags & MG_F_LISTENING) {
+      accept_conns(nc);
+    } else {
+      mg_if_can_recv_cb(nc);
+    }
+  }
+
+  flush_conn(nc, now);
+}
+
+/**
+ *  @brief  waits for and handles events (mongoose interface poll)
+ *
+ *  @arg    struct mg_iface*, int
+ *  @return time_t
+ */
+
+static time_t epoll_poll(struct mg_iface *iface, int timeout_ms) {
+
+  s_netif_t *netif = (s_netif_t *)iface->data;
+  struct mg_connection *nc = NULL;
+  struct mg_connection *tmp = NULL;
+  struct epoll_event ev[NETIF_EVENTS];
+
+  double now = mg_time();
+  int wait;
+  int num;
+  int i;
+
+  /* no epoll instance, all sockets are still in the connection list */
+  if ((netif == NULL) || (netif->epfd < 0)) {
+    return mg_socket_if_poll(iface, timeout_ms);
+  }
+
+  /* wake up for the next sweep at the latest */
+  wait = (int)((netif->sweep - now) * 1000) + 1;
+  if (wait > timeout_ms) {
+    wait = timeout_ms;
+  }
+  if (wait < 0) {
+    wait = 0;
+  }
+
+  num = epoll_wait(netif->epfd, ev, NETIF_EVENTS, wait);
+  if ((num < 0) && (errno != EINTR)) {
+    LOG4ERROR(pL, "epoll_wait failed: %s", strerror(errno));
+  }
+  now = mg_time();
+
+  /* a connection is only closed while its own events are handled */
+  for (i = 0; i < num; i++) {
+    handle_conn((struct mg_connection *)ev[i].data.ptr, ev[i].events, now);
+  }
+
+  if (now >= netif->sweep) {
+    for (nc = iface->mgr->active_connections; nc != NULL; nc = tmp) {
+      tmp = nc->next;
+      handle_conn(nc, 0, now);
+    }
+    netif->sweep = now + NETIF_SWEEP_MS / 1e3;
+  }
+
+  return (time_t)now;
+}
+
+/**
+ *  @brief  initializes the mongoose manager with an event loop backend
+ *          (NETIF_*, NULL: default), io_uring falls back to epoll and epoll
+ *          to select if the kernel does not support it
+ *
+ *  @arg    struct mg_mgr*, void*, const char*
+ *  @return int (0 or -1: unknown backend)
+ */
+
+int netif_init(struct mg_mgr *mgr, void *user_data, const char *name) {
+
+  struct mg_mgr_init_opts opts;
+  int fd;
+
+  memset(&opts, 0, sizeof(opts));
+
+  if (name == NULL) {
+    name = NETIF_DEFAULT;
+  }
+
+  if (strcmp(name, NETIF_URING) == 0) {
+    opts.main_iface = uring_iface();
+    if (opts.main_iface == NULL) {
+      LOG4WARN(pL, "using epoll instead of io_uring");
+      name = NETIF_EPOLL;
+    }
+  }
+
+  if (strcmp(name, NETIF_EPOLL) == 0) {
+    fd = epoll_create1(EPOLL_CLOEXEC);
+    if (fd < 0) {
+      LOG4WARN(pL, "epoll not available (%s), using select", strerror(errno));
+      name = NETIF_SELECT;
+    } else {
+      close(fd);
+      epoll_vtable = mg_socket_iface_vtable;
+      epoll_vtable.init = epoll_init;
+      epoll_vtable.free = epoll_free;
+      epoll_vtable.add_conn = epoll_add_conn;
+      epoll_vtable.poll = epoll_poll;
+      epoll_vtable.tcp_send = epoll_tcp_send;
+      epoll_vtable.tcp_recv = epoll_tcp_recv;
+      epoll_vtable.destroy_conn = epoll_destroy_conn;
+      epoll_vtable.sock_set = epoll_sock_set;
+      opts.main_iface = &epoll_vtable;
+    }
+  } else if ((opts.main_iface == NULL) && (strcmp(name, NETIF_SELECT) != 0)) {
+    LOG4ERROR(pL, "unknown event loop backend [%s]", name);
+    return -1;
+  }
+
+  mg_mgr_init_opt(mgr, user_data, opts);
+
+  LOG4INFO(pL, "event loop backend: %s", name);
+
+  return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    netif.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief event loop backend (mongoose network interface) header file
+ */
+
+#ifndef NETIF_H_INCLUDED
+#define NETIF_H_INCLUDED
+
+/******************************************************************** DEFINE */
+
+/* backend names (-e) */
+#define NETIF_SELECT "select"
+#define NETIF_EPOLL "epoll"
+#define NETIF_URING "uring"
+#define NETIF_DEFAULT NETIF_EPOLL
+
+/* events fetched per epoll_wait */
+#define NETIF_EVENTS 256
+/* interval of the sweep over all connections (timers, MG_EV_POLL, ms) */
+#define NETIF_SWEEP_MS 1000
+
+/* per connection state (mg_connection mgr_data) */
+#define NETIF_ADDED 1
+#define NETIF_READABLE 2
+#define NETIF_WRITABLE 4
+
+/******************************************************************* TYPEDEF */
+
+typedef struct NETIF {
+  int epfd;
+  /* next sweep (mg_time) */
+  double sweep;
+} s_netif_t;
+
+/****************************************************************PROTOTYPES */
+
+struct mg_mgr;
+
+int netif_init(struct mg_mgr *, void *, const char *);
+
+#endif // NETIF_H_INCLUDED
@@ -0,0 +1,857 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    prf-bench.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief PRF load generator (tcp or unix domain socket)
+ *
+ *  sends Kamailio-shaped PRF requests, either as http/json
+ *  (/api/v1/prf/req) or via the binary protocol (-B), from a number of
+ *  concurrent clients. Requests are built from templates (built-in or a
+ *  template file with SIP headers and/or captured PRF request json). Each
+ *  client keeps its connection for -k requests (0: for all requests).
+ *  Reports throughput, latency percentiles and a latency histogram. With
+ *  -i a number of idle connections is opened up front and held for the
+ *  whole run, the load then competes with many quiet connections.
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "prfclient.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+/******************************************************************** DEFINE */
+
+#define BUFSIZE 65536
+#define REQ_URI "/api/v1/prf/req"
+
+#define SIP_HDRS                                                               \
+  "Via: SIP/2.0/TCP 10.0.0.1:5060;branch=z9hG4bK776asdhds\r\n"                 \
+  "Max-Forwards: 69\r\n"                                                       \
+  "From: <sip:user@dec112.at>;tag=1928301774\r\n"                              \
+  "To: <sip:9144@root.dects.dec112.eu>\r\n"                                    \
+  "Call-ID: a84b4c76e66710@pc33.dec112.at\r\n"                                 \
+  "CSeq: 314159 INVITE\r\n"                                                    \
+  "Contact: <sip:user@10.0.0.1:5060;transport=tcp>\r\n"                        \
+  "Content-Type: application/sdp\r\n"                                          \
+  "Content-Length: 0\r\n"
+
+#define REQ_JSON                                                               \
+  "{\"tindex\":%u,\"tlabel\":%u,\"ruri\":\"%s\","                              \
+  "\"next\":\"%s\",\"request\":\"%s\"}"
+
+#define REQ_HTTP                                                               \
+  "POST " REQ_URI " HTTP/1.1\r\n"                                              \
+  "Host: prf\r\n"                                                              \
+  "Content-Type: application/json\r\n"                                         \
+  "Content-Length: %d\r\n\r\n%s"
+
+/* latency histogram buckets (bucket i: <= 2^i us) */
+#define HIST_BUCKETS 24
+#define HIST_BAR 40
+
+#define ERROR_PRINT(fmt, args...)                                              \
+  fprintf(stderr, "ERROR: %s():%d: " fmt, __func__, __LINE__, ##args)
+
+/******************************************************************* TYPEDEF */
+
+typedef struct TMPL {
+  char *ruri;
+  char *next;
+  /* raw sip header block (binary) and base64 encoded (http) */
+  char *shdr;
+  size_t shdrlen;
+  char *b64;
+  /* ruri and next escaped for the json body (http) */
+  char *jruri;
+  char *jnext;
+} s_tmpl_t;
+
+typedef struct BENCH {
+  const char *addr;
+  s_tmpl_t *tmpl;
+  int count;
+  int reuse;
+  int binary;
+  pthread_barrier_t barrier;
+} s_bench_t;
+
+typedef struct WORKER {
+  pthread_t thread;
+  s_bench_t *bench;
+  int id;
+  int warmup;
+  int requests;
+  /* latencies of successful requests */
+  double *lat;
+  int done;
+  int errors;
+  int connects;
+} s_worker_t;
+
+/******************************************************************* GLOBALS */
+
+static const char b64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  base64 encodes src (no line breaks, as Kamailio s.encode.base64)
+ *
+ *  @arg    const char*
+ *  @return char*
+ */
+
+static char *encode_base64(const char *src) {
+  size_t len = strlen(src);
+  char *out = malloc(len * 4 / 3 + 5);
+  char *pos = out;
+  size_t i;
+
+  if (out == NULL) {
+    return NULL;
+  }
+
+  for (i = 0; i + 2 < len; i += 3) {
+    *pos++ = b64[(unsigned char)src[i] >> 2];
+    *pos++ = b64[((src[i] & 0x03) << 4) | ((unsigned char)src[i + 1] >> 4)];
+    *pos++ = b64[((src[i + 1] & 0x0f) << 2) | ((unsigned char)src[i + 2] >> 6)];
+    *pos++ = b64[src[i + 2] & 0x3f];
+  }
+
+  if (i < len) {
+    *pos++ = b64[(unsigned char)src[i] >> 2];
+    if (i + 1 == len) {
+      *pos++ = b64[(src[i] & 0x03) << 4];
+      *pos++ = '=';
+    } else {
+      *pos++ = b64[((src[i] & 0x03) << 4) | ((unsigned char)src[i + 1] >> 4)];
+      *pos++ = b64[(src[i + 1] & 0x0f) << 2];
+    }
+    *pos++ = '=';
+  }
+
+  *pos = '\0';
+
+  return out;
+}
+
+/**
+ *  @brief  base64 decodes src (invalid characters are skipped)
+ *
+ *  @arg    const char*, size_t*
+ *  @return char* (NUL terminated)
+ */
+
+static char *decode_base64(const char *src, size_t *len) {
+  char *out = malloc(strlen(src) * 3 / 4 + 4);
+  const char *p = NULL;
+  unsigned int acc = 0;
+  int bits = 0;
+
+  *len = 0;
+  if (out == NULL) {
+    return NULL;
+  }
+
+  for (; *src != '\0' && *src != '='; src++) {
+    if ((p = strchr(b64, *src)) == NULL) {
+      continue;
+    }
+    acc = (acc << 6) | (unsigned int)(p - b64);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out[(*len)++] = (char)(acc >> bits);
+    }
+  }
+  out[*len] = '\0';
+
+  return out;
+}
+
+/**
+ *  @brief  gets a string attribute of a (captured) json request
+ *
+ *  @arg    const char*, const char*
+ *  @return char* (unescaped copy or NULL)
+ */
+
+static char *get_jsonstring(const char *json, const char *key) {
+  const char *pos = strstr(json, key);
+  char *out = NULL;
+  size_t n = 0;
+
+  if (pos == NULL) {
+    return NULL;
+  }
+  pos += strlen(key);
+  while ((*pos == ' ') || (*pos == ':')) {
+    pos++;
+  }
+  if ((*pos++ != '"') || ((out = malloc(strlen(pos) + 1)) == NULL)) {
+    return NULL;
+  }
+
+  for (; (*pos != '\0') && (*pos != '"'); pos++) {
+    if ((*pos == '\\') && (pos[1] != '\0')) {
+      pos++;
+      switch (*pos) {
+      case 'n':
+        out[n++] = '\n';
+        continue;
+      case 'r':
+        out[n++] = '\r';
+        continue;
+      case 't':
+        out[n++] = '\t';
+        continue;
+      }
+    }
+    out[n++] = *pos;
+  }
+  out[n] = '\0';
+
+  return out;
+}
+
+/**
+ *  @brief  escapes a string for a json string value (quotes, backslashes,
+ *          control characters)
+ *
+ *  @arg    const char*
+ *  @return char* (escaped copy or NULL)
+ */
+
+static char *escape_json(const char *str) {
+  const unsigned char *p = (const unsigned char *)str;
+  char *out = NULL;
+  size_t n = 0;
+
+  if ((str == NULL) || ((out = malloc(strlen(str) * 6 + 1)) == NULL)) {
+    return NULL;
+  }
+
+  for (; *p != '\0'; p++) {
+    if ((*p == '"') || (*p == '\\')) {
+      out[n++] = '\\';
+      out[n++] = *p;
+    } else if (*p < 0x20) {
+      n += sprintf(out + n, "\\u%04x", *p);
+    } else {
+      out[n++] = *p;
+    }
+  }
+  out[n] = '\0';
+
+  return out;
+}
+
+/**
+ *  @brief  appends a request template (ruri, next, sip header block)
+ *
+ *  @arg    s_bench_t*, char*, char*, char*, size_t
+ *  @return int (0 or -1)
+ */
+
+static int add_template(s_bench_t *bench, char *ruri, char *next, char *shdr,
+                        size_t shdrlen) {
+  s_tmpl_t *tmpl = NULL;
+
+  tmpl = realloc(bench->tmpl, (bench->count + 1) * sizeof(s_tmpl_t));
+  if ((tmpl == NULL) || (ruri == NULL) || (next == NULL) || (shdr == NULL)) {
+    ERROR_PRINT("invalid template %d\n", bench->count);
+    return -1;
+  }
+  bench->tmpl = tmpl;
+
+  tmpl = &bench->tmpl[bench->count++];
+  tmpl->ruri = ruri;
+  tmpl->next = next;
+  tmpl->shdr = shdr;
+  tmpl->shdrlen = shdrlen;
+  tmpl->b64 = encode_base64(shdr);
+  tmpl->jruri = escape_json(ruri);
+  tmpl->jnext = escape_json(next);
+
+  return ((tmpl->b64 != NULL) && (tmpl->jruri != NULL) &&
+          (tmpl->jnext != NULL))
+             ? 0
+             : -1;
+}
+
+/**
+ *  @brief  reads request templates: blocks of "<ruri> <next>" plus sip
+ *          header lines (separated by an empty line), or lines holding a
+ *          captured PRF request json
+ *
+ *  @arg    s_bench_t*, const char*
+ *  @return int (0 or -1)
+ */
+
+static int read_templates(s_bench_t *bench, const char *file) {
+  FILE *fp = fopen(file, "r");
+  char line[BUFSIZE];
+  char ruri[1024];
+  char next[1024];
+  char *shdr = NULL;
+  char *json = NULL;
+  size_t len = 0;
+  size_t n = 0;
+  int block = 0;
+  int res = 0;
+
+  if (fp == NULL) {
+    ERROR_PRINT("could not open %s\n", file);
+    return -1;
+  }
+
+  while ((res == 0) && (fgets(line, sizeof(line), fp) != NULL)) {
+    n = strcspn(line, "\r\n");
+    line[n] = '\0';
+
+    if (line[0] == '#') {
+      continue;
+    }
+
+    if ((!block) && ((json = strchr(line, '{')) != NULL)) {
+      /* captured request, the sip headers are base64 encoded */
+      shdr = get_jsonstring(json, "\"request\"");
+      if (shdr != NULL) {
+        char *raw = decode_base64(shdr, &len);
+        free(shdr);
+        shdr = raw;
+      }
+      res = add_template(bench, get_jsonstring(json, "\"ruri\""),
+                         get_jsonstring(json, "\"next\""), shdr, len);
+      continue;
+    }
+
+    if (!block) {
+      if (n == 0) {
+        continue;
+      }
+      next[0] = '\0';
+      if (sscanf(line, "%1023s %1023s", ruri, next) < 2) {
+        ERROR_PRINT("template needs \"<ruri> <next>\": %s\n", line);
+        res = -1;
+        break;
+      }
+      shdr = calloc(1, 1);
+      len = 0;
+      block = 1;
+      continue;
+    }
+
+    if (n == 0) {
+      res = add_template(bench, strdup(ruri), strdup(next), shdr, len);
+      block = 0;
+      continue;
+    }
+
+    /* sip header line, CRLF terminated */
+    if ((shdr = realloc(shdr, len + n + 3)) == NULL) {
+      res = -1;
+      break;
+    }
+    memcpy(shdr + len, line, n);
+    len += n;
+    memcpy(shdr + len, "\r\n", 3);
+    len += 2;
+  }
+
+  if ((res == 0) && block) {
+    res = add_template(bench, strdup(ruri), strdup(next), shdr, len);
+  }
+
+  fclose(fp);
+
+  if ((res == 0) && (bench->count == 0)) {
+    ERROR_PRINT("no templates in %s\n", file);
+    res = -1;
+  }
+
+  return res;
+}
+
+/**
+ *  @brief  reads one http response (chunked or content-length)
+ *
+ *  @arg    int, char*, size_t
+ *  @return int (response length or -1)
+ */
+
+static int read_response(int sock, char *buf, size_t size) {
+  size_t len = 0;
+  char *body = NULL;
+  char *clen = NULL;
+  ssize_t n;
+
+  for (;;) {
+    n = read(sock, buf + len, size - len - 1);
+    if (n <= 0) {
+      return -1;
+    }
+    len += n;
+    buf[len] = '\0';
+
+    if ((body = strstr(buf, "\r\n\r\n")) == NULL) {
+      continue;
+    }
+    body += 4;
+
+    if ((clen = strstr(buf, "Content-Length:")) != NULL && clen < body) {
+      if ((size_t)(body - buf) + atoi(clen + 15) <= len) {
+        return len;
+      }
+    } else if ((len >= 5) && (strcmp(buf + len - 5, "0\r\n\r\n") == 0)) {
+      return len;
+    }
+
+    if (len + 1 >= size) {
+      return -1;
+    }
+  }
+}
+
+/**
+ *  @brief  PRF status code of a json response body (rngin answers http 200
+ *          also for errors and shed requests)
+ *
+ *  @arg    const char*
+ *  @return int (-1 if missing)
+ */
+
+static int get_jsonstatus(const char *resp) {
+  const char *pos = strstr(resp, "\"statusCode\"");
+
+  if (pos == NULL) {
+    return -1;
+  }
+  pos += strlen("\"statusCode\"");
+  while ((*pos == ' ') || (*pos == ':')) {
+    pos++;
+  }
+
+  return atoi(pos);
+}
+
+/**
+ *  @brief  compares two doubles (qsort)
+ *
+ *  @arg    const void*, const void*
+ *  @return int
+ */
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ *  @brief  monotonic time in microseconds
+ *
+ *  @arg    void
+ *  @return double
+ */
+
+static double now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ *  @brief  sends one request and reads its response
+ *
+ *  @arg    int, s_bench_t*, s_tmpl_t*, unsigned int, unsigned int, char*,
+ *          s_prfresp_t*
+ *  @return int (0, 1: the server closes the connection, or -1)
+ */
+
+static int send_request(int sock, s_bench_t *bench, s_tmpl_t *tmpl,
+                        unsigned int tindex, unsigned int tlabel, char *buf,
+                        s_prfresp_t *bresp) {
+  s_prfreq_t breq;
+  char *json = buf;
+  int len;
+  int n;
+
+  if (bench->binary) {
+    /* binary requests carry the raw sip header block */
+    breq.tindex = tindex;
+    breq.tlabel = tlabel;
+    breq.ruri = tmpl->ruri;
+    breq.next = tmpl->next;
+    breq.shdr = tmpl->shdr;
+    breq.shdrlen = tmpl->shdrlen;
+
+    if ((prf_request(sock, &breq, bresp) != 0) ||
+        (bresp->tindex != tindex) || (bresp->status != 200)) {
+      return -1;
+    }
+    return 0;
+  }
+
+  /* json in the upper half of buf, the http request in the lower half */
+  json = buf + BUFSIZE / 2;
+  len = snprintf(json, BUFSIZE / 2, REQ_JSON, tindex, tlabel, tmpl->jruri,
+                 tmpl->jnext, tmpl->b64);
+  if ((len < 0) || (len >= BUFSIZE / 2)) {
+    return -1;
+  }
+  n = snprintf(buf, BUFSIZE / 2, REQ_HTTP, len, "");
+  if ((n < 0) || (n + len >= BUFSIZE / 2)) {
+    return -1;
+  }
+  memcpy(buf + n, json, len);
+  n += len;
+  if (write(sock, buf, n) != n) {
+    return -1;
+  }
+  /* same as binary: errors are a status code other than 200 */
+  if ((read_response(sock, buf, BUFSIZE) < 0) ||
+      (strncmp(buf, "HTTP/1.1 200", 12) != 0) ||
+      (get_jsonstatus(buf) != 200)) {
+    return -1;
+  }
+  /* e.g. a draining rngin, the next request needs a new connection */
+  if (strstr(buf, "\r\nConnection: close\r\n") != NULL) {
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ *  @brief  client thread: warmup, then the measured requests
+ *
+ *  @arg    void*
+ *  @return void*
+ */
+
+static void *run_worker(void *arg) {
+  s_worker_t *w = (s_worker_t *)arg;
+  s_bench_t *bench = w->bench;
+  s_prfresp_t bresp;
+
+  char *buf = malloc(BUFSIZE);
+  double beg;
+  int sock = -1;
+  int sent = 0;
+  int res;
+  int i;
+
+  prf_init_response(&bresp);
+
+  for (i = -w->warmup; i < w->requests; i++) {
+    if (i == 0) {
+      /* all clients start the measured requests together */
+      pthread_barrier_wait(&bench->barrier);
+    }
+    if (buf == NULL) {
+      w->errors++;
+      continue;
+    }
+
+    beg = now_us();
+    if (sock < 0) {
+      if ((sock = prf_connect(bench->addr)) < 0) {
+        w->errors += (i >= 0);
+        continue;
+      }
+      w->connects++;
+      sent = 0;
+    }
+
+    res = send_request(sock, bench,
+                       &bench->tmpl[(unsigned int)(i + w->warmup + w->id) %
+                                    bench->count],
+                       (unsigned int)(i + w->warmup), w->id, buf, &bresp);
+
+    if (res >= 0) {
+      if (i >= 0) {
+        w->lat[w->done++] = now_us() - beg;
+      }
+    } else {
+      w->errors += (i >= 0);
+    }
+
+    /* connection reuse limit, a failed or closed connection is not reused */
+    if ((res != 0) || ((bench->reuse > 0) && (++sent >= bench->reuse))) {
+      prf_close(sock);
+      sock = -1;
+    }
+  }
+
+  if (w->requests <= 0) {
+    pthread_barrier_wait(&bench->barrier);
+  }
+
+  prf_close(sock);
+  prf_free_response(&bresp);
+  free(buf);
+
+  return NULL;
+}
+
+/**
+ *  @brief  prints the latency histogram (power of two buckets)
+ *
+ *  @arg    double*, int
+ *  @return void
+ */
+
+static void print_histogram(double *lat, int count) {
+  int bucket[HIST_BUCKETS] = {0};
+  int first = HIST_BUCKETS;
+  int last = 0;
+  int max = 0;
+  int i;
+  int j;
+
+  for (i = 0; i < count; i++) {
+    for (j = 0; (j < HIST_BUCKETS - 1) && (lat[i] > (double)(1UL << j)); j++)
+      ;
+    bucket[j]++;
+    first = (j < first) ? j : first;
+    last = (j > last) ? j : last;
+  }
+
+  for (j = first; j <= last; j++) {
+    max = (bucket[j] > max) ? bucket[j] : max;
+  }
+
+  printf("latency histogram [us]:\n");
+  for (j = first; j <= last; j++) {
+    printf("  <= %8lu %9d %6.2f%% ", 1UL << j, bucket[j],
+           100.0 * bucket[j] / count);
+    for (i = 0; i < (max ? bucket[j] * HIST_BAR / max : 0); i++) {
+      putchar('#');
+    }
+    putchar('\n');
+  }
+}
+
+/********************************************************************** MAIN */
+/**
+ *  @brief  opens idle connections (open file limit raised as needed)
+ *
+ *  @arg    const char*, int, int*
+ *  @return int (connections opened)
+ */
+
+static int open_idle(const char *addr, int count, int *sock) {
+
+  struct rlimit rl;
+  int i;
+
+  if ((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur < rl.rlim_max)) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  for (i = 0; i < count; i++) {
+    if ((sock[i] = prf_connect(addr)) < 0) {
+      ERROR_PRINT("idle connection %d failed\n", i);
+      break;
+    }
+  }
+
+  return i;
+}
+
+int main(int argc, char *argv[]) {
+  const char *ruri = "urn:service:sos";
+  const char *next = "sip:border@border.dects.dec112.eu";
+  const char *file = NULL;
+
+  s_bench_t bench;
+  s_worker_t *worker = NULL;
+
+  int *isock = NULL;
+
+  double *lat = NULL;
+  double beg, wall, sum = 0;
+
+  int requests = 10000;
+  int warmup = 100;
+  int clients = 1;
+  int done = 0;
+  int errors = 0;
+  int connects = 0;
+  int idle = 0;
+  int opened = 0;
+  int opt, i, j;
+
+  memset(&bench, 0, sizeof(bench));
+
+  while ((opt = getopt(argc, argv, "a:n:w:r:x:c:k:t:i:B")) != -1) {
+    switch (opt) {
+    case 'a':
+      bench.addr = optarg;
+      break;
+    case 'n':
+      requests = atoi(optarg);
+      break;
+    case 'w':
+      warmup = atoi(optarg);
+      break;
+    case 'r':
+      ruri = optarg;
+      break;
+    case 'x':
+      next = optarg;
+      break;
+    case 'c':
+      clients = atoi(optarg);
+      break;
+    case 'k':
+      bench.reuse = atoi(optarg);
+      break;
+    case 't':
+      file = optarg;
+      break;
+    case 'i':
+      idle = atoi(optarg);
+      break;
+    case 'B':
+      bench.binary = 1;
+      break;
+    default:
+      bench.addr = NULL;
+    }
+  }
+
+  if ((bench.addr == NULL) || (requests <= 0) || (clients <= 0) ||
+      (warmup < 0) || (bench.reuse < 0) || (idle < 0)) {
+    ERROR_PRINT("usage: prf-bench -a <tcp:host:port|unix:path> [-n requests] "
+                "[-w warmup] [-c clients] [-k requests per connection] "
+                "[-t template file] [-r ruri] [-x next] "
+                "[-i idle connections] [-B]\n");
+    exit(1);
+  }
+
+  if (file != NULL) {
+    if (read_templates(&bench, file) != 0) {
+      exit(1);
+    }
+  } else if (add_template(&bench, strdup(ruri), strdup(next),
+                          strdup(SIP_HDRS), strlen(SIP_HDRS)) != 0) {
+    exit(1);
+  }
+
+  worker = calloc(clients, sizeof(s_worker_t));
+  lat = malloc(requests * sizeof(double));
+  isock = malloc((idle + 1) * sizeof(int));
+  if ((worker == NULL) || (lat == NULL) || (isock == NULL)) {
+    ERROR_PRINT("no memory\n");
+    exit(1);
+  }
+
+  opened = open_idle(bench.addr, idle, isock);
+
+  pthread_barrier_init(&bench.barrier, NULL, clients + 1);
+
+  /* requests and warmup are split across the clients */
+  for (i = 0, j = 0; i < clients; i++) {
+    worker[i].bench = &bench;
+    worker[i].id = i;
+    worker[i].requests = requests / clients + (i < requests % clients);
+    worker[i].warmup = warmup / clients + (i < warmup % clients);
+    worker[i].lat = lat + j;
+    j += worker[i].requests;
+    if (pthread_create(&worker[i].thread, NULL, run_worker, &worker[i]) != 0) {
+      ERROR_PRINT("could not start client %d\n", i);
+      exit(1);
+    }
+  }
+
+  pthread_barrier_wait(&bench.barrier);
+  beg = now_us();
+
+  for (i = 0; i < clients; i++) {
+    pthread_join(worker[i].thread, NULL);
+  }
+  wall = now_us() - beg;
+
+  /* compact the latencies of successful requests */
+  for (i = 0; i < clients; i++) {
+    memmove(lat + done, worker[i].lat, worker[i].done * sizeof(double));
+    done += worker[i].done;
+    errors += worker[i].errors;
+    connects += worker[i].connects;
+  }
+  for (i = 0; i < done; i++) {
+    sum += lat[i];
+  }
+
+  pthread_barrier_destroy(&bench.barrier);
+
+  printf("%s (%s): %d requests, %.0f req/s\n", bench.addr,
+         bench.binary ? "binary" : "http", done, done / wall * 1e6);
+  printf("clients %d, %d templates, %d connections, %d errors, %.3f s\n",
+         clients, bench.count, connects, errors, wall / 1e6);
+  if (idle > 0) {
+    printf("idle connections %d of %d\n", opened, idle);
+  }
+
+  if (done > 0) {
+    qsort(lat, done, sizeof(double), cmp_double);
+    printf("latency [us]: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  "
+           "max %.1f  mean %.1f\n",
+           lat[0], lat[done / 2], lat[done * 90 / 100], lat[done * 99 / 100],
+           lat[done * 999 / 1000], lat[done - 1], sum / done);
+    print_histogram(lat, done);
+  }
+
+  for (i = 0; i < bench.count; i++) {
+    free(bench.tmpl[i].ruri);
+    free(bench.tmpl[i].next);
+    free(bench.tmpl[i].shdr);
+    free(bench.tmpl[i].b64);
+    free(bench.tmpl[i].jruri);
+    free(bench.tmpl[i].jnext);
+  }
+  for (i = 0; i < opened; i++) {
+    prf_close(isock[i]);
+  }
+  free(isock);
+  free(bench.tmpl);
+  free(worker);
+  free(lat);
+
+  return ((errors > 0) || (opened < idle)) ? 1 : 0;
+}
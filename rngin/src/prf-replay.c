@@ -0,0 +1,848 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    prf-replay.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief replays a PRF traffic recording (rngin -r) against rngin
+ *
+ *  Sends the recorded requests, at maximum speed or with the recorded
+ *  timing (-o), as http/json or via the binary protocol (-B) and compares
+ *  each response with the recorded one. Before a request is sent the
+ *  queue states it was evaluated against are written to the database of
+ *  the rngin under test (-d), so the decisions can be compared.
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "cjson.h"
+#include "prfclient.h"
+#include "prfrec.h"
+#include <arpa/inet.h>
+#include <sqlite3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/******************************************************************** DEFINE */
+
+#define BUFSIZE 65536
+#define REQ_URI "/api/v1/prf/req"
+
+#define REQ_HTTP                                                               \
+  "POST " REQ_URI " HTTP/1.1\r\n"                                              \
+  "Host: prf\r\n"                                                              \
+  "Content-Type: application/json\r\n"                                         \
+  "Content-Length: %d\r\n\r\n"
+
+#define SQL_UPSERT                                                             \
+  "INSERT INTO queues (uri, state, max, length) VALUES (?1, ?2, ?3, ?4) "      \
+  "ON CONFLICT(uri) DO UPDATE SET state = ?2, max = ?3, length = ?4"
+#define SQL_DELETE "DELETE FROM queues WHERE uri = ?1"
+
+/* mismatches printed with -v */
+#define MAX_DIFFS 10
+
+#define ERROR_PRINT(fmt, args...)                                              \
+  fprintf(stderr, "ERROR: %s():%d: " fmt, __func__, __LINE__, ##args)
+
+/******************************************************************* TYPEDEF */
+
+/* queue state as applied to the database */
+typedef struct QSTATE {
+  char *uri;
+  char *state;
+  int max;
+  int length;
+  int found;
+} s_qstate_t;
+
+typedef struct REPLAY {
+  sqlite3 *db;
+  sqlite3_stmt *upsert;
+  sqlite3_stmt *delete;
+  s_qstate_t *qstate;
+  int count;
+} s_replay_t;
+
+/******************************************************************* GLOBALS */
+
+static const char b64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  base64 encodes src (no line breaks, as Kamailio s.encode.base64)
+ *
+ *  @arg    const char*
+ *  @return char*
+ */
+
+static char *encode_base64(const char *src, size_t len) {
+  char *out = malloc(len * 4 / 3 + 5);
+  char *pos = out;
+  size_t i;
+
+  if (out == NULL) {
+    return NULL;
+  }
+
+  for (i = 0; i + 2 < len; i += 3) {
+    *pos++ = b64[(unsigned char)src[i] >> 2];
+    *pos++ = b64[((src[i] & 0x03) << 4) | ((unsigned char)src[i + 1] >> 4)];
+    *pos++ = b64[((src[i + 1] & 0x0f) << 2) | ((unsigned char)src[i + 2] >> 6)];
+    *pos++ = b64[src[i + 2] & 0x3f];
+  }
+
+  if (i < len) {
+    *pos++ = b64[(unsigned char)src[i] >> 2];
+    if (i + 1 == len) {
+      *pos++ = b64[(src[i] & 0x03) << 4];
+      *pos++ = '=';
+    } else {
+      *pos++ = b64[((src[i] & 0x03) << 4) | ((unsigned char)src[i + 1] >> 4)];
+      *pos++ = b64[(src[i + 1] & 0x0f) << 2];
+    }
+    *pos++ = '=';
+  }
+
+  *pos = '\0';
+
+  return out;
+}
+
+/**
+ *  @brief  reads one http response (chunked or content-length)
+ *
+ *  @arg    int, char*, size_t
+ *  @return int (response length or -1)
+ */
+
+static int read_response(int sock, char *buf, size_t size) {
+  size_t len = 0;
+  char *body = NULL;
+  char *clen = NULL;
+  ssize_t n;
+
+  for (;;) {
+    n = read(sock, buf + len, size - len - 1);
+    if (n <= 0) {
+      return -1;
+    }
+    len += n;
+    buf[len] = '\0';
+
+    if ((body = strstr(buf, "\r\n\r\n")) == NULL) {
+      continue;
+    }
+    body += 4;
+
+    if ((clen = strstr(buf, "Content-Length:")) != NULL && clen < body) {
+      if ((size_t)(body - buf) + atoi(clen + 15) <= len) {
+        return len;
+      }
+    } else if ((len >= 5) && (strcmp(buf + len - 5, "0\r\n\r\n") == 0)) {
+      return len;
+    }
+
+    if (len + 1 >= size) {
+      return -1;
+    }
+  }
+}
+
+/**
+ *  @brief  compares two doubles (qsort)
+ *
+ *  @arg    const void*, const void*
+ *  @return int
+ */
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ *  @brief  monotonic time in microseconds
+ *
+ *  @arg    void
+ *  @return double
+ */
+
+static double now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ *  @brief  reads an unsigned integer (network byte order) of n bytes
+ *
+ *  @arg    const char**, const char*, int, unsigned int*
+ *  @return int (0 or -1 if the record is too short)
+ */
+
+static int get_uint(const char **pos, const char *end, int n,
+                    unsigned int *val) {
+  uint32_t u32;
+  uint16_t u16;
+
+  if (end - *pos < n) {
+    return -1;
+  }
+
+  if (n == 4) {
+    memcpy(&u32, *pos, 4);
+    *val = ntohl(u32);
+  } else if (n == 2) {
+    memcpy(&u16, *pos, 2);
+    *val = ntohs(u16);
+  } else {
+    *val = (unsigned char)**pos;
+  }
+  *pos += n;
+
+  return 0;
+}
+
+/**
+ *  @brief  reads a length prefixed string (copy, NUL terminated)
+ *
+ *  @arg    const char**, const char*, int
+ *  @return char* (NULL if the record is too short)
+ */
+
+static char *get_string(const char **pos, const char *end, int n) {
+  unsigned int len = 0;
+  char *str = NULL;
+
+  if ((get_uint(pos, end, n, &len) != 0) || ((size_t)(end - *pos) < len) ||
+      ((str = malloc(len + 1)) == NULL)) {
+    return NULL;
+  }
+  memcpy(str, *pos, len);
+  str[len] = '\0';
+  *pos += len;
+
+  return str;
+}
+
+/**
+ *  @brief  writes a recorded queue state to the database, unless it is
+ *          already there
+ *
+ *  @arg    s_replay_t*, s_qstate_t*
+ *  @return int (0 or -1)
+ */
+
+static int set_queuestate(s_replay_t *rp, s_qstate_t *qs) {
+  s_qstate_t *cur = NULL;
+  sqlite3_stmt *stmt = NULL;
+  int i;
+
+  for (i = 0; i < rp->count; i++) {
+    if (strcmp(rp->qstate[i].uri, qs->uri) == 0) {
+      cur = &rp->qstate[i];
+      break;
+    }
+  }
+
+  if ((cur != NULL) && (cur->found == qs->found) && (cur->max == qs->max) &&
+      (cur->length == qs->length) && (strcmp(cur->state, qs->state) == 0)) {
+    return 0;
+  }
+
+  if (qs->found) {
+    stmt = rp->upsert;
+    sqlite3_bind_text(stmt, 2, qs->state, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, qs->max);
+    sqlite3_bind_int(stmt, 4, qs->length);
+  } else {
+    stmt = rp->delete;
+  }
+  sqlite3_bind_text(stmt, 1, qs->uri, -1, SQLITE_STATIC);
+
+  if (sqlite3_step(stmt) != SQLITE_DONE) {
+    ERROR_PRINT("could not set queue state of %s: %s\n", qs->uri,
+                sqlite3_errmsg(rp->db));
+    sqlite3_reset(stmt);
+    return -1;
+  }
+  sqlite3_reset(stmt);
+
+  if (cur == NULL) {
+    cur = realloc(rp->qstate, (rp->count + 1) * sizeof(s_qstate_t));
+    if (cur == NULL) {
+      return -1;
+    }
+    rp->qstate = cur;
+    cur = &rp->qstate[rp->count++];
+    cur->uri = strdup(qs->uri);
+  } else {
+    free(cur->state);
+  }
+  cur->state = strdup(qs->state);
+  cur->max = qs->max;
+  cur->length = qs->length;
+  cur->found = qs->found;
+
+  return 0;
+}
+
+/**
+ *  @brief  reads the queue states of a record and applies them
+ *
+ *  @arg    s_replay_t*, const char**, const char*
+ *  @return int (0 or -1)
+ */
+
+static int get_queuestates(s_replay_t *rp, const char **pos, const char *end) {
+  s_qstate_t qs;
+  unsigned int count = 0;
+  unsigned int val = 0;
+  unsigned int i;
+  int res = 0;
+
+  if (get_uint(pos, end, 2, &count) != 0) {
+    return -1;
+  }
+
+  for (i = 0; (i < count) && (res == 0); i++) {
+    qs.uri = get_string(pos, end, 2);
+    qs.state = get_string(pos, end, 2);
+    res = ((qs.uri == NULL) || (qs.state == NULL)) ? -1 : 0;
+    res |= get_uint(pos, end, 4, &val);
+    qs.max = (int)val;
+    res |= get_uint(pos, end, 4, &val);
+    qs.length = (int)val;
+    res |= get_uint(pos, end, 1, &val);
+    qs.found = (int)val;
+    if ((res == 0) && (rp->db != NULL)) {
+      res = set_queuestate(rp, &qs);
+    }
+    free(qs.uri);
+    free(qs.state);
+  }
+
+  return res;
+}
+
+/**
+ *  @brief  canonical form of a binary response (status, target, headers)
+ *
+ *  @arg    s_prfresp_t*, char*, size_t
+ *  @return void
+ */
+
+static void put_binresult(s_prfresp_t *resp, char *out, size_t size) {
+  size_t len = 0;
+  int i;
+
+  len = snprintf(out, size, "%u/%u %d %s", resp->tindex, resp->tlabel,
+                 resp->status, resp->target);
+  for (i = 0; (i < resp->count) && (len < size); i++) {
+    len += snprintf(out + len, size - len, " | %s: %s", resp->header[i].name,
+                    resp->header[i].value);
+  }
+}
+
+/**
+ *  @brief  canonical form of a json response (header names without the
+ *          colon, as in the binary protocol)
+ *
+ *  @arg    const char*, char*, size_t
+ *  @return int (0 or -1)
+ */
+
+static int put_jsonresult(const char *json, char *out, size_t size) {
+  cJSON *jresp = cJSON_Parse(json);
+  cJSON *jitem = NULL;
+  cJSON *jname = NULL;
+  cJSON *jvalue = NULL;
+  size_t len = 0;
+  size_t n = 0;
+
+  if (jresp == NULL) {
+    snprintf(out, size, "invalid json");
+    return -1;
+  }
+
+  len = snprintf(
+      out, size, "%u/%u %d %s",
+      (unsigned int)cJSON_GetObjectItem(jresp, "tindex")->valuedouble,
+      (unsigned int)cJSON_GetObjectItem(jresp, "tlabel")->valuedouble,
+      cJSON_GetObjectItem(jresp, "statusCode")->valueint,
+      cJSON_GetObjectItem(jresp, "target")->valuestring);
+
+  jitem = cJSON_GetObjectItem(jresp, "additionalHeaders")->child;
+  for (; (jitem != NULL) && (len < size); jitem = jitem->next) {
+    jname = cJSON_GetObjectItem(jitem, "name");
+    jvalue = cJSON_GetObjectItem(jitem, "value");
+    if ((jname == NULL) || (jvalue == NULL)) {
+      continue;
+    }
+    n = strlen(jname->valuestring);
+    if ((n > 0) && (jname->valuestring[n - 1] == ':')) {
+      n--;
+    }
+    len += snprintf(out + len, size - len, " | %.*s: %s", (int)n,
+                    jname->valuestring, jvalue->valuestring);
+  }
+
+  cJSON_Delete(jresp);
+
+  return 0;
+}
+
+/**
+ *  @brief  checks that a json response has all PRF attributes
+ *
+ *  @arg    const char*
+ *  @return int (0 or -1)
+ */
+
+static int check_json(const char *json) {
+  cJSON *jresp = cJSON_Parse(json);
+  int res = -1;
+
+  if ((jresp != NULL) && cJSON_GetObjectItem(jresp, "tindex") &&
+      cJSON_GetObjectItem(jresp, "tlabel") &&
+      cJSON_GetObjectItem(jresp, "statusCode") &&
+      cJSON_GetObjectItem(jresp, "target") &&
+      cJSON_GetObjectItem(jresp, "target")->valuestring &&
+      cJSON_GetObjectItem(jresp, "additionalHeaders")) {
+    res = 0;
+  }
+  cJSON_Delete(jresp);
+
+  return res;
+}
+
+/**
+ *  @brief  canonical form of a recorded response
+ *
+ *  @arg    int, const char*, size_t, s_prfresp_t*, char*, size_t
+ *  @return int (0 or -1)
+ */
+
+static int put_recresult(int type, const char *buf, size_t len,
+                         s_prfresp_t *resp, char *out, size_t size) {
+  char *json = NULL;
+  int res = -1;
+
+  if (type == PRFREC_BIN) {
+    if (prf_decode(resp, buf, len) != 0) {
+      return -1;
+    }
+    put_binresult(resp, out, size);
+    return 0;
+  }
+
+  if ((json = malloc(len + 1)) == NULL) {
+    return -1;
+  }
+  memcpy(json, buf, len);
+  json[len] = '\0';
+  if (check_json(json) == 0) {
+    res = put_jsonresult(json, out, size);
+  }
+  free(json);
+
+  return res;
+}
+
+/**
+ *  @brief  builds the json body of a request (recorded uris may contain
+ *          quotes or backslashes, cJSON escapes them)
+ *
+ *  @arg    s_prfreq_t*, const char*
+ *  @return char* (to be freed, NULL on error)
+ */
+
+static char *put_jsonrequest(s_prfreq_t *req, const char *b64shdr) {
+  cJSON *jreq = cJSON_CreateObject();
+  char *json = NULL;
+
+  if (jreq == NULL) {
+    return NULL;
+  }
+  cJSON_AddNumberToObject(jreq, "tindex", req->tindex);
+  cJSON_AddNumberToObject(jreq, "tlabel", req->tlabel);
+  cJSON_AddStringToObject(jreq, "ruri", req->ruri ? req->ruri : "");
+  cJSON_AddStringToObject(jreq, "next", req->next ? req->next : "");
+  cJSON_AddStringToObject(jreq, "request", b64shdr);
+
+  json = cJSON_PrintUnformatted(jreq);
+  cJSON_Delete(jreq);
+
+  return json;
+}
+
+/**
+ *  @brief  sends a request as http/json and returns the canonical response
+ *
+ *  @arg    int, s_prfreq_t*, char*, char*, size_t
+ *  @return int (0 or -1)
+ */
+
+static int send_http(int sock, s_prfreq_t *req, char *buf, char *out,
+                     size_t size) {
+  char *b64shdr = encode_base64(req->shdr ? req->shdr : "", req->shdrlen);
+  char *json = NULL;
+  char *body = NULL;
+  int len = 0;
+  int n = 0;
+
+  if (b64shdr == NULL) {
+    return -1;
+  }
+  json = put_jsonrequest(req, b64shdr);
+  free(b64shdr);
+  if (json == NULL) {
+    return -1;
+  }
+  len = (int)strlen(json);
+
+  n = snprintf(buf, BUFSIZE, REQ_HTTP, len);
+  if ((write(sock, buf, n) != n) || (write(sock, json, len) != len)) {
+    free(json);
+    return -1;
+  }
+  free(json);
+
+  if ((read_response(sock, buf, BUFSIZE) < 0) ||
+      ((body = strstr(buf, "\r\n\r\n")) == NULL)) {
+    return -1;
+  }
+  body += 4;
+  /* chunked: skip the chunk size line */
+  if (strstr(buf, "Transfer-Encoding: chunked") != NULL) {
+    if ((body = strstr(body, "\r\n")) == NULL) {
+      return -1;
+    }
+    body += 2;
+  }
+
+  if (check_json(body) != 0) {
+    return -1;
+  }
+
+  return put_jsonresult(body, out, size);
+}
+
+/**
+ *  @brief  opens the database of the rngin under test and prepares the
+ *          queue state statements
+ *
+ *  @arg    s_replay_t*, const char*
+ *  @return int (0 or -1)
+ */
+
+static int open_db(s_replay_t *rp, const char *file) {
+  if ((sqlite3_open_v2(file, &rp->db, SQLITE_OPEN_READWRITE, NULL) !=
+       SQLITE_OK) ||
+      (sqlite3_prepare_v2(rp->db, SQL_UPSERT, -1, &rp->upsert, NULL) !=
+       SQLITE_OK) ||
+      (sqlite3_prepare_v2(rp->db, SQL_DELETE, -1, &rp->delete, NULL) !=
+       SQLITE_OK)) {
+    ERROR_PRINT("could not open database %s: %s\n", file,
+                rp->db ? sqlite3_errmsg(rp->db) : "no memory");
+    return -1;
+  }
+  sqlite3_busy_timeout(rp->db, 1000);
+
+  return 0;
+}
+
+/**
+ *  @brief  closes the database, frees the applied queue states
+ *
+ *  @arg    s_replay_t*
+ *  @return void
+ */
+
+static void close_db(s_replay_t *rp) {
+  int i;
+
+  sqlite3_finalize(rp->upsert);
+  sqlite3_finalize(rp->delete);
+  sqlite3_close(rp->db);
+
+  for (i = 0; i < rp->count; i++) {
+    free(rp->qstate[i].uri);
+    free(rp->qstate[i].state);
+  }
+  free(rp->qstate);
+}
+
+/********************************************************************** MAIN */
+int main(int argc, char *argv[]) {
+  const char *addr = NULL;
+  const char *file = NULL;
+  const char *dbfile = NULL;
+  const char *pos = NULL;
+  const char *end = NULL;
+
+  FILE *fp = NULL;
+
+  s_replay_t rp;
+  s_prfreq_t req;
+  s_prfresp_t resp;
+  s_prfresp_t recresp;
+
+  char magic[PRFREC_MAGICLEN];
+  char expect[BUFSIZE];
+  char result[BUFSIZE];
+  char *rec = NULL;
+  char *buf = NULL;
+  char *ruri = NULL;
+  char *next = NULL;
+
+  double *lat = NULL;
+  double beg, start, wall, sum = 0;
+  double due = 0;
+  double wait = 0;
+
+  unsigned long long usec = 0;
+  unsigned int len = 0;
+  unsigned int val = 0;
+  unsigned int type = 0;
+  unsigned int rlen = 0;
+
+  int original = 0;
+  int binary = 0;
+  int verbose = 0;
+  int limit = 0;
+  int records = 0;
+  int done = 0;
+  int mismatches = 0;
+  int errors = 0;
+  int sock = -1;
+  int size = 0;
+  int res = 0;
+  int opt;
+
+  memset(&rp, 0, sizeof(rp));
+
+  while ((opt = getopt(argc, argv, "a:f:d:n:oBv")) != -1) {
+    switch (opt) {
+    case 'a':
+      addr = optarg;
+      break;
+    case 'f':
+      file = optarg;
+      break;
+    case 'd':
+      dbfile = optarg;
+      break;
+    case 'n':
+      limit = atoi(optarg);
+      break;
+    case 'o':
+      original = 1;
+      break;
+    case 'B':
+      binary = 1;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      addr = NULL;
+    }
+  }
+
+  if ((addr == NULL) || (file == NULL)) {
+    ERROR_PRINT("usage: prf-replay -a <tcp:host:port|unix:path> -f <recording> "
+                "[-d <db file of the rngin under test>] [-n requests] "
+                "[-o (recorded timing)] [-B] [-v]\n");
+    exit(1);
+  }
+
+  if (((fp = fopen(file, "rb")) == NULL) ||
+      (fread(magic, 1, PRFREC_MAGICLEN, fp) != PRFREC_MAGICLEN) ||
+      (memcmp(magic, PRFREC_MAGIC, PRFREC_MAGICLEN) != 0)) {
+    ERROR_PRINT("%s is not a PRF recording\n", file);
+    exit(1);
+  }
+
+  if (dbfile == NULL) {
+    fprintf(stderr, "WARNING: no database (-d), recorded queue states are "
+                    "not applied\n");
+  } else if (open_db(&rp, dbfile) != 0) {
+    exit(1);
+  }
+
+  buf = malloc(BUFSIZE);
+  if (buf == NULL) {
+    ERROR_PRINT("no memory\n");
+    exit(1);
+  }
+
+  if ((sock = prf_connect(addr)) < 0) {
+    ERROR_PRINT("could not connect to %s\n", addr);
+    exit(1);
+  }
+
+  prf_init_response(&resp);
+  prf_init_response(&recresp);
+
+  start = now_us();
+
+  while ((limit == 0) || (records < limit)) {
+    if (fread(&len, 1, 4, fp) != 4) {
+      break;
+    }
+    len = ntohl(len);
+    if ((int)len > size) {
+      if ((rec = realloc(rec, len)) == NULL) {
+        ERROR_PRINT("no memory\n");
+        exit(1);
+      }
+      size = len;
+    }
+    if (fread(rec, 1, len, fp) != len) {
+      ERROR_PRINT("truncated record %d\n", records);
+      break;
+    }
+    records++;
+
+    pos = rec;
+    end = rec + len;
+
+    /* arrival time, request */
+    res = get_uint(&pos, end, 4, &val);
+    usec = (unsigned long long)val << 32;
+    res |= get_uint(&pos, end, 4, &val);
+    usec |= val;
+    res |= get_uint(&pos, end, 4, &rlen);
+    res |= get_uint(&pos, end, 4, &req.tindex);
+    res |= get_uint(&pos, end, 4, &req.tlabel);
+    req.ruri = ruri = get_string(&pos, end, 2);
+    req.next = next = get_string(&pos, end, 2);
+    res |= get_uint(&pos, end, 4, &val);
+    req.shdr = pos;
+    req.shdrlen = val;
+    if ((res != 0) || (ruri == NULL) || (next == NULL) ||
+        ((size_t)(end - pos) < val)) {
+      ERROR_PRINT("malformed record %d\n", records);
+      exit(1);
+    }
+    pos += val;
+
+    /* queue states the request was evaluated against, recorded response */
+    res = get_queuestates(&rp, &pos, end);
+    res |= get_uint(&pos, end, 1, &type);
+    res |= get_uint(&pos, end, 4, &val);
+    if ((res != 0) || ((size_t)(end - pos) < val) ||
+        (put_recresult(type, pos, val, &recresp, expect, sizeof(expect)) !=
+         0)) {
+      ERROR_PRINT("malformed record %d\n", records);
+      exit(1);
+    }
+
+    if (original) {
+      /* recorded timing, requests that are late are sent right away */
+      due = start + usec;
+      wait = due - now_us();
+      if (wait > 0) {
+        usleep((useconds_t)wait);
+      }
+    }
+
+    if (sock < 0) {
+      sock = prf_connect(addr);
+    }
+
+    beg = now_us();
+    if (sock < 0) {
+      res = -1;
+    } else if (binary) {
+      res = prf_request(sock, &req, &resp);
+      if (res == 0) {
+        put_binresult(&resp, result, sizeof(result));
+      }
+    } else {
+      res = send_http(sock, &req, buf, result, sizeof(result));
+    }
+
+    if (res != 0) {
+      errors++;
+      prf_close(sock);
+      sock = -1;
+    } else {
+      if ((lat = realloc(lat, (done + 1) * sizeof(double))) == NULL) {
+        ERROR_PRINT("no memory\n");
+        exit(1);
+      }
+      lat[done] = now_us() - beg;
+      sum += lat[done++];
+
+      if (strcmp(expect, result) != 0) {
+        if (verbose && (mismatches < MAX_DIFFS)) {
+          printf("record %d (%s):\n  recorded: %s\n  replayed: %s\n", records,
+                 ruri, expect, result);
+        }
+        mismatches++;
+      }
+    }
+
+    free(ruri);
+    free(next);
+  }
+  wall = now_us() - start;
+
+  printf("%s (%s): %d records, %d replayed, %d mismatches, %d errors\n", addr,
+         binary ? "binary" : "http", records, done, mismatches, errors);
+  if (done > 0) {
+    qsort(lat, done, sizeof(double), cmp_double);
+    printf("%.0f req/s (%.3f s, %s timing)\n", done / wall * 1e6, wall / 1e6,
+           original ? "recorded" : "maximum");
+    printf("latency [us]: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  "
+           "max %.1f  mean %.1f\n",
+           lat[0], lat[done / 2], lat[done * 90 / 100], lat[done * 99 / 100],
+           lat[done * 999 / 1000], lat[done - 1], sum / done);
+  }
+
+  prf_close(sock);
+  prf_free_response(&resp);
+  prf_free_response(&recresp);
+  if (rp.db != NULL) {
+    close_db(&rp);
+  }
+  fclose(fp);
+  free(lat);
+  free(rec);
+  free(buf);
+
+  return ((mismatches > 0) || (errors > 0)) ? 1 : 0;
+}
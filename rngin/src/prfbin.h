@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    prfbin.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief binary PRF protocol (wire format shared by rngin and prfclient)
+ *
+ *  All integers are unsigned and in network byte order, strings are not
+ *  NUL terminated. Each record starts with the length of the remaining
+ *  record (u32).
+ *
+ *  request:  u32 len | u32 tindex | u32 tlabel | u16 n | ruri[n] |
+ *            u16 n | next[n] | u32 n | sip header block[n] (raw, CRLF)
+ *
+ *  response: u32 len | u32 tindex | u32 tlabel | u16 statusCode |
+ *            u16 n | target[n] | u16 count |
+ *            count * (u16 n | name[n] | u16 n | value[n])
+ *
+ *  Header names are sent without the trailing colon of the JSON API.
+ */
+
+#ifndef PRFBIN_H_INCLUDED
+#define PRFBIN_H_INCLUDED
+
+/******************************************************************** DEFINE */
+
+/* record length prefix */
+#define PRFBIN_LEN 4
+/* maximum record length (without length prefix) */
+#define PRFBIN_MAX 65536
+/* fixed part of a request record: tindex, tlabel and the length fields */
+#define PRFBIN_REQ_MIN (4 + 4 + 2 + 2 + 4)
+/* fixed part of a response record: tindex, tlabel, status, target, count */
+#define PRFBIN_RESP_MIN (4 + 4 + 2 + 2 + 2)
+
+#endif // PRFBIN_H_INCLUDED
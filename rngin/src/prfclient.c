@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    prfclient.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief binary PRF protocol client library
+ *
+ *  Requests are written with a single writev, responses are decoded in
+ *  place: every string is moved over its length field and NUL terminated,
+ *  so no memory is allocated once the receive buffers are large enough.
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "prfclient.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  connects to tcp:<host>:<port> or unix:<path>
+ *
+ *  @arg    const char*
+ *  @return int (socket or -1)
+ */
+
+int prf_connect(const char *addr) {
+  struct addrinfo hints, *res = NULL;
+  struct sockaddr_un sun;
+  char host[256];
+  const char *port = NULL;
+  int sock = -1;
+  int one = 1;
+
+  if (strncmp(addr, "unix:", 5) == 0) {
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, addr + 5, sizeof(sun.sun_path) - 1);
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((sock >= 0) &&
+        (connect(sock, (struct sockaddr *)&sun, sizeof(sun)) != 0)) {
+      close(sock);
+      sock = -1;
+    }
+    return sock;
+  }
+
+  if (strncmp(addr, "tcp:", 4) == 0) {
+    addr += 4;
+  }
+
+  port = strrchr(addr, ':');
+  if ((port == NULL) || (port - addr >= (long)sizeof(host))) {
+    return -1;
+  }
+  memcpy(host, addr, port - addr);
+  host[port - addr] = '\0';
+  port++;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if (getaddrinfo(host, port, &hints, &res) != 0) {
+    return -1;
+  }
+
+  sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if ((sock >= 0) && (connect(sock, res->ai_addr, res->ai_addrlen) != 0)) {
+    close(sock);
+    sock = -1;
+  }
+  if (sock >= 0) {
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  freeaddrinfo(res);
+
+  return sock;
+}
+
+/**
+ *  @brief  closes a connection
+ *
+ *  @arg    int
+ *  @return void
+ */
+
+void prf_close(int sock) {
+  if (sock >= 0) {
+    close(sock);
+  }
+}
+
+/**
+ *  @brief  writes all iovec data (handles short writes)
+ *
+ *  @arg    int, struct iovec*, int
+ *  @return int (0 or -1)
+ */
+
+static int write_iov(int sock, struct iovec *iov, int cnt) {
+  ssize_t n;
+
+  while (cnt > 0) {
+    n = writev(sock, iov, cnt);
+    if ((n < 0) && (errno == EINTR)) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    while ((cnt > 0) && ((size_t)n >= iov->iov_len)) {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ *  @brief  reads exactly len bytes
+ *
+ *  @arg    int, char*, size_t
+ *  @return int (0 or -1)
+ */
+
+static int read_all(int sock, char *buf, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = read(sock, buf, len);
+    if ((n < 0) && (errno == EINTR)) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/**
+ *  @brief  sends a request record (responses arrive in request order, so
+ *          several requests may be sent before reading the responses)
+ *
+ *  @arg    int, const s_prfreq_t*
+ *  @return int (0 or -1)
+ */
+
+int prf_send(int sock, const s_prfreq_t *req) {
+  struct iovec iov[6];
+  size_t rlen = req->ruri ? strlen(req->ruri) : 0;
+  size_t nlen = req->next ? strlen(req->next) : 0;
+  size_t len = PRFBIN_REQ_MIN + rlen + nlen + req->shdrlen;
+  char fix[PRFBIN_LEN + 10];
+  char mid[2];
+  char end[4];
+  uint32_t u32;
+  uint16_t u16;
+
+  if ((rlen > UINT16_MAX) || (nlen > UINT16_MAX) || (len > PRFBIN_MAX)) {
+    return -1;
+  }
+
+  u32 = htonl(len);
+  memcpy(fix, &u32, 4);
+  u32 = htonl(req->tindex);
+  memcpy(fix + 4, &u32, 4);
+  u32 = htonl(req->tlabel);
+  memcpy(fix + 8, &u32, 4);
+  u16 = htons(rlen);
+  memcpy(fix + 12, &u16, 2);
+  u16 = htons(nlen);
+  memcpy(mid, &u16, 2);
+  u32 = htonl(req->shdrlen);
+  memcpy(end, &u32, 4);
+
+  iov[0].iov_base = fix;
+  iov[0].iov_len = sizeof(fix);
+  iov[1].iov_base = (void *)req->ruri;
+  iov[1].iov_len = rlen;
+  iov[2].iov_base = mid;
+  iov[2].iov_len = sizeof(mid);
+  iov[3].iov_base = (void *)req->next;
+  iov[3].iov_len = nlen;
+  iov[4].iov_base = end;
+  iov[4].iov_len = sizeof(end);
+  iov[5].iov_base = (void *)req->shdr;
+  iov[5].iov_len = req->shdrlen;
+
+  return write_iov(sock, iov, 6);
+}
+
+/**
+ *  @brief  decodes a length prefixed string in place (the string is moved
+ *          over its u16 length and NUL terminated)
+ *
+ *  @arg    char**, char*
+ *  @return char* (string or NULL if the record is too short)
+ */
+
+static char *get_string(char **pos, char *end) {
+  char *str = *pos;
+  uint16_t u16;
+  size_t n;
+
+  if (end - str < 2) {
+    return NULL;
+  }
+  memcpy(&u16, str, 2);
+  n = ntohs(u16);
+  if ((size_t)(end - str - 2) < n) {
+    return NULL;
+  }
+
+  memmove(str, str + 2, n);
+  str[n] = '\0';
+  *pos = str + 2 + n;
+
+  return str;
+}
+
+/**
+ *  @brief  makes sure the receive buffer holds len bytes
+ *
+ *  @arg    s_prfresp_t*, size_t
+ *  @return int (0 or -1)
+ */
+
+static int get_buffer(s_prfresp_t *resp, size_t len) {
+  char *tmp = NULL;
+
+  if (resp->size < len) {
+    if ((tmp = realloc(resp->buf, len)) == NULL) {
+      return -1;
+    }
+    resp->buf = tmp;
+    resp->size = len;
+  }
+
+  return 0;
+}
+
+/**
+ *  @brief  decodes the response record (without length prefix) in the
+ *          receive buffer
+ *
+ *  @arg    s_prfresp_t*, size_t
+ *  @return int (0 or -1)
+ */
+
+static int decode_response(s_prfresp_t *resp, size_t len) {
+  s_prfhdr_t *hdr = NULL;
+  char *pos = NULL;
+  char *end = NULL;
+  uint32_t u32;
+  uint16_t u16;
+  int count;
+  int i;
+
+  if (len < PRFBIN_RESP_MIN) {
+    return -1;
+  }
+
+  pos = resp->buf;
+  end = resp->buf + len;
+
+  memcpy(&u32, pos, 4);
+  resp->tindex = ntohl(u32);
+  memcpy(&u32, pos + 4, 4);
+  resp->tlabel = ntohl(u32);
+  memcpy(&u16, pos + 8, 2);
+  resp->status = ntohs(u16);
+  pos += 10;
+
+  if ((resp->target = get_string(&pos, end)) == NULL) {
+    return -1;
+  }
+  if (end - pos < 2) {
+    return -1;
+  }
+  memcpy(&u16, pos, 2);
+  count = ntohs(u16);
+  pos += 2;
+
+  if (resp->maxcount < count) {
+    if ((hdr = realloc(resp->header, count * sizeof(s_prfhdr_t))) == NULL) {
+      return -1;
+    }
+    resp->header = hdr;
+    resp->maxcount = count;
+  }
+
+  for (i = 0; i < count; i++) {
+    resp->header[i].name = get_string(&pos, end);
+    resp->header[i].value = get_string(&pos, end);
+    if ((resp->header[i].name == NULL) || (resp->header[i].value == NULL)) {
+      return -1;
+    }
+  }
+  resp->count = count;
+
+  return 0;
+}
+
+/**
+ *  @brief  receives and decodes a response record
+ *
+ *  @arg    int, s_prfresp_t*
+ *  @return int (0 or -1)
+ */
+
+int prf_recv(int sock, s_prfresp_t *resp) {
+  uint32_t u32;
+  size_t len;
+
+  if (read_all(sock, (char *)&u32, 4) != 0) {
+    return -1;
+  }
+  len = ntohl(u32);
+  if ((len < PRFBIN_RESP_MIN) || (len > PRFBIN_MAX)) {
+    return -1;
+  }
+
+  if ((get_buffer(resp, len) != 0) || (read_all(sock, resp->buf, len) != 0)) {
+    return -1;
+  }
+
+  return decode_response(resp, len);
+}
+
+/**
+ *  @brief  decodes a response record (without length prefix) from memory,
+ *          e.g. a recorded response (see prfrec.h)
+ *
+ *  @arg    s_prfresp_t*, const char*, size_t
+ *  @return int (0 or -1)
+ */
+
+int prf_decode(s_prfresp_t *resp, const char *buf, size_t len) {
+  if ((len > PRFBIN_MAX) || (get_buffer(resp, len) != 0)) {
+    return -1;
+  }
+  memcpy(resp->buf, buf, len);
+
+  return decode_response(resp, len);
+}
+
+/**
+ *  @brief  sends a request and waits for its response
+ *
+ *  @arg    int, const s_prfreq_t*, s_prfresp_t*
+ *  @return int (0 or -1)
+ */
+
+int prf_request(int sock, const s_prfreq_t *req, s_prfresp_t *resp) {
+  if (prf_send(sock, req) != 0) {
+    return -1;
+  }
+
+  return prf_recv(sock, resp);
+}
+
+/**
+ *  @brief  initializes an (empty) response
+ *
+ *  @arg    s_prfresp_t*
+ *  @return void
+ */
+
+void prf_init_response(s_prfresp_t *resp) { memset(resp, 0, sizeof(*resp)); }
+
+/**
+ *  @brief  frees the response buffers
+ *
+ *  @arg    s_prfresp_t*
+ *  @return void
+ */
+
+void prf_free_response(s_prfresp_t *resp) {
+  free(resp->buf);
+  free(resp->header);
+  prf_init_response(resp);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    prfclient.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief binary PRF protocol client library header file
+ */
+
+#ifndef PRFCLIENT_H_INCLUDED
+#define PRFCLIENT_H_INCLUDED
+
+/******************************************************************* INCLUDE */
+
+#include "prfbin.h"
+#include <stddef.h>
+
+/******************************************************************* TYPEDEF */
+
+typedef struct PRFREQ {
+  unsigned int tindex;
+  unsigned int tlabel;
+  const char *ruri;
+  const char *next;
+  /* raw sip header block (CRLF separated, not base64 encoded) */
+  const char *shdr;
+  size_t shdrlen;
+} s_prfreq_t;
+
+typedef struct PRFHDR {
+  char *name;
+  char *value;
+} s_prfhdr_t;
+
+/* strings point into buf, valid until the next prf_recv/prf_free_response */
+typedef struct PRFRESP {
+  unsigned int tindex;
+  unsigned int tlabel;
+  int status;
+  char *target;
+  s_prfhdr_t *header;
+  int count;
+  /* receive buffers, reused by subsequent calls */
+  char *buf;
+  size_t size;
+  int maxcount;
+} s_prfresp_t;
+
+/****************************************************************PROTOTYPES */
+
+int prf_connect(const char *);
+void prf_close(int);
+
+int prf_send(int, const s_prfreq_t *);
+int prf_recv(int, s_prfresp_t *);
+int prf_request(int, const s_prfreq_t *, s_prfresp_t *);
+int prf_decode(s_prfresp_t *, const char *, size_t);
+
+void prf_init_response(s_prfresp_t *);
+void prf_free_response(s_prfresp_t *);
+
+#endif // PRFCLIENT_H_INCLUDED
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    prfrec.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief PRF traffic recording (file format shared by rngin and prf-replay)
+ *
+ *  A recording starts with PRFREC_MAGIC, followed by one record per
+ *  evaluated request. Integers are unsigned and in network byte order,
+ *  strings are not NUL terminated (see prfbin.h).
+ *
+ *  record:   u32 len | u32 time (high) | u32 time (low) |
+ *            u32 n | request[n] |
+ *            u16 count | count * (u16 n | uri[n] | u16 n | state[n] |
+ *                                 u32 max | u32 length | u8 found) |
+ *            u8 type | u32 n | response[n]
+ *
+ *  time is the arrival time in us since the recording started. request is
+ *  a binary protocol request record, response the response as sent (type
+ *  PRFREC_JSON: PRF response json, PRFREC_BIN: binary response record), both
+ *  without their length prefix. The queue states are the results of all
+ *  queue lookups made for the request (found 0: uri not in the database).
+ */
+
+#ifndef PRFREC_H_INCLUDED
+#define PRFREC_H_INCLUDED
+
+/******************************************************************** DEFINE */
+
+#define PRFREC_MAGIC "PRFREC1\n"
+#define PRFREC_MAGICLEN 8
+
+/* response types */
+#define PRFREC_JSON 0
+#define PRFREC_BIN 1
+
+#endif // PRFREC_H_INCLUDED
@@ -0,0 +1,499 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    qcache.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief this file holds the queue state cache definitions
+ *
+ *  Queue states change far less often than requests arrive. A refresher
+ *  thread polls PRAGMA data_version on its own connection and reloads the
+ *  whole queues table into a hash table only after another connection
+ *  (qngin) has written. The event loop takes up a new table when a
+ *  request starts, so all lookups of a request see the same states, and
+ *  frees the one it replaces. Lookups fall back to the database while
+ *  there is no table or the newest one is older than QCACHE_MAXAGE
+ *  refresh intervals. The refresher thread does not log, the event loop
+ *  reports its errors.
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "functions.h"
+#include "qcache.h"
+#include <sqlite3.h>
+
+/******************************************************************* GLOBALS */
+
+static s_qcache_t *pQcache = NULL;
+
+/* event loop only: table in use and refresh errors reported so far */
+static s_qtable_t *current = NULL;
+static unsigned long errseen = 0;
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  FNV-1a hash of a queue uri, case insensitive (as LIKE)
+ *
+ *  @arg    const char*
+ *  @return unsigned long
+ */
+
+static unsigned long hash_uri(const char *uri) {
+
+  unsigned long hash = 14695981039346656037UL;
+
+  for (; *uri; uri++) {
+    hash ^= (unsigned char)tolower((unsigned char)*uri);
+    hash *= 1099511628211UL;
+  }
+
+  return hash;
+}
+
+/**
+ *  @brief  frees a table
+ *
+ *  @arg    s_qtable_t*
+ *  @return void
+ */
+
+static void free_table(s_qtable_t *table) {
+
+  int i;
+
+  if (table == NULL) {
+    return;
+  }
+
+  for (i = 0; i < table->count; i++) {
+    free(table->entry[i].uri);
+    free(table->entry[i].state);
+  }
+  free(table->entry);
+  free(table->slot);
+  free(table);
+}
+
+/**
+ *  @brief  indexes the entries of a table, of equal uris the last one
+ *          wins (as the last row of a lookup)
+ *
+ *  @arg    s_qtable_t*
+ *  @return int (0 or -1)
+ */
+
+static int index_table(s_qtable_t *table) {
+
+  unsigned long slots = 2;
+  unsigned long k;
+  int i;
+  int j;
+
+  while (slots < 2 * (unsigned long)table->count) {
+    slots <<= 1;
+  }
+
+  table->slot = (int *)malloc(slots * sizeof(int));
+  if (table->slot == NULL) {
+    return -1;
+  }
+  table->mask = slots - 1;
+  for (k = 0; k < slots; k++) {
+    table->slot[k] = -1;
+  }
+
+  for (i = 0; i < table->count; i++) {
+    for (k = table->entry[i].hash & table->mask; (j = table->slot[k]) >= 0;
+         k = (k + 1) & table->mask) {
+      if ((table->entry[j].hash == table->entry[i].hash) &&
+          (strcasecmp(table->entry[j].uri, table->entry[i].uri) == 0)) {
+        break;
+      }
+    }
+    table->slot[k] = i;
+  }
+
+  return 0;
+}
+
+/**
+ *  @brief  reads the queues table
+ *
+ *  @arg    sqlite3_stmt*
+ *  @return s_qtable_t* (NULL on error)
+ */
+
+static s_qtable_t *load_table(sqlite3_stmt *stmt) {
+
+  s_qtable_t *table = NULL;
+  s_qentry_t *entry = NULL;
+  const char *str = NULL;
+  int size = 0;
+  int res;
+
+  table = (s_qtable_t *)calloc(1, sizeof(s_qtable_t));
+  if (table == NULL) {
+    return NULL;
+  }
+
+  while ((res = sqlite3_step(stmt)) == SQLITE_ROW) {
+    str = (const char *)sqlite3_column_text(stmt, 0);
+    if (str == NULL) {
+      continue;
+    }
+    if (table->count == size) {
+      size = size ? 2 * size : 64;
+      entry = (s_qentry_t *)realloc(table->entry, size * sizeof(s_qentry_t));
+      if (entry == NULL) {
+        break;
+      }
+      table->entry = entry;
+    }
+    entry = &table->entry[table->count];
+    entry->uri = strdup(str);
+    str = (const char *)sqlite3_column_text(stmt, 1);
+    entry->state = (str != NULL) ? strdup(str) : NULL;
+    entry->max = sqlite3_column_int(stmt, 2);
+    entry->length = sqlite3_column_int(stmt, 3);
+    table->count++;
+    if ((entry->uri == NULL) || ((str != NULL) && (entry->state == NULL))) {
+      break;
+    }
+    entry->hash = hash_uri(entry->uri);
+  }
+  sqlite3_reset(stmt);
+
+  if ((res != SQLITE_DONE) || (index_table(table) != 0)) {
+    free_table(table);
+    return NULL;
+  }
+
+  return table;
+}
+
+/**
+ *  @brief  closes the refresher connection
+ *
+ *  @arg    s_qcache_t*
+ *  @return void
+ */
+
+static void close_db(s_qcache_t *qc) {
+
+  sqlite3_finalize(qc->version);
+  sqlite3_finalize(qc->select);
+  sqlite3_close(qc->db);
+
+  qc->version = NULL;
+  qc->select = NULL;
+  qc->db = NULL;
+  qc->loaded = false;
+}
+
+/**
+ *  @brief  opens the refresher connection (read-only) and prepares the
+ *          data version and table queries
+ *
+ *  @arg    s_qcache_t*
+ *  @return int (0 or -1)
+ */
+
+static int open_db(s_qcache_t *qc) {
+
+  if ((sqlite3_open_v2(qc->dbfile, &qc->db, SQLITE_OPEN_READONLY, NULL) !=
+       SQLITE_OK) ||
+      (sqlite3_prepare_v3(qc->db, "PRAGMA data_version;", -1,
+                          SQLITE_PREPARE_PERSISTENT, &qc->version,
+                          NULL) != SQLITE_OK) ||
+      (sqlite3_prepare_v3(qc->db, "SELECT uri, state, max, length FROM queues;",
+                          -1, SQLITE_PREPARE_PERSISTENT, &qc->select,
+                          NULL) != SQLITE_OK)) {
+    close_db(qc);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ *  @brief  reloads the queues table if the data version has changed,
+ *          otherwise confirms the newest table as current
+ *
+ *  @arg    s_qcache_t*
+ *  @return int (0 or -1: error, counted)
+ */
+
+static int refresh(s_qcache_t *qc) {
+
+  s_qtable_t *table = NULL;
+  long long dv = 0;
+  double start = 0;
+  int res;
+
+  if ((qc->db == NULL) && (open_db(qc) != 0)) {
+    atomic_fetch_add(&qc->errors, 1);
+    return -1;
+  }
+
+  /* the states read after this are current as of start */
+  start = get_usec();
+  res = sqlite3_step(qc->version);
+  if (res == SQLITE_ROW) {
+    dv = sqlite3_column_int64(qc->version, 0);
+  }
+  sqlite3_reset(qc->version);
+
+  if ((res == SQLITE_ROW) && (!qc->loaded || (dv != qc->dataversion))) {
+    table = load_table(qc->select);
+    if (table != NULL) {
+      free_table(atomic_exchange(&qc->pending, table));
+      metrics_inc(M_QCACHE_LOAD);
+      qc->dataversion = dv;
+      qc->loaded = true;
+    } else {
+      res = SQLITE_ERROR;
+    }
+  }
+
+  if (res != SQLITE_ROW) {
+    atomic_fetch_add(&qc->errors, 1);
+    /* a locked database is retried, anything else reopens it */
+    if (res != SQLITE_BUSY) {
+      close_db(qc);
+    }
+    return -1;
+  }
+
+  atomic_store(&qc->checked, (unsigned long)start);
+
+  return 0;
+}
+
+/**
+ *  @brief  refresher thread: refreshes the table every interval
+ *
+ *  @arg    void*
+ *  @return void*
+ */
+
+static void *qcache_refresher(void *arg) {
+
+  s_qcache_t *qc = (s_qcache_t *)arg;
+  struct timespec ts;
+
+  ts.tv_sec = qc->interval / 1000;
+  ts.tv_nsec = (qc->interval % 1000) * 1000000;
+
+  while (atomic_load(&qc->running)) {
+    nanosleep(&ts, NULL);
+    refresh(qc);
+  }
+
+  close_db(qc);
+
+  return NULL;
+}
+
+/**
+ *  @brief  loads the queues table and starts the refresher thread, the
+ *          table is reloaded at most every ms (0: no cache, lookups go to
+ *          the database); the first load is done before returning, so
+ *          requests find the cache populated
+ *
+ *  @arg    const char*, long
+ *  @return int (0 or -1)
+ */
+
+int qcache_start(const char *dbfile, long ms) {
+
+  s_qcache_t *qc = NULL;
+
+  if ((pQcache != NULL) || (ms <= 0) || (dbfile == NULL)) {
+    return 0;
+  }
+
+  qc = (s_qcache_t *)calloc(1, sizeof(s_qcache_t));
+  if (qc == NULL) {
+    LOG4ERROR(pL, "could not allocate queue state cache");
+    return -1;
+  }
+
+  qc->dbfile = strdup(dbfile);
+  qc->interval = ms;
+  atomic_init(&qc->pending, NULL);
+  atomic_init(&qc->checked, 0);
+  atomic_init(&qc->errors, 0);
+  atomic_init(&qc->running, true);
+
+  if (qc->dbfile == NULL) {
+    LOG4ERROR(pL, "could not allocate queue state cache");
+    free(qc);
+    return -1;
+  }
+
+  /* e.g. a locked database, the refresher thread retries */
+  if (refresh(qc) != 0) {
+    LOG4WARN(pL, "could not load queue states, using the database meanwhile");
+  }
+
+  if (pthread_create(&qc->thread, NULL, qcache_refresher, qc) != 0) {
+    LOG4ERROR(pL, "could not start queue state refresher");
+    close_db(qc);
+    free_table(atomic_exchange(&qc->pending, NULL));
+    free(qc->dbfile);
+    free(qc);
+    return -1;
+  }
+
+  pQcache = qc;
+  errseen = atomic_load(&qc->errors);
+  qcache_update();
+
+  LOG4INFO(pL, "caching queue states, refreshed every %ld ms", ms);
+
+  return 0;
+}
+
+/**
+ *  @brief  stops the refresher thread and frees the tables
+ *
+ *  @arg    void
+ *  @return void
+ */
+
+void qcache_stop(void) {
+
+  s_qcache_t *qc = pQcache;
+
+  if (qc == NULL) {
+    return;
+  }
+
+  atomic_store(&qc->running, false);
+  pthread_join(qc->thread, NULL);
+
+  pQcache = NULL;
+
+  free_table(atomic_exchange(&qc->pending, NULL));
+  free_table(current);
+  current = NULL;
+  free(qc->dbfile);
+  free(qc);
+}
+
+/**
+ *  @brief  takes up the newest table (event loop, between requests: the
+ *          table it replaces is no longer in use) and reports refresh
+ *          errors
+ *
+ *  @arg    void
+ *  @return void
+ */
+
+void qcache_update(void) {
+
+  s_qtable_t *table = NULL;
+  unsigned long errors = 0;
+
+  if (pQcache == NULL) {
+    return;
+  }
+
+  table = atomic_exchange(&pQcache->pending, NULL);
+  if (table != NULL) {
+    free_table(current);
+    current = table;
+    LOG4DEBUG(pL, "queue states reloaded (%d queues)", table->count);
+  }
+
+  errors = atomic_load_explicit(&pQcache->errors, memory_order_relaxed);
+  if (errors != errseen) {
+    LOG4WARN(pL, "queue state refresh failed (%lu times)", errors);
+    errseen = errors;
+  }
+}
+
+/**
+ *  @brief  looks up the state of a queue in the table in use
+ *
+ *  @arg    const char*, s_query_t*
+ *  @return int (0 if found, -1 if not, QCACHE_STALE: ask the database)
+ */
+
+int qcache_lookup(const char *uri, s_query_t *query) {
+
+  s_qentry_t *entry = NULL;
+  unsigned long hash = 0;
+  unsigned long k = 0;
+  double age = qcache_age();
+  int i;
+
+  if ((current == NULL) || (age < 0) ||
+      (age * 1e3 > QCACHE_MAXAGE * pQcache->interval)) {
+    return QCACHE_STALE;
+  }
+
+  hash = hash_uri(uri);
+
+  for (k = hash & current->mask; (i = current->slot[k]) >= 0;
+       k = (k + 1) & current->mask) {
+    entry = &current->entry[i];
+    if ((entry->hash == hash) && (strcasecmp(entry->uri, uri) == 0)) {
+      query->max = entry->max;
+      query->length = entry->length;
+      if (entry->state != NULL) {
+        query->state = copy_string(entry->state, strlen(entry->state));
+      }
+      LOG4DEBUG(pL, "\t- cached: %s [%s / %d / %d]", uri, entry->state,
+                entry->max, entry->length);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ *  @brief  time since the newest table was last known current
+ *
+ *  @arg    void
+ *  @return double (s, -1: no cache or nothing loaded yet)
+ */
+
+double qcache_age(void) {
+
+  unsigned long checked = 0;
+
+  if (pQcache == NULL) {
+    return -1;
+  }
+
+  checked = atomic_load(&pQcache->checked);
+  if (checked == 0) {
+    return -1;
+  }
+
+  return (get_usec() - checked) / 1e6;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    qcache.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief queue state cache header file
+ */
+
+#ifndef QCACHE_H_INCLUDED
+#define QCACHE_H_INCLUDED
+
+/******************************************************************* INCLUDE */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/******************************************************************** DEFINE */
+
+/* states older than this many refresh intervals are looked up in the
+   database instead (refresher stalled, database locked) */
+#define QCACHE_MAXAGE 10
+
+/* qcache_lookup: no current states, look up in the database */
+#define QCACHE_STALE -2
+
+/******************************************************************* TYPEDEF */
+
+typedef struct QENTRY {
+  char *uri;
+  char *state;
+  int max;
+  int length;
+  unsigned long hash;
+} s_qentry_t;
+
+/* the queues table as of one data version, not changed once published */
+typedef struct QTABLE {
+  s_qentry_t *entry;
+  int count;
+  /* open addressing, entry index (-1: free slot) */
+  int *slot;
+  unsigned long mask;
+} s_qtable_t;
+
+/* single producer (refresher thread), single consumer (event loop) */
+typedef struct QCACHE {
+  char *dbfile;
+  long interval;
+  /* refresher connection and the data version of the newest table, used
+     by qcache_start for the first load, then by the refresher thread */
+  struct sqlite3 *db;
+  struct sqlite3_stmt *version;
+  struct sqlite3_stmt *select;
+  long long dataversion;
+  bool loaded;
+  /* loaded table, not yet taken up by the event loop */
+  _Atomic(s_qtable_t *) pending;
+  /* last time the newest table was known current (monotonic us) */
+  atomic_ulong checked;
+  atomic_ulong errors;
+  atomic_bool running;
+  pthread_t thread;
+} s_qcache_t;
+
+/****************************************************************PROTOTYPES */
+
+struct QUERY;
+
+int qcache_start(const char *, long);
+void qcache_stop(void);
+void qcache_update(void);
+int qcache_lookup(const char *, struct QUERY *);
+double qcache_age(void);
+
+#endif // QCACHE_H_INCLUDED
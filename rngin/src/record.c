@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * requires: liblog4c-dev
+ */
+
+/**
+ *  @file    record.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief this file holds the PRF traffic recording function definitions
+ *
+ *  Every evaluated request is appended to the recording file (see
+ *  prfrec.h) together with the queue states it was evaluated against and
+ *  the response sent. The request is encoded before evaluation, as the
+ *  SIP header block is tokenized in place while it is parsed.
+ */
+
+/******************************************************************* INCLUDE */
+
+#include "functions.h"
+#include "record.h"
+#include <arpa/inet.h>
+#include <stdint.h>
+
+/******************************************************************* GLOBALS */
+
+static FILE *pRec = NULL;
+/* record under construction */
+static struct mbuf rec;
+static double recstart = 0;
+static bool pending = FALSE;
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  appends an unsigned 16 bit integer (network byte order)
+ *
+ *  @arg    unsigned int
+ *  @return void
+ */
+
+static void put_u16(unsigned int num) {
+
+  uint16_t val = htons((uint16_t)num);
+
+  mbuf_append(&rec, &val, sizeof(val));
+}
+
+/**
+ *  @brief  appends an unsigned 32 bit integer (network byte order)
+ *
+ *  @arg    unsigned int
+ *  @return void
+ */
+
+static void put_u32(unsigned int num) {
+
+  uint32_t val = htonl((uint32_t)num);
+
+  mbuf_append(&rec, &val, sizeof(val));
+}
+
+/**
+ *  @brief  patches an unsigned 32 bit integer at off
+ *
+ *  @arg    size_t, unsigned int
+ *  @return void
+ */
+
+static void set_u32(size_t off, unsigned int num) {
+
+  uint32_t val = htonl((uint32_t)num);
+
+  memcpy(rec.buf + off, &val, sizeof(val));
+}
+
+/**
+ *  @brief  appends a u16 length prefixed string (NULL: empty)
+ *
+ *  @arg    const char*
+ *  @return void
+ */
+
+static void put_str(const char *str) {
+
+  size_t len = str ? strlen(str) : 0;
+
+  if (len > UINT16_MAX) {
+    len = UINT16_MAX;
+  }
+
+  put_u16(len);
+  mbuf_append(&rec, str, len);
+}
+
+/**
+ *  @brief  opens (appends to) the recording file
+ *
+ *  @arg    const char*
+ *  @return int (0 or -1)
+ */
+
+int rec_start(const char *file) {
+
+  if (pRec != NULL) {
+    return -1;
+  }
+
+  pRec = fopen(file, "ab");
+  if (pRec == NULL) {
+    LOG4ERROR(pL, "can not open recording file [%s]", file);
+    return -1;
+  }
+  setvbuf(pRec, NULL, _IOFBF, REC_BUFSIZE);
+
+  if ((ftell(pRec) == 0) &&
+      (fwrite(PRFREC_MAGIC, 1, PRFREC_MAGICLEN, pRec) != PRFREC_MAGICLEN)) {
+    LOG4ERROR(pL, "can not write recording file [%s]", file);
+    fclose(pRec);
+    pRec = NULL;
+    return -1;
+  }
+
+  mbuf_init(&rec, MAX_HDR_LINE);
+  recstart = get_usec();
+  pending = FALSE;
+
+  LOG4INFO(pL, "recording requests to [%s]", file);
+
+  return 0;
+}
+
+/**
+ *  @brief  closes the recording file
+ *
+ *  @arg    void
+ *  @return void
+ */
+
+void rec_stop(void) {
+
+  if (pRec == NULL) {
+    return;
+  }
+
+  fclose(pRec);
+  pRec = NULL;
+  mbuf_free(&rec);
+}
+
+/**
+ *  @brief  encodes a request (before it is evaluated)
+ *
+ *  @arg    s_input_t*
+ *  @return void
+ */
+
+void rec_request(s_input_t *in) {
+
+  unsigned long long usec = 0;
+  size_t off = 0;
+
+  if (pRec == NULL) {
+    return;
+  }
+
+  usec = (unsigned long long)(get_usec() - recstart);
+
+  rec.len = 0;
+  /* record and request length, patched later */
+  put_u32(0);
+  put_u32(usec >> 32);
+  put_u32(usec & 0xffffffff);
+  off = rec.len;
+  put_u32(0);
+
+  put_u32(in->tindex);
+  put_u32(in->tlabel);
+  put_str(in->ruri);
+  put_str(in->next);
+  put_u32(in->shdrlen);
+  mbuf_append(&rec, in->shdr, in->shdrlen);
+
+  set_u32(off, rec.len - off - 4);
+  pending = TRUE;
+}
+
+/**
+ *  @brief  completes the record of the last request with the queue states
+ *          of the snapshot and the response, then writes it
+ *
+ *  @arg    s_qsnap_t*, int, const char*, size_t
+ *  @return void
+ */
+
+void rec_decision(s_qsnap_t *snap, int type, const char *resp, size_t len) {
+
+  s_qstate_t *pstate = NULL;
+  int count = (snap != NULL) ? snap->count : 0;
+  int i;
+
+  if ((pRec == NULL) || (!pending)) {
+    return;
+  }
+  pending = FALSE;
+
+  put_u16(count);
+  for (i = 0; i < count; i++) {
+    pstate = &snap->qstate[i];
+    put_str(pstate->uri);
+    put_str(pstate->query.state);
+    put_u32((unsigned int)pstate->query.max);
+    put_u32((unsigned int)pstate->query.length);
+    mbuf_append(&rec, (pstate->res == 0) ? "\1" : "\0", 1);
+  }
+
+  mbuf_append(&rec, (type == PRFREC_BIN) ? "\1" : "\0", 1);
+  put_u32(len);
+  mbuf_append(&rec, resp, len);
+
+  set_u32(0, rec.len - 4);
+
+  if (fwrite(rec.buf, 1, rec.len, pRec) != rec.len) {
+    LOG4ERROR(pL, "recording file write failed, recording stopped");
+    rec_stop();
+  }
+}
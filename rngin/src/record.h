@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    record.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief PRF traffic recording header file
+ */
+
+#ifndef RECORD_H_INCLUDED
+#define RECORD_H_INCLUDED
+
+/******************************************************************* INCLUDE */
+
+#include "prfrec.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/******************************************************************** DEFINE */
+
+/* stdio buffer of the recording file */
+#define REC_BUFSIZE 65536
+
+/****************************************************************PROTOTYPES */
+
+struct INPUT;
+struct QSNAP;
+
+int rec_start(const char *);
+void rec_stop(void);
+
+void rec_request(struct INPUT *);
+void rec_decision(struct QSNAP *, int, const char *, size_t);
+
+#endif // RECORD_H_INCLUDED
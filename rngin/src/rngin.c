@@ -31,11 +31,44 @@
 /******************************************************************* INCLUDE */
 
 #include "functions.h"
+#include <netdb.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/******************************************************************* TYPEDEF */
+
+typedef struct SERVER {
+    s_cfg_t *cfg;
+    const char *netif;
+    const char *recfile;
+    long cachettl;
+    /* queue state cache refresh interval (ms, 0: off) */
+    long qcache;
+    /* listening sockets (-1: none), opened before workers are forked */
+    int http;
+    int unixhttp;
+    int bin;
+    /* handoff socket (-1: none), TRUE once the listeners are handed over */
+    int ctl;
+    bool handoff;
+    /* worker number (0: single process) */
+    int worker;
+} s_server_t;
 
 /******************************************************************* GLOBALS */
 
 static sig_atomic_t s_signal_received = 0;
+static sig_atomic_t s_drain = 0;
+
+/* takes the place of closed listeners while draining, mongoose looks up
+ * http endpoints through the listener of a connection */
+static struct mg_connection s_listener;
 
 /******************************************************************* SIGNALS */
 
@@ -44,30 +77,527 @@ static void signal_handler(int sig_num) {
     s_signal_received = sig_num;
 }
 
+static void drain_handler(int sig_num) {
+    signal(sig_num, drain_handler);
+    s_drain = 1;
+}
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  opens a listening unix domain socket (stale socket file is
+ *          removed, file permissions are set to mode)
+ *
+ *  @arg    const char*, mode_t
+ *  @return int (socket or -1)
+ */
+
+static int listen_unix(const char *path, mode_t mode) {
+    struct sockaddr_un sun;
+    struct stat st;
+    int sock;
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        LOG4ERROR(pL, "unix socket path too long: %s", path);
+        return -1;
+    }
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+
+    /* remove socket file left by a previous run */
+    if ((lstat(path, &st) == 0) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        LOG4ERROR(pL, "could not create unix socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if ((bind(sock, (struct sockaddr *)&sun, sizeof(sun)) != 0) ||
+        (chmod(path, mode) != 0) || (listen(sock, SOMAXCONN) != 0)) {
+        LOG4ERROR(pL, "could not listen on %s: %s", path, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/**
+ *  @brief  opens a listening tcp socket, addr is [host:]port
+ *
+ *  @arg    const char*
+ *  @return int (socket or -1)
+ */
+
+static int listen_tcp(const char *addr) {
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    const char *port = strrchr(addr, ':');
+    char host[256];
+    int on = 1;
+    int sock;
+    int err;
+
+    host[0] = '\0';
+    if (port == NULL) {
+        port = addr;
+    } else {
+        snprintf(host, sizeof(host), "%.*s", (int)(port - addr), addr);
+        port++;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    err = getaddrinfo((host[0] != '\0') ? host : NULL, port, &hints, &res);
+    if (err != 0) {
+        LOG4ERROR(pL, "could not resolve %s: %s", addr, gai_strerror(err));
+        return -1;
+    }
+
+    if ((sock = socket(res->ai_family, res->ai_socktype, 0)) < 0) {
+        LOG4ERROR(pL, "could not create socket: %s", strerror(errno));
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if ((bind(sock, res->ai_addr, res->ai_addrlen) != 0) ||
+        (listen(sock, SOMAXCONN) != 0)) {
+        LOG4ERROR(pL, "could not listen on %s: %s", addr, strerror(errno));
+        close(sock);
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    freeaddrinfo(res);
+
+    return sock;
+}
+
+/**
+ *  @brief  adds a listening socket to the mongoose manager
+ *
+ *  @arg    struct mg_mgr*, int, mg_event_handler_t, bool (HTTP API), void*
+ *  @return int (0 or -1)
+ */
+
+static int add_listener(struct mg_mgr *mgr, int sock, mg_event_handler_t handler,
+                        bool http, void *user_data) {
+    struct mg_add_sock_opts sock_opts;
+    struct mg_connection *nc;
+
+    memset(&sock_opts, 0, sizeof(sock_opts));
+    sock_opts.user_data = user_data;
+
+    nc = mg_add_sock_opt(mgr, sock, handler, sock_opts);
+    if (!nc) {
+        LOG4ERROR(pL, "could not add listening socket %d", sock);
+        return -1;
+    }
+
+    nc->flags |= MG_F_LISTENING;
+    if (http) {
+        mg_set_protocol_http_websocket(nc);
+    }
+
+    return 0;
+}
+
+/**
+ *  @brief  hands the listening sockets over to a restarted rngin that
+ *          connected to the handoff socket
+ *
+ *  @arg    s_server_t*, int
+ *  @return bool (TRUE: handed over)
+ */
+
+static bool hand_over(s_server_t *srv, int sock) {
+    int socks[HANDOFF_SOCKS];
+
+    socks[0] = srv->http;
+    socks[1] = srv->unixhttp;
+    socks[2] = srv->bin;
+
+    if (handoff_send(sock, socks) != 0) {
+        return FALSE;
+    }
+    srv->handoff = TRUE;
+
+    return TRUE;
+}
+
+/**
+ *  @brief  handoff socket event handler, a restarted rngin connected
+ *
+ *  @arg    struct mg_connection*, int, void*
+ *  @return void
+ */
+
+static void ev_ctlhandler(struct mg_connection *nc, int ev, void *ev_data) {
+    s_server_t *srv = (s_server_t *)nc->user_data;
+
+    (void)ev_data;
+
+    if (ev != MG_EV_ACCEPT) {
+        return;
+    }
+
+    if (hand_over(srv, (int)nc->sock)) {
+        s_drain = 1;
+    }
+    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+}
+
+/**
+ *  @brief  stops accepting and closes idle connections, connections with
+ *          a request in progress are closed once DRAIN_MS has passed
+ *
+ *  @arg    struct mg_mgr*, double* (deadline, 0: not draining yet)
+ *  @return int (connections left)
+ */
+
+static int drain(struct mg_mgr *mgr, double *until) {
+    struct mg_connection *nc;
+    double now = mg_time();
+    bool idle;
+    int left = 0;
+
+    if (*until == 0) {
+        *until = now + DRAIN_MS / 1e3;
+        ((s_cfg_t *)mgr->user_data)->draining = TRUE;
+        LOG4INFO(pL, "stopped accepting, draining connections");
+    }
+
+    for (nc = mg_next(mgr, NULL); nc != NULL; nc = mg_next(mgr, nc)) {
+        // binary clients have no close signal, http ones get Connection: close
+        idle = (nc->recv_mbuf.len == 0) && (nc->send_mbuf.len == 0) &&
+               ((nc->proto_handler == NULL) ||
+                (now - nc->last_io_time >= DRAIN_IDLE));
+        if ((nc->flags & MG_F_LISTENING) || (now >= *until) || idle) {
+            nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        }
+        if (nc->listener != NULL) {
+            nc->listener = &s_listener;
+        }
+        left++;
+    }
+
+    return left;
+}
+
+/**
+ *  @brief  runs the event loop on the listening sockets until a signal is
+ *          received, the listening sockets are closed on return
+ *
+ *  @arg    s_server_t*
+ *  @return int (0 or -1: could not start)
+ */
+
+static int serve(s_server_t *srv) {
+    struct mg_mgr mgr;
+    s_cfg_t *cfg = srv->cfg;
+    double until = 0;
+
+// initiate mongoose
+    if (netif_init(&mgr, NULL, srv->netif) != 0) {
+        return -1;
+    }
+    mgr.user_data = (void *)cfg;
+
+    if (((srv->http >= 0) && (add_listener(&mgr, srv->http, ev_handler, TRUE, NULL) != 0)) ||
+        ((srv->unixhttp >= 0) && (add_listener(&mgr, srv->unixhttp, ev_handler, TRUE, NULL) != 0)) ||
+        ((srv->bin >= 0) && (add_listener(&mgr, srv->bin, ev_binhandler, FALSE, NULL) != 0)) ||
+        ((srv->ctl >= 0) && (add_listener(&mgr, srv->ctl, ev_ctlhandler, FALSE, srv) != 0))) {
+        mg_mgr_free(&mgr);
+        return -1;
+    }
+
+// record requests, queue states and responses for replay
+    if ((srv->recfile != NULL) && (rec_start(srv->recfile) != 0)) {
+        LOG4ERROR(pL, "could not open recording file: %s", srv->recfile);
+        mg_mgr_free(&mgr);
+        return -1;
+    }
+
+// responses repeated for retransmitted transactions
+    if (cache_start(srv->cachettl) != 0) {
+        rec_stop();
+        mg_mgr_free(&mgr);
+        return -1;
+    }
+
+// queue states are read on a connection of this process, kept open
+    if (sqlite_OPEN(cfg->dbfile) == 0) {
+        LOG4WARN(pL, "could not open database, retrying on lookup: %s", cfg->dbfile);
+    }
+
+// queue states cached in memory, reloaded by a thread when they change
+    if (qcache_start(cfg->dbfile, srv->qcache) != 0) {
+        LOG4WARN(pL, "could not start queue state cache, using the database");
+    }
+
+// request logging is handed over to a writer thread
+    if (alog_start(ALOG_SLOTS) != 0) {
+        LOG4WARN(pL, "could not start log writer, logging synchronously");
+    }
+
+// start server
+    while (s_signal_received == 0) {
+        /* requests handled in one poll round count against the watermark,
+           requests not read in this round are not (see admit_request) */
+        cfg->backlog = 0;
+        mg_mgr_poll(&mgr, 1000);
+        /* after a handoff, until the last connection is closed */
+        if (s_drain && (drain(&mgr, &until) == 0)) {
+            break;
+        }
+    }
+
+// stop and cleanup
+    if (srv->worker > 0) {
+        LOG4INFO(pL, "worker %d stopped (%lu requests exceeded the deadline, %lu shed)",
+                 srv->worker, cfg->timeouts, cfg->shed);
+    } else {
+        printf("\n");
+        LOG4INFO(pL, "rngin stopped (%lu requests exceeded the deadline, %lu shed)",
+                 cfg->timeouts, cfg->shed);
+    }
+    alog_stop();
+    rec_stop();
+    cache_stop();
+    qcache_stop();
+    sqlite_CLOSE();
+
+    mg_mgr_free(&mgr);
+
+    return 0;
+}
+
+/**
+ *  @brief  forks a worker process that serves the listening sockets, it
+ *          stops with the supervisor
+ *
+ *  @arg    s_server_t*, int
+ *  @return pid_t (-1 on error)
+ */
+
+static pid_t start_worker(s_server_t *srv, int worker) {
+    pid_t ppid = getpid();
+    pid_t pid;
+
+    fflush(stdout);
+
+    pid = fork();
+    if (pid < 0) {
+        LOG4ERROR(pL, "could not fork worker %d: %s", worker, strerror(errno));
+        return -1;
+    }
+    if (pid > 0) {
+        return pid;
+    }
+
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != ppid) {
+        exit(0);
+    }
+    signal(SIGTERM, signal_handler);
+    signal(SIGINT, signal_handler);
+
+    /* the supervisor answers the handoff socket */
+    if (srv->ctl >= 0) {
+        close(srv->ctl);
+        srv->ctl = -1;
+    }
+    srv->worker = worker;
+    LOG4INFO(pL, "worker %d started (pid %d)", worker, (int)getpid());
+
+    exit((serve(srv) == 0) ? 0 : 1);
+}
+
+/**
+ *  @brief  starts the worker processes and restarts crashed ones until a
+ *          signal is received or the listening sockets are handed over,
+ *          the listening sockets stay open meanwhile, so connections queue
+ *          up instead of being refused
+ *
+ *  @arg    s_server_t*, int
+ *  @return int (0 or -1: a worker could not start)
+ */
+
+static int supervise(s_server_t *srv, int workers) {
+    struct sigaction sa;
+    struct pollfd pfd;
+    pid_t pid[WORKERS_MAX];
+    double started[WORKERS_MAX];
+    int status;
+    int ret = 0;
+    int sock;
+    int i;
+    pid_t p;
+
+    /* without SA_RESTART, a signal interrupts waitpid */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sa.sa_handler = drain_handler;
+    sigaction(SIGUSR2, &sa, NULL);
+
+    for (i = 0; i < workers; i++) {
+        pid[i] = start_worker(srv, i + 1);
+        started[i] = mg_time();
+        if (pid[i] < 0) {
+            s_signal_received = SIGTERM;
+            ret = -1;
+        }
+    }
+
+    while ((s_signal_received == 0) && !s_drain) {
+        /* a restarted rngin takes over, the workers drain and exit */
+        if (srv->ctl >= 0) {
+            pfd.fd = srv->ctl;
+            pfd.events = POLLIN;
+            if ((poll(&pfd, 1, 200) > 0) &&
+                ((sock = accept(srv->ctl, NULL, NULL)) >= 0)) {
+                hand_over(srv, sock);
+                close(sock);
+                if (srv->handoff) {
+                    break;
+                }
+            }
+        }
+
+        p = waitpid(-1, &status, (srv->ctl >= 0) ? WNOHANG : 0);
+        if (p == 0) {
+            continue;
+        }
+        if (p < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (i = 0; (i < workers) && (pid[i] != p); i++);
+        if (i == workers) {
+            continue;
+        }
+        pid[i] = -1;
+
+        if (WIFSIGNALED(status)) {
+            LOG4ERROR(pL, "worker %d (pid %d) killed by signal %d", i + 1, (int)p,
+                      WTERMSIG(status));
+        } else {
+            LOG4WARN(pL, "worker %d (pid %d) exited with status %d", i + 1, (int)p,
+                     WEXITSTATUS(status));
+            /* start failed (e.g. unknown backend), would fail again */
+            if (WEXITSTATUS(status) == 1) {
+                ret = -1;
+                break;
+            }
+        }
+
+        /* a worker that keeps crashing is not restarted in a tight loop */
+        if (mg_time() - started[i] < RESPAWN_MS / 1e3) {
+            usleep(RESPAWN_MS * 1000);
+        }
+        if (s_signal_received == 0) {
+            pid[i] = start_worker(srv, i + 1);
+            started[i] = mg_time();
+        }
+    }
+
+    for (i = 0; i < workers; i++) {
+        if (pid[i] > 0) {
+            kill(pid[i], (srv->handoff || s_drain) ? SIGUSR2 : SIGTERM);
+        }
+    }
+    for (i = 0; i < workers; i++) {
+        if (pid[i] > 0) {
+            waitpid(pid[i], NULL, 0);
+        }
+    }
+
+    printf("\n");
+    LOG4INFO(pL, "rngin stopped (%d workers)", workers);
+
+    return ret;
+}
+
+/**
+ *  @brief  raises the open file limit to the hard limit, every client
+ *          connection holds a descriptor
+ *
+ *  @arg    void
+ *  @return void
+ */
+
+static void raise_nofile(void) {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+        return;
+    }
+
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+            LOG4WARN(pL, "could not raise open file limit: %s", strerror(errno));
+            return;
+        }
+    }
+
+    LOG4DEBUG(pL, "open file limit: %lu", (unsigned long)rl.rlim_cur);
+}
+
 /********************************************************************** MAIN */
 int main(int argc, char *argv[]) {
-    struct mg_mgr mgr;
-    struct mg_connection *nc;
-    struct mg_bind_opts bind_opts;
+    s_server_t srv;
+    cJSON_Hooks hooks;
 
     const char *strHttpPort = NULL;
     const char *strLogCat = NULL;
     const char *strIPAddr = NULL;
     const char *strDBName = NULL;
     const char *strYamlFile = NULL;
+    const char *strUnixPath = NULL;
+    const char *strBinAddr = NULL;
+    const char *strRecFile = NULL;
+    const char *strNetIf = NULL;
+    const char *strCtlPath = NULL;
 
     char s_ip_port[256];
     int opt = 0;
+    int socks[HANDOFF_SOCKS];
+    int workers = 0;
+    int ret = 0;
+    int i;
+
+    mode_t sock_mode = 0660;
+
+    long deadline = DEADLINE_MS;
+    long cachettl = 0;
+    long qcache = 0;
+    int watermark = 0;
 
     FILE *fh = NULL;
     s_cfg_t *cfg = NULL;
 
     signal(SIGTERM, signal_handler);
     signal(SIGINT, signal_handler);
+    signal(SIGUSR2, drain_handler);
 
     strLogCat = LOGCAT;
 
-    while ((opt = getopt(argc, argv, "i:p:f:d:v")) != -1) {
+    while ((opt = getopt(argc, argv, "i:p:f:d:u:m:b:t:w:r:c:q:e:n:H:v")) != -1) {
         switch(opt) {
         case 'v':
             strLogCat = LOGCATDBG;
@@ -84,6 +614,39 @@ int main(int argc, char *argv[]) {
         case 'p':
             strHttpPort = optarg;
             break;
+        case 'u':
+            strUnixPath = optarg;
+            break;
+        case 'm':
+            sock_mode = (mode_t)strtol(optarg, NULL, 8);
+            break;
+        case 'b':
+            strBinAddr = optarg;
+            break;
+        case 't':
+            deadline = strtol(optarg, NULL, 10);
+            break;
+        case 'w':
+            watermark = atoi(optarg);
+            break;
+        case 'r':
+            strRecFile = optarg;
+            break;
+        case 'c':
+            cachettl = strtol(optarg, NULL, 10);
+            break;
+        case 'q':
+            qcache = strtol(optarg, NULL, 10);
+            break;
+        case 'e':
+            strNetIf = optarg;
+            break;
+        case 'n':
+            workers = atoi(optarg);
+            break;
+        case 'H':
+            strCtlPath = optarg;
+            break;
         case '?':
             if (optopt == 'i') {
                 ERROR_PRINT("Option -%c requires ip address as argument\n", optopt);
@@ -93,6 +656,28 @@ int main(int argc, char *argv[]) {
                 ERROR_PRINT("Option -%c requires rules file as argument\n", optopt);
             } else if (optopt == 'd') {
                 ERROR_PRINT("Option -%c requires sqlite database name as argument\n", optopt);
+            } else if (optopt == 'u') {
+                ERROR_PRINT("Option -%c requires unix socket path as argument\n", optopt);
+            } else if (optopt == 'm') {
+                ERROR_PRINT("Option -%c requires octal file mode as argument\n", optopt);
+            } else if (optopt == 'w') {
+                ERROR_PRINT("Option -%c requires shedding watermark (requests) as argument\n", optopt);
+            } else if (optopt == 't') {
+                ERROR_PRINT("Option -%c requires request deadline (ms) as argument\n", optopt);
+            } else if (optopt == 'r') {
+                ERROR_PRINT("Option -%c requires recording file as argument\n", optopt);
+            } else if (optopt == 'c') {
+                ERROR_PRINT("Option -%c requires response cache ttl (ms) as argument\n", optopt);
+            } else if (optopt == 'q') {
+                ERROR_PRINT("Option -%c requires queue state refresh interval (ms) as argument\n", optopt);
+            } else if (optopt == 'e') {
+                ERROR_PRINT("Option -%c requires event loop backend (select|epoll|uring) as argument\n", optopt);
+            } else if (optopt == 'n') {
+                ERROR_PRINT("Option -%c requires number of worker processes as argument\n", optopt);
+            } else if (optopt == 'H') {
+                ERROR_PRINT("Option -%c requires handoff socket path as argument\n", optopt);
+            } else if (optopt == 'b') {
+                ERROR_PRINT("Option -%c requires binary protocol port or unix socket path as argument\n", optopt);
             } else {
                 ERROR_PRINT("Unknown option `-%c'.\n", optopt);
             }
@@ -101,8 +686,21 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if ((strIPAddr == NULL) || (strHttpPort == NULL) || (strDBName == NULL) || (strYamlFile == NULL)) {
-        ERROR_PRINT("usage: rngin -i <ip/domain str> -p <listening port> -f <rules file> -d <db file>\n");
+    if ((strDBName == NULL) || (strYamlFile == NULL) ||
+        (((strIPAddr == NULL) || (strHttpPort == NULL)) && (strUnixPath == NULL) &&
+         (strBinAddr == NULL))) {
+        ERROR_PRINT("usage: rngin -i <ip/domain str> -p <listening port> [-u <unix socket> [-m <mode>]] [-b <binary port|unix socket>] [-t <deadline ms>] [-w <watermark>] [-r <recording file>] [-c <cache ttl ms>] [-q <queue refresh ms>] [-e <select|epoll|uring>] [-n <workers>] [-H <handoff socket>] -f <rules file> -d <db file>\n");
+        exit(0);
+    }
+
+    if ((workers < 0) || (workers > WORKERS_MAX)) {
+        ERROR_PRINT("number of worker processes must be 0 to %d\n", WORKERS_MAX);
+        exit(0);
+    }
+
+    /* workers would interleave their records */
+    if ((workers > 0) && (strRecFile != NULL)) {
+        ERROR_PRINT("recording (-r) requires a single process (-n 0)\n");
         exit(0);
     }
 
@@ -122,6 +720,14 @@ int main(int argc, char *argv[]) {
 
     LOG4DEBUG(pL, "ip/domain string: %s", strIPAddr);
     LOG4DEBUG(pL, "listening port: %s", strHttpPort);
+    LOG4DEBUG(pL, "unix socket: %s (%04o)", strUnixPath, (unsigned int)sock_mode);
+    LOG4DEBUG(pL, "binary protocol: %s", strBinAddr);
+    LOG4DEBUG(pL, "request deadline: %ld ms", deadline);
+    LOG4DEBUG(pL, "shedding watermark: %d", watermark);
+    LOG4DEBUG(pL, "response cache ttl: %ld ms", cachettl);
+    LOG4DEBUG(pL, "queue state refresh: %ld ms", qcache);
+    LOG4DEBUG(pL, "worker processes: %d", workers);
+    LOG4DEBUG(pL, "handoff socket: %s", strCtlPath);
     LOG4DEBUG(pL, "rules file: %s", strYamlFile);
     LOG4DEBUG(pL, "sqlite database: %s", strDBName);
 
@@ -149,38 +755,160 @@ int main(int argc, char *argv[]) {
 
     cfg->dbfile = strDBName;
     cfg->rulefile = strYamlFile;
+    cfg->deadline = deadline;
+    cfg->timeouts = 0;
+    cfg->draining = FALSE;
+    cfg->watermark = watermark;
+
+// request arena, cJSON allocates from it as well
+    cfg->arena = new_arena(ARENA_BLKSIZE);
+    if (cfg->arena == NULL) {
+        LOG4ERROR(pL, "could not allocate memory");
+        free(cfg);
+        log4c_fini();
+        exit(0);
+    }
 
-    snprintf(s_ip_port, 255, "%s:%s", strIPAddr, strHttpPort);
+// load shedding answer, computed once
+    if (init_shed(cfg) != 0) {
+        LOG4ERROR(pL, "could not allocate memory");
+        delete_arena(cfg->arena);
+        free(cfg);
+        log4c_fini();
+        exit(0);
+    }
 
-// initiate mongoose
-    mg_mgr_init(&mgr, NULL);
-    mgr.user_data = (void *)cfg;
+    hooks.malloc_fn = arena_malloc;
+    hooks.free_fn = arena_free;
+    cJSON_InitHooks(&hooks);
+
+// listening sockets, shared by all workers
+    memset(&srv, 0, sizeof(srv));
+    srv.cfg = cfg;
+    srv.netif = strNetIf;
+    srv.recfile = strRecFile;
+    srv.cachettl = cachettl;
+    srv.qcache = qcache;
+    srv.ctl = -1;
+
+// take them over from a running rngin, rules and database are loaded
+    if (strCtlPath != NULL) {
+        handoff_recv(strCtlPath, socks);
+    } else {
+        for (i = 0; i < HANDOFF_SOCKS; i++) {
+            socks[i] = -1;
+        }
+    }
+    srv.http = socks[0];
+    srv.unixhttp = socks[1];
+    srv.bin = socks[2];
+
+    /* handed over, but not served by this configuration */
+    if (((strIPAddr == NULL) || (strHttpPort == NULL)) && (srv.http >= 0)) {
+        close(srv.http);
+        srv.http = -1;
+    }
+    if ((strUnixPath == NULL) && (srv.unixhttp >= 0)) {
+        close(srv.unixhttp);
+        srv.unixhttp = -1;
+    }
+    if ((strBinAddr == NULL) && (srv.bin >= 0)) {
+        close(srv.bin);
+        srv.bin = -1;
+    }
 
-    memset(&bind_opts, 0, sizeof(bind_opts));
+    if ((strIPAddr != NULL) && (strHttpPort != NULL)) {
+        snprintf(s_ip_port, 255, "%s:%s", strIPAddr, strHttpPort);
 
-    nc = mg_bind_opt(&mgr, s_ip_port, ev_handler, bind_opts);
+        if (srv.http < 0) {
+            srv.http = listen_tcp(s_ip_port);
+        }
+        if (srv.http < 0) {
+            ERROR_PRINT("could not bind port: %s\n", strHttpPort);
+            exit(0);
+        }
+    }
 
-    if (!nc) {
-        ERROR_PRINT("could not bind port: %s\n", strHttpPort);
-        exit(0);
+// unix domain socket listener (same HTTP API)
+    if ((strUnixPath != NULL) && (srv.unixhttp < 0)) {
+        srv.unixhttp = listen_unix(strUnixPath, sock_mode);
+        if (srv.unixhttp < 0) {
+            ERROR_PRINT("could not listen on unix socket: %s\n", strUnixPath);
+            exit(0);
+        }
     }
+// binary protocol listener (tcp port or unix socket path)
+    if ((strBinAddr != NULL) && (srv.bin < 0) && (strchr(strBinAddr, '/') != NULL)) {
+        srv.bin = listen_unix(strBinAddr, sock_mode);
+        if (srv.bin < 0) {
+            ERROR_PRINT("could not listen on unix socket: %s\n", strBinAddr);
+            exit(0);
+        }
+    } else if ((strBinAddr != NULL) && (srv.bin < 0)) {
+        if (strIPAddr != NULL) {
+            snprintf(s_ip_port, 255, "%s:%s", strIPAddr, strBinAddr);
+        } else {
+            snprintf(s_ip_port, 255, "%s", strBinAddr);
+        }
 
-// set up HTTP server parameters
-    mg_set_protocol_http_websocket(nc);
-    //s_http_server_opts.document_root = ".";  // Serve current directory
-    //s_http_server_opts.dav_document_root = ".";  // Allow access via WebDav
-    //s_http_server_opts.enable_directory_listing = "yes";
+        srv.bin = listen_tcp(s_ip_port);
+        if (srv.bin < 0) {
+            ERROR_PRINT("could not bind port: %s\n", strBinAddr);
+            exit(0);
+        }
+    }
 
-// start server
-    while (s_signal_received == 0) {
-        mg_mgr_poll(&mgr, 1000);
+// handoff socket for the next restart
+    if (strCtlPath != NULL) {
+        srv.ctl = listen_unix(strCtlPath, 0600);
+        if (srv.ctl < 0) {
+            ERROR_PRINT("could not listen on handoff socket: %s\n", strCtlPath);
+            exit(0);
+        }
     }
 
-// stop and cleanup
-    printf("\n");
-    LOG4INFO(pL, "rngin stopped");
+// many connections need many descriptors
+    raise_nofile();
 
-    mg_mgr_free(&mgr);
+// serve in this process or in forked workers
+    if (workers == 0) {
+        ret = serve(&srv);
+    } else {
+        /* one set of metrics for all workers, whichever answers /metrics */
+        if (metrics_share() != 0) {
+            ERROR_PRINT("could not share metrics between workers\n");
+            exit(0);
+        }
+        ret = supervise(&srv, workers);
+        if (srv.http >= 0) {
+            close(srv.http);
+        }
+        if (srv.unixhttp >= 0) {
+            close(srv.unixhttp);
+        }
+        if (srv.bin >= 0) {
+            close(srv.bin);
+        }
+        if (srv.ctl >= 0) {
+            close(srv.ctl);
+        }
+    }
+    if (ret != 0) {
+        ERROR_PRINT("could not start server\n");
+    }
+
+    /* after a handoff, the socket files belong to the new rngin */
+    if ((strUnixPath != NULL) && !srv.handoff) {
+        unlink(strUnixPath);
+    }
+    if ((strBinAddr != NULL) && (strchr(strBinAddr, '/') != NULL) && !srv.handoff) {
+        unlink(strBinAddr);
+    }
+    if ((strCtlPath != NULL) && !srv.handoff) {
+        unlink(strCtlPath);
+    }
+    delete_shed(cfg);
+    delete_arena(cfg->arena);
     free(cfg);
 
     log4c_fini();
@@ -32,6 +32,18 @@
 
 #include "sqlite.h"
 
+/******************************************************************* GLOBALS */
+
+/* persistent read-only connection of this process and its statements */
+static sqlite3 *s_db = NULL;
+static const char *s_dbfile = NULL;
+static sqlite3_stmt *s_stmt[STMT_COUNT];
+static bool s_reopen = FALSE;
+
+static const char *s_sql[STMT_COUNT] = {
+    "SELECT state, max, length FROM queues WHERE uri LIKE ?1;", "BEGIN;",
+    "COMMIT;"};
+
 /***************************************************************** FUNCTIONS */
 
 /**
@@ -80,40 +92,189 @@ int sqlite_CHECK(const char *dbname) {
 
 
 /**
- *  @brief  DB query to get service mapping (input urn + location)
+ *  @brief  opens the persistent read-only connection of this process and
+ *          prepares its statements (call after fork, connections must not
+ *          be shared between processes)
  *
- *  @arg    p_req_t, char*
- *  @return int
+ *  @arg    const char*
+ *  @return 1 if ok, otherwise 0
  */
 
-int sqlite_QUERY(s_query_t *query, char *next, const char *dbname) {
-  sqlite3 *db;
-  sqlite3_stmt *stmt;
+int sqlite_OPEN(const char *dbfile) {
+  sqlite3 *db = NULL;
+  int i;
 
-  char strQuery[QUERYSIZE];
+  sqlite_CLOSE();
+  s_dbfile = dbfile;
 
-  int len;
-  int iRes = -1;
+  if (dbfile == NULL) {
+    return 0;
+  }
 
-  // open database
-  CALL_SQLITE(open_v2(dbname, &db, SQLITE_OPEN_READONLY, NULL));
-  // init database connection
+  CALL_SQLITE(open_v2(dbfile, &db, SQLITE_OPEN_READONLY, NULL));
 
-  if (next) {
-    snprintf(strQuery, QUERYSIZE - 1,
-             "SELECT state, max, length FROM queues WHERE uri LIKE '%s';",
-             next);
-  } else {
-    return iRes;
+  if (!db) {
+    LOG4ERROR(pL, "cannot open database: %s", dbfile);
+    return 0;
   }
 
-  LOG4DEBUG(pL, " query: [%s]", strQuery);
+  s_db = db;
 
-  CALL_SQLITE(prepare_v2(db, strQuery, strlen(strQuery) + 1, &stmt, NULL));
+  /* a bound LIKE pattern would otherwise re-prepare the query per binding */
+  sqlite3_db_config(db, SQLITE_DBCONFIG_ENABLE_QPSG, 1, NULL);
 
-  while (sqlite3_step(stmt) == SQLITE_ROW) {
+  for (i = 0; i < STMT_COUNT; i++) {
+    if (sqlite3_prepare_v3(db, s_sql[i], -1, SQLITE_PREPARE_PERSISTENT,
+                           &s_stmt[i], NULL) != SQLITE_OK) {
+      LOG4ERROR(pL, "cannot prepare [%s]: %s", s_sql[i], sqlite3_errmsg(db));
+      sqlite_CLOSE();
+      return 0;
+    }
+  }
+
+  LOG4DEBUG(pL, "database opened: %s", dbfile);
+
+  return 1;
+}
+
+/**
+ *  @brief  finalizes the statements and closes the persistent connection
+ *
+ *  @arg    void
+ *  @return void
+ */
+
+void sqlite_CLOSE(void) {
+  sqlite3 *db = s_db;
+  int i;
+
+  for (i = 0; i < STMT_COUNT; i++) {
+    sqlite3_finalize(s_stmt[i]);
+    s_stmt[i] = NULL;
+  }
+
+  if (db != NULL) {
+    CALL_SQLITE(close(db));
+  }
+
+  s_db = NULL;
+  s_reopen = FALSE;
+}
+
+/**
+ *  @brief  persistent connection to dbfile, (re)opened when missing, after
+ *          an error or for another file; never while a snapshot holds it
+ *
+ *  @arg    const char*
+ *  @return sqlite3* (NULL: no database)
+ */
+
+static sqlite3 *get_db(const char *dbfile) {
+
+  if ((s_db != NULL) && !s_reopen && (s_dbfile != NULL) && (dbfile != NULL) &&
+      (strcmp(s_dbfile, dbfile) == 0)) {
+    return s_db;
+  }
+
+  if (dbfile == NULL) {
+    return NULL;
+  }
+
+  sqlite_OPEN(dbfile);
+
+  return s_db;
+}
+
+/**
+ *  @brief  runs a statement without result rows
+ *
+ *  @arg    sqlite3*, int
+ *  @return int (sqlite result code)
+ */
+
+static int run_stmt(sqlite3 *db, int id) {
+  int res = sqlite3_step(s_stmt[id]);
+
+  if (res != SQLITE_DONE) {
+    LOG4ERROR(pL, "%s failed with status %d: %s", s_sql[id], res,
+              sqlite3_errmsg(db));
+  }
+  sqlite3_reset(s_stmt[id]);
+
+  return res;
+}
+
+/**
+ *  @brief  sqlite progress handler, interrupts a statement once the
+ *          request deadline has passed
+ *
+ *  @arg    void*
+ *  @return int (non-zero interrupts)
+ */
+
+static int check_progress(void *arg) {
+
+  return check_deadline((s_qsnap_t *)arg) ? 1 : 0;
+}
+
+/**
+ *  @brief  removes the lock wait and the progress handler, the connection
+ *          outlives the request whose snapshot the handler points to
+ *
+ *  @arg    sqlite3*
+ *  @return void
+ */
+
+static void clear_timeout(sqlite3 *db) {
+
+  sqlite3_busy_timeout(db, 0);
+  sqlite3_progress_handler(db, 0, NULL, NULL);
+}
+
+/**
+ *  @brief  bounds lock waits and statement run time by the remaining
+ *          request time (without deadline: no busy wait, as before)
+ *
+ *  @arg    sqlite3*, s_qsnap_t*
+ *  @return void
+ */
+
+static void set_timeout(sqlite3 *db, s_qsnap_t *snap) {
+
+  double left = 0;
+
+  if (snap->deadline == 0) {
+    clear_timeout(db);
+    return;
+  }
+
+  left = (snap->deadline - get_usec()) / 1e3;
+
+  sqlite3_busy_timeout(db, left < 1 ? 1 : (int)left);
+  sqlite3_progress_handler(db, DEADLINE_OPS, check_progress, snap);
+}
+
+/**
+ *  @brief  runs the prepared queue state query, uri as bound parameter
+ *
+ *  @arg    sqlite3*, s_query_t*, char*
+ *  @return int
+ */
+
+static int query_queue(sqlite3 *db, s_query_t *query, char *next) {
+  sqlite3_stmt *stmt = s_stmt[STMT_QUEUE];
+
+  int len;
+  int res;
+  int iRes = -1;
+
+  LOG4DEBUG(pL, " query: [%s] [%s]", s_sql[STMT_QUEUE], next);
+
+  CALL_SQLITE(bind_text(stmt, 1, next, -1, SQLITE_STATIC));
+
+  while ((res = sqlite3_step(stmt)) == SQLITE_ROW) {
     len = sqlite3_column_bytes(stmt, 0);
-    query->state = (char *)malloc(len + 1);
+    query->state = (char *)arena_malloc(len + 1);
     if (query->state != NULL) {
       memcpy(query->state, (char *)sqlite3_column_text(stmt, 0), len);
       query->state[len] = '\0';
@@ -125,11 +286,114 @@ int sqlite_QUERY(s_query_t *query, char *next, const char *dbname) {
     iRes = 0;
   }
 
-  CALL_SQLITE(finalize(stmt));
-  CALL_SQLITE(db_release_memory(db));
-  CALL_SQLITE(close(db));
+  /* locked or cut short by the deadline, other errors reopen the database */
+  if ((res != SQLITE_DONE) && (res != SQLITE_INTERRUPT)) {
+    LOG4ERROR(pL, "queue query failed with status %d: %s", res,
+              sqlite3_errmsg(db));
+    s_reopen = (res != SQLITE_BUSY);
+  }
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
 
   LOG4DEBUG(pL, "result: [%s / %d / %d]", query->state, query->max, query->length);
 
   return iRes;
 }
+
+/**
+ *  @brief  DB query to get service mapping (input urn + location)
+ *
+ *  @arg    s_query_t*, char*, s_qsnap_t*
+ *  @return int
+ */
+
+int sqlite_QUERY(s_query_t *query, char *next, s_qsnap_t *snap) {
+  sqlite3 *db;
+  int res;
+
+  if (next == NULL) {
+    return -1;
+  }
+
+  db = get_db(snap->dbfile);
+  if (db == NULL) {
+    return -1;
+  }
+
+  set_timeout(db, snap);
+  res = query_queue(db, query, next);
+  clear_timeout(db);
+
+  return res;
+}
+
+/**
+ *  @brief  starts a read transaction on the persistent connection, so that
+ *          all queue lookups of a snapshot see the same database state
+ *
+ *  @arg    s_qsnap_t*
+ *  @return 1 if ok, otherwise 0
+ */
+
+int sqlite_SNAPSHOT(s_qsnap_t *snap) {
+  sqlite3 *db;
+
+  snap->db = NULL;
+
+  db = get_db(snap->dbfile);
+  if (db == NULL) {
+    return 0;
+  }
+
+  if (run_stmt(db, STMT_BEGIN) != SQLITE_DONE) {
+    s_reopen = TRUE;
+    return 0;
+  }
+
+  snap->db = db;
+
+  return 1;
+}
+
+/**
+ *  @brief  queue state query within a snapshot (see sqlite_SNAPSHOT)
+ *
+ *  @arg    s_query_t*, char*, s_qsnap_t*
+ *  @return int
+ */
+
+int sqlite_QUERYSNAP(s_query_t *query, char *next, s_qsnap_t *snap) {
+
+  if ((next == NULL) || (snap->db == NULL)) {
+    return -1;
+  }
+
+  set_timeout(snap->db, snap);
+
+  return query_queue(snap->db, query, next);
+}
+
+/**
+ *  @brief  ends snapshot read transaction, the connection stays open
+ *
+ *  @arg    s_qsnap_t*
+ *  @return void
+ */
+
+void sqlite_RELEASE(s_qsnap_t *snap) {
+  sqlite3 *db = snap->db;
+
+  if (db == NULL) {
+    return;
+  }
+
+  /* an error may have ended the transaction already */
+  if (!sqlite3_get_autocommit(db) &&
+      (run_stmt(db, STMT_COMMIT) != SQLITE_DONE)) {
+    s_reopen = TRUE;
+  }
+  clear_timeout(db);
+
+  snap->db = NULL;
+}
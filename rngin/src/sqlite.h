@@ -40,6 +40,12 @@
 #define QUERYSIZE 1024
 #define BUFSIZE 256
 
+/* prepared statements of the persistent connection */
+#define STMT_QUEUE 0
+#define STMT_BEGIN 1
+#define STMT_COMMIT 2
+#define STMT_COUNT 3
+
 #define CALL_SQLITE(f)                                          \
     {                                                           \
         int i;                                                  \
@@ -0,0 +1,1029 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    uring.c
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief this file holds the io_uring event loop backend definitions
+ *
+ *  A mongoose network interface on top of io_uring (raw system calls, no
+ *  liburing). Listeners keep a multishot accept and connections a
+ *  multishot receive armed, received data lands in a ring of provided
+ *  buffers. Output is copied into a registered buffer and sent with one
+ *  send in flight per connection, the data stays in the send mbuf until
+ *  the completion arrives. Every loop round is a single io_uring_enter()
+ *  that submits the sends of the last round and waits for completions.
+ *  Once per NETIF_SWEEP_MS all connections are visited, as with epoll.
+ *
+ *  Multishot receive and sends from registered buffers need kernel 6.0,
+ *  netif_init() falls back to epoll on older kernels, and on hosts whose
+ *  kernel headers predate 6.1 (see URING_SUPPORTED). Outgoing connections
+ *  are not supported (rngin does not make any).
+ */
+
+/******************************************************************* INCLUDE */
+
+/* accept4() */
+#define _GNU_SOURCE
+
+#include "functions.h"
+#include "netif.h"
+#include "uring.h"
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#ifdef URING_SUPPORTED
+
+/******************************************************************* GLOBALS */
+
+/* mongoose socket interface (mg_net_if_socket.c), the io_uring backend
+ * reuses binding and listening */
+extern const struct mg_iface_vtable mg_socket_iface_vtable;
+
+void mg_socket_if_sock_set(struct mg_connection *, sock_t);
+void mg_socket_if_destroy_conn(struct mg_connection *);
+time_t mg_socket_if_poll(struct mg_iface *, int);
+
+static struct mg_iface_vtable uring_vtable;
+
+/* received data handed to mongoose by uring_tcp_recv */
+static struct mg_connection *pStaged = NULL;
+static const char *staged = NULL;
+static size_t stagedLen = 0;
+
+/***************************************************************** FUNCTIONS */
+
+/**
+ *  @brief  io_uring system calls
+ *
+ *  @arg    see io_uring_setup(2), io_uring_enter(2), io_uring_register(2)
+ *  @return int (-1 on error, errno set)
+ */
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags,
+                     void *arg, size_t argsz) {
+
+  return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg,
+                      argsz);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned num) {
+
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, num);
+}
+
+/**
+ *  @brief  checks whether the kernel supports what the backend uses
+ *
+ *  @arg    void
+ *  @return bool
+ */
+
+static bool uring_probe(void) {
+
+  static const int ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+                            IORING_OP_ASYNC_CANCEL, IORING_OP_SEND_ZC};
+  const unsigned features =
+      IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+
+  struct io_uring_params p;
+  struct io_uring_probe *probe = NULL;
+  size_t size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+  bool ok = FALSE;
+  unsigned i;
+  int fd;
+
+  memset(&p, 0, sizeof(p));
+  fd = sys_setup(4, &p);
+  if (fd < 0) {
+    LOG4WARN(pL, "io_uring not available: %s", strerror(errno));
+    return FALSE;
+  }
+
+  probe = (struct io_uring_probe *)calloc(1, size);
+  if (probe == NULL) {
+    LOG4ERROR(pL, "could not allocate memory");
+    close(fd);
+    return FALSE;
+  }
+
+  if (((p.features & features) == features) &&
+      (sys_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0)) {
+    ok = TRUE;
+    /* SEND_ZC came with 6.0, like multishot receive and fixed buffer send */
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+      if ((ops[i] > probe->last_op) ||
+          !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+        ok = FALSE;
+      }
+    }
+  }
+  if (!ok) {
+    LOG4WARN(pL, "io_uring of this kernel is too old (6.0 required)");
+  }
+
+  free(probe);
+  close(fd);
+
+  return ok;
+}
+
+/**
+ *  @brief  submits queued entries, optionally waits for a completion
+ *
+ *  @arg    s_uring_t*, int (ms, -1: do not wait)
+ *  @return void
+ */
+
+static void submit(s_uring_t *ring, int wait_ms) {
+
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  unsigned num;
+  int res;
+
+  __atomic_store_n(ring->sqtail, ring->sqlocal, __ATOMIC_RELEASE);
+  num = ring->sqlocal - __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE);
+
+  if ((wait_ms < 0) ||
+      (*ring->cqhead != __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE))) {
+    if (num == 0) {
+      return;
+    }
+    res = sys_enter(ring->fd, num, 0, 0, NULL, 0);
+  } else {
+    memset(&arg, 0, sizeof(arg));
+    ts.tv_sec = wait_ms / 1000;
+    ts.tv_nsec = (wait_ms % 1000) * 1000000L;
+    arg.ts = (unsigned long)&ts;
+    res = sys_enter(ring->fd, num, 1,
+                    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                    sizeof(arg));
+  }
+
+  if ((res < 0) && (errno != ETIME) && (errno != EINTR) &&
+      (errno != EBUSY)) {
+    LOG4ERROR(pL, "io_uring_enter failed: %s", strerror(errno));
+  }
+}
+
+/**
+ *  @brief  next free submission queue entry, submits if the queue is full
+ *
+ *  @arg    s_uring_t*
+ *  @return struct io_uring_sqe* (NULL: queue full)
+ */
+
+static struct io_uring_sqe *get_sqe(s_uring_t *ring) {
+
+  struct io_uring_sqe *sqe = NULL;
+
+  if (ring->sqlocal - __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE) >=
+      ring->sqentries) {
+    submit(ring, -1);
+    if (ring->sqlocal - __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE) >=
+        ring->sqentries) {
+      return NULL;
+    }
+  }
+
+  sqe = &ring->sqes[ring->sqlocal & ring->sqmask];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sqlocal++;
+
+  return sqe;
+}
+
+/**
+ *  @brief  hands a receive buffer back to the kernel
+ *
+ *  @arg    s_uring_t*, unsigned short
+ *  @return void
+ */
+
+static void put_rbuf(s_uring_t *ring, unsigned short bid) {
+
+  struct io_uring_buf *buf = &ring->br->bufs[ring->brtail & (URING_RBUFS - 1)];
+
+  buf->addr = (unsigned long)(ring->rbuf + (size_t)bid * URING_RBUFSIZE);
+  buf->len = URING_RBUFSIZE;
+  buf->bid = bid;
+  ring->brtail++;
+  __atomic_store_n(&ring->br->tail, ring->brtail, __ATOMIC_RELEASE);
+}
+
+/**
+ *  @brief  arms the multishot accept of a listener or the multishot
+ *          receive of a connection (retried by the sweep if the submission
+ *          queue is full)
+ *
+ *  @arg    s_uring_t*, s_uconn_t*
+ *  @return void
+ */
+
+static void arm_conn(s_uring_t *ring, s_uconn_t *uc) {
+
+  struct io_uring_sqe *sqe = NULL;
+
+  if (uc->armed) {
+    return;
+  }
+
+  sqe = get_sqe(ring);
+  if (sqe == NULL) {
+    return;
+  }
+
+  sqe->fd = uc->fd;
+  if (uc->listener) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = (unsigned long)uc | URING_ACCEPT;
+  } else {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (unsigned long)uc | URING_RECV;
+  }
+
+  uc->armed = TRUE;
+  uc->pending++;
+}
+
+/**
+ *  @brief  sends the pending output of a connection (one send in flight)
+ *
+ *  @arg    s_uring_t*, s_uconn_t*
+ *  @return void
+ */
+
+static void send_conn(s_uring_t *ring, s_uconn_t *uc) {
+
+  struct mg_connection *nc = uc->nc;
+  struct io_uring_sqe *sqe = NULL;
+  size_t len = nc->send_mbuf.len;
+  char *buf = NULL;
+
+  if (uc->sending || (len == 0) || (nc->flags & MG_F_CLOSE_IMMEDIATELY)) {
+    return;
+  }
+
+  if ((ring->nfree > 0) && ring->fixed) {
+    if (len > URING_SBUFSIZE) {
+      len = URING_SBUFSIZE;
+    }
+    uc->slot = ring->sfree[--ring->nfree];
+    buf = ring->sbuf + (size_t)uc->slot * URING_SBUFSIZE;
+  } else {
+    /* all registered buffers in flight, e.g. many large batch responses */
+    buf = (char *)malloc(len);
+    if (buf == NULL) {
+      LOG4ERROR(pL, "could not allocate memory");
+      return;
+    }
+    uc->slot = -1;
+    uc->heap = buf;
+  }
+
+  sqe = get_sqe(ring);
+  if (sqe == NULL) {
+    if (uc->slot >= 0) {
+      ring->sfree[ring->nfree++] = uc->slot;
+    }
+    free(uc->heap);
+    uc->heap = NULL;
+    return;
+  }
+
+  memcpy(buf, nc->send_mbuf.buf, len);
+  sqe->fd = uc->fd;
+  sqe->addr = (unsigned long)buf;
+  sqe->len = (unsigned)len;
+  if (uc->slot >= 0) {
+    /* a send from a registered buffer is zero copy only, a write is not
+     * (SIGPIPE is ignored by mongoose) */
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->buf_index = 0;
+  } else {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->msg_flags = MSG_NOSIGNAL;
+  }
+  sqe->user_data = (unsigned long)uc | URING_SEND;
+
+  uc->sending = TRUE;
+  uc->pending++;
+}
+
+/**
+ *  @brief  sends pending output, closes the connection once it is done
+ *
+ *  @arg    s_uring_t*, s_uconn_t*, double
+ *  @return void
+ */
+
+static void flush_conn(s_uring_t *ring, s_uconn_t *uc, double now) {
+
+  struct mg_connection *nc = uc->nc;
+
+  send_conn(ring, uc);
+
+  if ((nc->flags & (MG_F_CLOSE_IMMEDIATELY | MG_F_RECV_AND_CLOSE)) ||
+      ((nc->flags & MG_F_SEND_AND_CLOSE) && (nc->send_mbuf.len == 0))) {
+    mg_if_poll(nc, now);
+  }
+}
+
+/**
+ *  @brief  attaches the backend state to a connection and arms it
+ *
+ *  @arg    struct mg_connection*
+ *  @return void
+ */
+
+static void add_uconn(struct mg_connection *nc) {
+
+  s_uring_t *ring = (s_uring_t *)nc->iface->data;
+  s_uconn_t *uc = NULL;
+  int listening = 0;
+  socklen_t len = sizeof(listening);
+
+  if ((ring == NULL) || (nc->sock == INVALID_SOCKET) ||
+      (nc->mgr_data != NULL)) {
+    return;
+  }
+
+  uc = (s_uconn_t *)calloc(1, sizeof(s_uconn_t));
+  if (uc == NULL) {
+    LOG4ERROR(pL, "could not allocate memory");
+    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+    return;
+  }
+
+  if (nc->flags & MG_F_UDP) {
+    LOG4ERROR(pL, "udp is not supported by the io_uring backend");
+    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+    free(uc);
+    return;
+  }
+
+  /* listeners are set before mongoose flags them */
+  if (getsockopt(nc->sock, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) != 0) {
+    listening = 0;
+  }
+
+  uc->nc = nc;
+  uc->fd = (int)nc->sock;
+  uc->listener = (listening != 0);
+  uc->slot = -1;
+  nc->mgr_data = uc;
+  ring->uconns++;
+
+  arm_conn(ring, uc);
+}
+
+/**
+ *  @brief  frees the backend state of a closed connection after its last
+ *          completion
+ *
+ *  @arg    s_uring_t*, s_uconn_t*
+ *  @return void
+ */
+
+static void free_uconn(s_uring_t *ring, s_uconn_t *uc) {
+
+  if ((uc->nc != NULL) || (uc->pending > 0)) {
+    return;
+  }
+
+  ring->uconns--;
+  free(uc);
+}
+
+/**
+ *  @brief  creates the ring and its buffers (mongoose interface init),
+ *          failures leave mongoose on select
+ *
+ *  @arg    struct mg_iface*
+ *  @return void
+ */
+
+static void uring_init(struct mg_iface *iface) {
+
+  s_uring_t *ring = (s_uring_t *)calloc(1, sizeof(s_uring_t));
+  struct io_uring_params p;
+  struct io_uring_buf_reg reg;
+  struct iovec iov;
+  size_t sqsz;
+  size_t cqsz;
+  char *base = NULL;
+  unsigned i;
+
+  if (ring == NULL) {
+    LOG4ERROR(pL, "could not allocate memory");
+    return;
+  }
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+            IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+  p.cq_entries = URING_ENTRIES * 4;
+  ring->fd = sys_setup(URING_ENTRIES, &p);
+  if ((ring->fd < 0) && (errno == EINVAL)) {
+    /* task work deferral came with 6.1 */
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    ring->fd = sys_setup(URING_ENTRIES, &p);
+  }
+  if (ring->fd < 0) {
+    LOG4ERROR(pL, "could not create io_uring: %s", strerror(errno));
+    free(ring);
+    return;
+  }
+
+  /* submission and completion queue share one mapping */
+  sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->ringsz = (sqsz > cqsz) ? sqsz : cqsz;
+  ring->ring = mmap(NULL, ring->ringsz, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->sqesz = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(
+      NULL, ring->sqesz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ring->fd, IORING_OFF_SQES);
+
+  /* receive buffers, the buffer ring must be page aligned */
+  ring->rbuf = (char *)malloc((size_t)URING_RBUFS * URING_RBUFSIZE);
+  if (posix_memalign((void **)&ring->br, 4096,
+                     URING_RBUFS * sizeof(struct io_uring_buf)) != 0) {
+    ring->br = NULL;
+  }
+
+  if ((ring->ring == MAP_FAILED) || (ring->sqes == MAP_FAILED) ||
+      (ring->rbuf == NULL) || (ring->br == NULL)) {
+    LOG4ERROR(pL, "could not map io_uring: %s", strerror(errno));
+    goto error;
+  }
+
+  base = (char *)ring->ring;
+  ring->sqhead = (unsigned *)(base + p.sq_off.head);
+  ring->sqtail = (unsigned *)(base + p.sq_off.tail);
+  ring->sqmask = *(unsigned *)(base + p.sq_off.ring_mask);
+  ring->sqentries = p.sq_entries;
+  ring->sqlocal = *ring->sqtail;
+  ring->cqhead = (unsigned *)(base + p.cq_off.head);
+  ring->cqtail = (unsigned *)(base + p.cq_off.tail);
+  ring->cqmask = *(unsigned *)(base + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+  for (i = 0; i < p.sq_entries; i++) {
+    ((unsigned *)(base + p.sq_off.array))[i] = i;
+  }
+
+  memset(ring->br, 0, URING_RBUFS * sizeof(struct io_uring_buf));
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long)ring->br;
+  reg.ring_entries = URING_RBUFS;
+  reg.bgid = URING_BGID;
+  if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    LOG4ERROR(pL, "could not register receive buffers: %s", strerror(errno));
+    goto error;
+  }
+  for (i = 0; i < URING_RBUFS; i++) {
+    put_rbuf(ring, (unsigned short)i);
+  }
+
+  /* registered send buffers count against RLIMIT_MEMLOCK, without them
+   * sends use heap buffers */
+  ring->sbuf = (char *)malloc((size_t)URING_SBUFS * URING_SBUFSIZE);
+  if (ring->sbuf != NULL) {
+    iov.iov_base = ring->sbuf;
+    iov.iov_len = (size_t)URING_SBUFS * URING_SBUFSIZE;
+    if (sys_register(ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+      ring->fixed = TRUE;
+    } else {
+      LOG4WARN(pL, "could not register send buffers: %s", strerror(errno));
+    }
+  }
+  for (i = 0; i < URING_SBUFS; i++) {
+    ring->sfree[i] = URING_SBUFS - 1 - (int)i;
+  }
+  ring->nfree = URING_SBUFS;
+
+  iface->data = ring;
+
+  return;
+
+error:
+  if ((ring->sqes != NULL) && (ring->sqes != MAP_FAILED)) {
+    munmap(ring->sqes, ring->sqesz);
+  }
+  if ((ring->ring != NULL) && (ring->ring != MAP_FAILED)) {
+    munmap(ring->ring, ring->ringsz);
+  }
+  close(ring->fd);
+  free(ring->rbuf);
+  free(ring->br);
+  free(ring);
+}
+
+/**
+ *  @brief  associates a socket (mongoose interface sock_set)
+ *
+ *  @arg    struct mg_connection*, sock_t
+ *  @return void
+ */
+
+static void uring_sock_set(struct mg_connection *nc, sock_t sock) {
+
+  mg_socket_if_sock_set(nc, sock);
+  add_uconn(nc);
+}
+
+/**
+ *  @brief  outgoing connections are not supported (mongoose interface
+ *          add_conn, called for all new connections)
+ *
+ *  @arg    struct mg_connection*
+ *  @return void
+ */
+
+static void uring_add_conn(struct mg_connection *nc) {
+
+  if ((nc->iface->data != NULL) && (nc->flags & MG_F_CONNECTING)) {
+    LOG4ERROR(pL, "outgoing connections are not supported by io_uring");
+    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+  }
+}
+
+/**
+ *  @brief  cancels the operations and closes the socket (mongoose
+ *          interface destroy_conn)
+ *
+ *  @arg    struct mg_connection*
+ *  @return void
+ */
+
+static void uring_destroy_conn(struct mg_connection *nc) {
+
+  s_uring_t *ring = (s_uring_t *)nc->iface->data;
+  s_uconn_t *uc = (s_uconn_t *)nc->mgr_data;
+  struct io_uring_sqe *sqe = NULL;
+
+  if ((ring != NULL) && (uc != NULL)) {
+    if (uc->armed) {
+      sqe = get_sqe(ring);
+      if (sqe != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr =
+            (unsigned long)uc | (uc->listener ? URING_ACCEPT : URING_RECV);
+        sqe->user_data = 0;
+      } else {
+        /* ends the receive as well */
+        shutdown(uc->fd, SHUT_RDWR);
+      }
+    }
+    uc->nc = NULL;
+    nc->mgr_data = NULL;
+    free_uconn(ring, uc);
+  }
+
+  mg_socket_if_destroy_conn(nc);
+}
+
+/**
+ *  @brief  hands staged received data to mongoose (mongoose interface
+ *          tcp_recv)
+ *
+ *  @arg    struct mg_connection*, void*, size_t
+ *  @return int (bytes received)
+ */
+
+static int uring_tcp_recv(struct mg_connection *nc, void *buf, size_t len) {
+
+  if (nc->iface->data == NULL) {
+    return (int)recv(nc->sock, buf, len, 0);
+  }
+
+  /* nothing staged, e.g. mongoose reading the rest while closing */
+  if ((nc != pStaged) || (stagedLen == 0)) {
+    return 0;
+  }
+
+  if (len > stagedLen) {
+    len = stagedLen;
+  }
+  memcpy(buf, staged, len);
+  staged += len;
+  stagedLen -= len;
+
+  return (int)len;
+}
+
+/**
+ *  @brief  sends data (mongoose interface tcp_send), only used if the ring
+ *          could not be created
+ *
+ *  @arg    struct mg_connection*, const void*, size_t
+ *  @return int (bytes sent, -1 on error)
+ */
+
+static int uring_tcp_send(struct mg_connection *nc, const void *buf,
+                          size_t len) {
+
+  ssize_t n = send(nc->sock, buf, len, MSG_NOSIGNAL);
+
+  if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+    return 0;
+  }
+
+  return (int)n;
+}
+
+/**
+ *  @brief  handles an accept completion
+ *
+ *  @arg    s_uring_t*, s_uconn_t*, int, unsigned, double
+ *  @return void
+ */
+
+static void handle_accept(s_uring_t *ring, s_uconn_t *uc, int res,
+                          unsigned flags, double now) {
+
+  struct mg_connection *nc = NULL;
+  union socket_address sa;
+  socklen_t len = sizeof(sa);
+
+  if (!(flags & IORING_CQE_F_MORE)) {
+    uc->armed = FALSE;
+    uc->pending--;
+  }
+
+  /* a listener flagged for closing (draining) takes no more connections */
+  if ((uc->nc != NULL) && (uc->nc->flags & MG_F_CLOSE_IMMEDIATELY)) {
+    uc->pending++;
+    mg_if_poll(uc->nc, now);
+    uc->pending--;
+  }
+
+  if (uc->nc == NULL) {
+    if (res >= 0) {
+      close(res);
+    }
+    free_uconn(ring, uc);
+    return;
+  }
+
+  if (res < 0) {
+    if (res != -ECANCELED) {
+      /* e.g. out of descriptors, re-armed by the next sweep */
+      LOG4WARN(pL, "could not accept connection: %s", strerror(-res));
+    }
+    return;
+  }
+
+  nc = mg_if_accept_new_conn(uc->nc);
+  if (nc == NULL) {
+    close(res);
+    return;
+  }
+
+  /* non-blocking and close-on-exec already */
+  nc->sock = res;
+  add_uconn(nc);
+  if (getpeername(res, &sa.sa, &len) != 0) {
+    memset(&sa, 0, sizeof(sa));
+  }
+  mg_if_accept_tcp_cb(nc, &sa, len);
+
+  if (!uc->armed && (uc->nc != NULL)) {
+    arm_conn(ring, uc);
+  }
+}
+
+/**
+ *  @brief  accepts what is left in the queue of a listening socket, the
+ *          wakeup may have gone to the accept of another process that was
+ *          cancelled meanwhile (handoff, stopped worker)
+ *
+ *  @arg    s_uring_t*, s_uconn_t*, double
+ *  @return void
+ */
+
+static void accept_queued(s_uring_t *ring, s_uconn_t *uc, double now) {
+
+  int fd;
+
+  while ((uc->nc != NULL) &&
+         ((fd = accept4(uc->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >=
+          0)) {
+    handle_accept(ring, uc, fd, IORING_CQE_F_MORE, now);
+  }
+}
+
+/**
+ *  @brief  handles a receive completion
+ *
+ *  @arg    s_uring_t*, s_uconn_t*, int, unsigned, double
+ *  @return void
+ */
+
+static void handle_recv(s_uring_t *ring, s_uconn_t *uc, int res,
+                        unsigned flags, double now) {
+
+  struct mg_connection *nc = uc->nc;
+  unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+
+  if (!(flags & IORING_CQE_F_MORE)) {
+    uc->armed = FALSE;
+    uc->pending--;
+  }
+
+  /* mongoose may close the connection, keep uc until the end */
+  uc->pending++;
+  if ((nc != NULL) && mg_if_poll(nc, now)) {
+    if (res > 0) {
+      pStaged = nc;
+      staged = ring->rbuf + (size_t)bid * URING_RBUFSIZE;
+      stagedLen = (size_t)res;
+      mg_if_can_recv_cb(nc);
+      /* mongoose stops at recv_mbuf_limit, keep the rest anyway */
+      if (stagedLen > 0) {
+        mbuf_append(&nc->recv_mbuf, staged, stagedLen);
+      }
+      pStaged = NULL;
+      stagedLen = 0;
+    } else if (res == 0) {
+      /* orderly shutdown, flush the output */
+      nc->flags |= MG_F_SEND_AND_CLOSE;
+    } else if ((res != -ENOBUFS) && (res != -ECANCELED)) {
+      nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+    }
+  }
+
+  uc->pending--;
+
+  if (flags & IORING_CQE_F_BUFFER) {
+    put_rbuf(ring, bid);
+  }
+
+  if (uc->nc == NULL) {
+    free_uconn(ring, uc);
+    return;
+  }
+
+  if (!uc->armed && (res != 0) &&
+      !(nc->flags & (MG_F_CLOSE_IMMEDIATELY | MG_F_SEND_AND_CLOSE))) {
+    arm_conn(ring, uc);
+  }
+
+  flush_conn(ring, uc, now);
+}
+
+/**
+ *  @brief  handles a send completion
+ *
+ *  @arg    s_uring_t*, s_uconn_t*, int, double
+ *  @return void
+ */
+
+static void handle_send(s_uring_t *ring, s_uconn_t *uc, int res, double now) {
+
+  struct mg_connection *nc = uc->nc;
+
+  uc->sending = FALSE;
+  uc->pending--;
+  if (uc->slot >= 0) {
+    ring->sfree[ring->nfree++] = uc->slot;
+    uc->slot = -1;
+  }
+  free(uc->heap);
+  uc->heap = NULL;
+
+  if (nc == NULL) {
+    free_uconn(ring, uc);
+    return;
+  }
+
+  if (res > 0) {
+    mbuf_remove(&nc->send_mbuf, (size_t)res);
+    mbuf_trim(&nc->send_mbuf);
+    nc->last_io_time = (time_t)now;
+  } else if (res < 0) {
+    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+  }
+
+  flush_conn(ring, uc, now);
+}
+
+/**
+ *  @brief  handles all completions
+ *
+ *  @arg    s_uring_t*, double
+ *  @return void
+ */
+
+static void reap(s_uring_t *ring, double now) {
+
+  struct io_uring_cqe *cqe = NULL;
+  unsigned head = *ring->cqhead;
+  unsigned long data;
+  unsigned flags;
+  s_uconn_t *uc = NULL;
+  int res;
+
+  while (head != __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE)) {
+    cqe = &ring->cqes[head & ring->cqmask];
+    data = cqe->user_data;
+    res = cqe->res;
+    flags = cqe->flags;
+    __atomic_store_n(ring->cqhead, ++head, __ATOMIC_RELEASE);
+
+    /* cancel requests */
+    if (data == 0) {
+      continue;
+    }
+
+    uc = (s_uconn_t *)(data & ~(unsigned long)URING_OPMASK);
+    switch (data & URING_OPMASK) {
+    case URING_ACCEPT:
+      handle_accept(ring, uc, res, flags, now);
+      break;
+    case URING_RECV:
+      handle_recv(ring, uc, res, flags, now);
+      break;
+    case URING_SEND:
+      handle_send(ring, uc, res, now);
+      break;
+    }
+  }
+}
+
+/**
+ *  @brief  closes the ring (mongoose interface free), waits for the
+ *          cancelled operations of closed connections
+ *
+ *  @arg    struct mg_iface*
+ *  @return void
+ */
+
+static void uring_free(struct mg_iface *iface) {
+
+  s_uring_t *ring = (s_uring_t *)iface->data;
+  int i;
+
+  if (ring == NULL) {
+    return;
+  }
+
+  for (i = 0; (i < 10) && (ring->uconns > 0); i++) {
+    submit(ring, 100);
+    reap(ring, mg_time());
+  }
+  if (ring->uconns > 0) {
+    LOG4WARN(pL, "%d connections still pending", ring->uconns);
+  }
+
+  munmap(ring->sqes, ring->sqesz);
+  munmap(ring->ring, ring->ringsz);
+  close(ring->fd);
+  free(ring->rbuf);
+  free(ring->br);
+  free(ring->sbuf);
+  free(ring);
+  iface->data = NULL;
+}
+
+/**
+ *  @brief  submits, waits for and handles completions (mongoose interface
+ *          poll)
+ *
+ *  @arg    struct mg_iface*, int
+ *  @return time_t
+ */
+
+static time_t uring_poll(struct mg_iface *iface, int timeout_ms) {
+
+  s_uring_t *ring = (s_uring_t *)iface->data;
+  struct mg_connection *nc = NULL;
+  struct mg_connection *tmp = NULL;
+  s_uconn_t *uc = NULL;
+
+  double now = mg_time();
+  int wait;
+
+  /* no ring, all sockets are still in the connection list */
+  if (ring == NULL) {
+    return mg_socket_if_poll(iface, timeout_ms);
+  }
+
+  /* wake up for the next sweep at the latest */
+  wait = (int)((ring->sweep - now) * 1000) + 1;
+  if (wait > timeout_ms) {
+    wait = timeout_ms;
+  }
+  if (wait < 0) {
+    wait = 0;
+  }
+
+  submit(ring, wait);
+  now = mg_time();
+  reap(ring, now);
+
+  if (now >= ring->sweep) {
+    for (nc = iface->mgr->active_connections; nc != NULL; nc = tmp) {
+      tmp = nc->next;
+      /* closes flagged connections, timers and MG_EV_POLL */
+      if (!mg_if_poll(nc, now)) {
+        continue;
+      }
+      uc = (s_uconn_t *)nc->mgr_data;
+      if (uc != NULL) {
+        if (uc->listener) {
+          accept_queued(ring, uc, now);
+        }
+        if (!(nc->flags & (MG_F_CLOSE_IMMEDIATELY | MG_F_SEND_AND_CLOSE))) {
+          arm_conn(ring, uc);
+        }
+        flush_conn(ring, uc, now);
+      }
+    }
+    ring->sweep = now + NETIF_SWEEP_MS / 1e3;
+  }
+
+  return (time_t)now;
+}
+
+/**
+ *  @brief  the io_uring mongoose interface (NULL: not supported by the
+ *          kernel)
+ *
+ *  @arg    void
+ *  @return const struct mg_iface_vtable*
+ */
+
+const struct mg_iface_vtable *uring_iface(void) {
+
+  if (!uring_probe()) {
+    return NULL;
+  }
+
+  uring_vtable = mg_socket_iface_vtable;
+  uring_vtable.init = uring_init;
+  uring_vtable.free = uring_free;
+  uring_vtable.add_conn = uring_add_conn;
+  uring_vtable.poll = uring_poll;
+  uring_vtable.tcp_send = uring_tcp_send;
+  uring_vtable.tcp_recv = uring_tcp_recv;
+  uring_vtable.destroy_conn = uring_destroy_conn;
+  uring_vtable.sock_set = uring_sock_set;
+
+  return &uring_vtable;
+}
+
+#else
+
+/**
+ *  @brief  the io_uring mongoose interface, not built (kernel headers
+ *          before 6.1)
+ *
+ *  @arg    void
+ *  @return const struct mg_iface_vtable*
+ */
+
+const struct mg_iface_vtable *uring_iface(void) {
+
+  LOG4WARN(pL, "io_uring backend not built, kernel headers before 6.1");
+
+  return NULL;
+}
+
+#endif // URING_SUPPORTED
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2020  <Wolfgang Kampichler>
+ *
+ * This file is part of rngin
+ *
+ * rngin is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rngin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ *  @file    uring.h
+ *  @author  Wolfgang Kampichler (DEC112 2.0)
+ *  @date    04-2020
+ *  @version 1.0
+ *
+ *  @brief io_uring event loop backend header file
+ */
+
+#ifndef URING_H_INCLUDED
+#define URING_H_INCLUDED
+
+/******************************************************************* INCLUDE */
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#include <stdbool.h>
+#include <stddef.h>
+
+/******************************************************************** DEFINE */
+
+/* the backend is built against the uapi headers of kernel 6.1 or later,
+   otherwise uring_iface() returns NULL and rngin uses epoll */
+#ifdef IORING_SETUP_DEFER_TASKRUN
+#define URING_SUPPORTED 1
+#endif
+
+/* submission queue entries (completion queue: 4 times) */
+#define URING_ENTRIES 1024
+
+/* provided receive buffers (power of two) */
+#define URING_RBUFS 1024
+#define URING_RBUFSIZE 4096
+#define URING_BGID 0
+
+/* registered send buffers, a send without a free one uses the heap */
+#define URING_SBUFS 256
+#define URING_SBUFSIZE 16384
+
+/* operation, low bits of the completion user_data */
+#define URING_ACCEPT 1
+#define URING_RECV 2
+#define URING_SEND 3
+#define URING_OPMASK 3
+
+/******************************************************************* TYPEDEF */
+
+typedef struct UCONN {
+  /* NULL once the connection is closed, freed with the last operation */
+  struct mg_connection *nc;
+  int fd;
+  bool listener;
+  /* operations in flight */
+  int pending;
+  /* multishot accept or receive armed */
+  bool armed;
+  bool sending;
+  /* registered send buffer (-1: heap buffer) */
+  int slot;
+  char *heap;
+} s_uconn_t;
+
+typedef struct URING {
+  int fd;
+  void *ring;
+  size_t ringsz;
+  /* submission queue */
+  unsigned *sqhead;
+  unsigned *sqtail;
+  unsigned sqmask;
+  unsigned sqentries;
+  unsigned sqlocal;
+  struct io_uring_sqe *sqes;
+  size_t sqesz;
+  /* completion queue */
+  unsigned *cqhead;
+  unsigned *cqtail;
+  unsigned cqmask;
+  struct io_uring_cqe *cqes;
+  /* provided receive buffers */
+  struct io_uring_buf_ring *br;
+  unsigned short brtail;
+  char *rbuf;
+  /* registered send buffers and free list */
+  char *sbuf;
+  bool fixed;
+  int sfree[URING_SBUFS];
+  int nfree;
+  /* connections not yet freed */
+  int uconns;
+  /* next sweep (mg_time) */
+  double sweep;
+} s_uring_t;
+
+/****************************************************************PROTOTYPES */
+
+struct mg_iface_vtable;
+
+const struct mg_iface_vtable *uring_iface(void);
+
+#endif // URING_H_INCLUDED